@@ -0,0 +1,1296 @@
+
+#include <assert.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "util.h"
+#include "tinyoslib.h"
+#include "unit_testing.h"
+
+
+/*
+	Benchmarks for the kernel API.
+
+	The benchmarks are written as boot tests, so that they can be run
+	with the unit testing library, on any number of cores, e.g.,
+	@verbatim
+	$ ./bench_api -c 1,2,4 bench_pipe_throughput
+	@endverbatim
+	Each benchmark reports its measurements with @c MSG. A benchmark
+	only fails if the kernel misbehaves, never because it is slow.
+ */
+
+
+/* Wall-clock time in seconds */
+static double wtime()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + 1E-9 * t.tv_nsec;
+}
+
+#define KiB  (1024)
+#define MiB  (1024*1024)
+
+
+
+/*********************************************
+ *
+ *  Pipe benchmarks
+ *
+ *********************************************/
+
+/* Arguments to a streaming thread */
+struct stream_args {
+	Fid_t fid;				/* The stream to read or write */
+	unsigned int chunk;		/* The size of each Read or Write call */
+	unsigned long total;	/* The number of bytes to transfer */
+};
+
+/* Write args->total bytes to args->fid, in calls of args->chunk bytes, then close it */
+static int stream_writer(int argl, void* args)
+{
+	struct stream_args* A = args;
+	char* buffer = xmalloc(A->chunk);
+	memset(buffer, 'x', A->chunk);
+
+	unsigned long sent = 0;
+	while(sent < A->total) {
+		unsigned long n = A->total - sent;
+		int rc = Write(A->fid, buffer, (n < A->chunk) ? n : A->chunk);
+		assert(rc > 0);
+		sent += rc;
+	}
+
+	free(buffer);
+	Close(A->fid);
+	return 0;
+}
+
+/* Read from args->fid until EOF, in calls of args->chunk bytes. Return the bytes read. */
+static unsigned long stream_reader(struct stream_args* A)
+{
+	char* buffer = xmalloc(A->chunk);
+	unsigned long count = 0;
+	int rc;
+	while((rc = Read(A->fid, buffer, A->chunk)) > 0)
+		count += rc;
+	free(buffer);
+	return count;
+}
+
+
+BOOT_TEST(bench_pipe_throughput,
+	"Measure the throughput (MB/s) of a pipe between two threads, for write sizes from 1 to 64 KiB.",
+	.timeout = 120
+	)
+{
+	const unsigned long total = 64*MiB;
+
+	for(unsigned int chunk = 1*KiB; chunk <= 64*KiB; chunk *= 2) {
+		pipe_t pipe;
+		ASSERT(Pipe(&pipe)==0);
+
+		struct stream_args W = { pipe.write, chunk, total };
+		struct stream_args R = { pipe.read, chunk, total };
+
+		double t0 = wtime();
+		Tid_t t = CreateThread(stream_writer, sizeof(W), &W);
+		ASSERT(t != NOTHREAD);
+		unsigned long count = stream_reader(&R);
+		double t1 = wtime();
+		ThreadJoin(t, NULL);
+		Close(pipe.read);
+
+		ASSERT(count == total);
+		MSG("write size %5u KiB: %8.1f MB/s\n", chunk/KiB, total / (t1-t0) / MiB);
+	}
+	return 0;
+}
+
+
+BOOT_TEST(bench_pipe_buffer_size,
+	"Measure the throughput (MB/s) of a pipe created by PipeEx, for buffer sizes from 4 KiB to 4 MiB.",
+	.timeout = 120
+	)
+{
+	const unsigned long total = 256*MiB;
+
+	for(unsigned int size = 4*KiB; size <= PIPE_MAX_SIZE; size *= 4) {
+		pipe_t pipe;
+		ASSERT(PipeEx(&pipe, size, 0)==0);
+
+		struct stream_args W = { pipe.write, 256*KiB, total };
+		struct stream_args R = { pipe.read, 256*KiB, total };
+
+		double t0 = wtime();
+		Tid_t t = CreateThread(stream_writer, sizeof(W), &W);
+		ASSERT(t != NOTHREAD);
+		unsigned long count = stream_reader(&R);
+		double t1 = wtime();
+		ThreadJoin(t, NULL);
+		Close(pipe.read);
+
+		ASSERT(count == total);
+		MSG("buffer size %5u KiB: %8.1f MB/s\n", size/KiB, total / (t1-t0) / MiB);
+	}
+	return 0;
+}
+
+
+/* Arguments to a relay thread */
+struct relay_args {
+	Fid_t in, out;			/* Relay from in to out, then close out */
+	unsigned int chunk;		/* The size of each transfer */
+	int splice;				/* Use Splice, instead of Read and Write */
+};
+
+static int relay(int argl, void* args)
+{
+	struct relay_args* A = args;
+	char* buffer = xmalloc(A->chunk);
+
+	int rc;
+	if(A->splice)
+		while((rc = Splice(A->in, A->out, A->chunk, 0)) > 0);
+	else
+		while((rc = Read(A->in, buffer, A->chunk)) > 0) {
+			for(int w = 0; w < rc; ) {
+				int n = Write(A->out, buffer + w, rc - w);
+				assert(n > 0);
+				w += n;
+			}
+		}
+
+	free(buffer);
+	Close(A->out);
+	return 0;
+}
+
+
+BOOT_TEST(bench_pipe_relay,
+	"Measure the throughput (MB/s) of a thread relaying between two pipes, by Read/Write and by Splice.",
+	.timeout = 120
+	)
+{
+	const unsigned long total = 256*MiB;
+	const char* method[] = { "Read/Write", "Splice" };
+
+	for(int splice = 0; splice <= 1; splice++) {
+		for(unsigned int chunk = 4*KiB; chunk <= 64*KiB; chunk *= 4) {
+			pipe_t p1, p2;
+			ASSERT(PipeEx(&p1, 64*KiB, 0)==0);
+			ASSERT(PipeEx(&p2, 64*KiB, 0)==0);
+
+			struct stream_args W = { p1.write, chunk, total };
+			struct relay_args X = { p1.read, p2.write, chunk, splice };
+			struct stream_args R = { p2.read, chunk, total };
+
+			double t0 = wtime();
+			Tid_t tw = CreateThread(stream_writer, sizeof(W), &W);
+			Tid_t tx = CreateThread(relay, sizeof(X), &X);
+			ASSERT(tw != NOTHREAD && tx != NOTHREAD);
+			unsigned long count = stream_reader(&R);
+			double t1 = wtime();
+			ThreadJoin(tw, NULL);
+			ThreadJoin(tx, NULL);
+			Close(p1.read);
+			Close(p2.read);
+
+			ASSERT(count == total);
+			MSG("%-10s %5u KiB: %8.1f MB/s\n", method[splice], chunk/KiB, total / (t1-t0) / MiB);
+		}
+	}
+	return 0;
+}
+
+
+BOOT_TEST(bench_pipe_zero_copy,
+	"Measure the throughput (MB/s) of a segmented pipe read by ReadZC, against Read on a ring pipe and a segmented pipe.",
+	.timeout = 120
+	)
+{
+	const unsigned long total = 256*MiB;
+	const char* method[] = { "ring, Read", "segmented, Read", "segmented, ReadZC" };
+
+	for(int m = 0; m < 3; m++) {
+		for(unsigned int chunk = 4*KiB; chunk <= 64*KiB; chunk *= 4) {
+			pipe_t pipe;
+			ASSERT(PipeEx(&pipe, 256*KiB, (m > 0) ? PIPE_SEGMENTED : 0)==0);
+
+			struct stream_args W = { pipe.write, chunk, total };
+			struct stream_args R = { pipe.read, chunk, total };
+
+			double t0 = wtime();
+			Tid_t t = CreateThread(stream_writer, sizeof(W), &W);
+			ASSERT(t != NOTHREAD);
+			unsigned long count = 0;
+			if(m < 2)
+				count = stream_reader(&R);
+			else {
+				const char* data;
+				int rc;
+				while((rc = ReadZC(pipe.read, &data, chunk)) > 0) {
+					count += rc;
+					ReleaseZC(pipe.read, data);
+				}
+			}
+			double t1 = wtime();
+			ThreadJoin(t, NULL);
+			Close(pipe.read);
+
+			ASSERT(count == total);
+			MSG("%-18s %5u KiB: %8.1f MB/s\n", method[m], chunk/KiB, total / (t1-t0) / MiB);
+		}
+	}
+	return 0;
+}
+
+
+TEST_SUITE(pipe_benchmarks,
+	"Benchmarks for pipes."
+	)
+{
+	&bench_pipe_throughput,
+	&bench_pipe_buffer_size,
+	&bench_pipe_relay,
+	&bench_pipe_zero_copy,
+	NULL
+};
+
+
+
+/*********************************************
+ *
+ *  Socket benchmarks
+ *
+ *********************************************/
+
+struct connector_args {
+	Fid_t sock;
+	port_t port;
+};
+
+static int connector(int argl, void* args)
+{
+	struct connector_args* A = args;
+	return Connect(A->sock, A->port, 1000);
+}
+
+/* Connect a new socket to lsock, which is listening on port. Return both ends. */
+static void connect_pair(Fid_t lsock, port_t port, Fid_t* cli, Fid_t* srv)
+{
+	struct connector_args A = { Socket(NOPORT), port };
+	assert(A.sock != NOFILE);
+
+	Tid_t t = CreateThread(connector, sizeof(A), &A);
+	*srv = Accept(lsock);
+	int rc;
+	ThreadJoin(t, &rc);
+	assert(rc == 0 && *srv != NOFILE);
+	*cli = A.sock;
+}
+
+
+/* I/O calls with the signature of ReadV and WriteV, which transfer one buffer by Read and Write */
+static int read1(Fid_t fd, const iovec_t* iov, int iovcnt) { return Read(fd, iov->base, iov->len); }
+static int write1(Fid_t fd, const iovec_t* iov, int iovcnt) { return Write(fd, iov->base, iov->len); }
+
+typedef int (*iov_call)(Fid_t, const iovec_t*, int);
+
+/* Transfer all the bytes of the buffers, calling op as many times as needed. Return the number of calls. */
+static unsigned int transfer_all(iov_call op, Fid_t fd, iovec_t* iov, int iovcnt)
+{
+	unsigned int calls = 0;
+	while(iovcnt > 0) {
+		int rc = op(fd, iov, iovcnt);
+		calls++;
+		assert(rc > 0);
+
+		/* Skip the buffers that are done, and advance into the next one */
+		while(iovcnt > 0 && (unsigned int) rc >= iov->len) {
+			rc -= iov->len;
+			iov++;
+			iovcnt--;
+		}
+		if(iovcnt > 0) {
+			iov->base = (char*) iov->base + rc;
+			iov->len -= rc;
+		}
+	}
+	return calls;
+}
+
+/* A request (or reply) of the header+body benchmark */
+struct message_header {
+	unsigned int seq;
+	unsigned int length;
+};
+
+/* Arguments to the server of the header+body benchmark */
+struct hb_args {
+	Fid_t sock;
+	int vectored;			/* Use ReadV/WriteV, instead of Read/Write */
+	unsigned int body;		/* The size of a request body */
+	unsigned int count;		/* The number of requests */
+	unsigned long calls;	/* Output: the I/O calls made by the server */
+};
+
+/* Send a header and a body, by one WriteV or by two Write calls */
+static unsigned int send_hb(Fid_t sock, int vectored, struct message_header* h, char* body)
+{
+	iovec_t iov[2] = { { h, sizeof(*h) }, { body, h->length } };
+	if(vectored)
+		return transfer_all(WriteV, sock, iov, (h->length > 0) ? 2 : 1);
+	unsigned int calls = transfer_all(write1, sock, &iov[0], 1);
+	if(h->length > 0)
+		calls += transfer_all(write1, sock, &iov[1], 1);
+	return calls;
+}
+
+/* Receive a header and a body of known size, by ReadV or by two Read calls */
+static unsigned int recv_hb(Fid_t sock, int vectored, struct message_header* h, char* body, unsigned int size)
+{
+	iovec_t iov[2] = { { h, sizeof(*h) }, { body, size } };
+	if(vectored)
+		return transfer_all(ReadV, sock, iov, (size > 0) ? 2 : 1);
+	unsigned int calls = transfer_all(read1, sock, &iov[0], 1);
+	if(size > 0)
+		calls += transfer_all(read1, sock, &iov[1], 1);
+	return calls;
+}
+
+/* Answer each request with a reply header */
+static int hb_server(int argl, void* args)
+{
+	struct hb_args* A = args;
+	char* body = xmalloc(A->body);
+
+	for(unsigned int i = 0; i < A->count; i++) {
+		struct message_header h;
+		A->calls += recv_hb(A->sock, A->vectored, &h, body, A->body);
+		assert(h.seq == i && h.length == A->body);
+		h.length = 0;
+		A->calls += send_hb(A->sock, A->vectored, &h, NULL);
+	}
+
+	free(body);
+	return 0;
+}
+
+
+BOOT_TEST(bench_socket_header_body,
+	"Measure the round-trip time of requests with a header and a body over a socket, sent by Read/Write or by ReadV/WriteV.",
+	.timeout = 120
+	)
+{
+	const unsigned int count = 20000;
+	const char* method[] = { "Read/Write", "ReadV/WriteV" };
+
+	Fid_t lsock = Socket(100);
+	ASSERT(Listen(lsock)==0);
+
+	for(int vectored = 0; vectored <= 1; vectored++) {
+		for(unsigned int body = 64; body <= 16*KiB; body *= 16) {
+			Fid_t cli, srv;
+			connect_pair(lsock, 100, &cli, &srv);
+
+			char* buffer = xmalloc(body);
+			memset(buffer, 'x', body);
+			struct hb_args S = { srv, vectored, body, count, 0 };
+			unsigned long calls = 0;
+
+			double t0 = wtime();
+			Tid_t t = CreateThread(hb_server, sizeof(S), &S);
+			ASSERT(t != NOTHREAD);
+			for(unsigned int i = 0; i < count; i++) {
+				struct message_header h = { i, body };
+				calls += send_hb(cli, vectored, &h, buffer);
+				calls += recv_hb(cli, vectored, &h, NULL, 0);
+				ASSERT(h.seq == i);
+			}
+			double t1 = wtime();
+			ThreadJoin(t, NULL);
+
+			free(buffer);
+			Close(cli);
+			Close(srv);
+
+			MSG("%-12s body %5u bytes: %6.2f usec/round trip, %4.2f I/O calls/round trip\n", 
+				method[vectored], body, (t1-t0) * 1E6 / count, (double)(calls + S.calls) / count);
+		}
+	}
+
+	Close(lsock);
+	return 0;
+}
+
+
+BOOT_TEST(bench_stream_cross_core,
+	"Measure the throughput (MB/s) of small writes between two threads, over a pipe (which is read and written without the kernel lock) and over a socket.",
+	.minimum_cores = 2, .timeout = 120
+	)
+{
+	const unsigned long total = 16*MiB;
+
+	Fid_t lsock = Socket(101);
+	ASSERT(Listen(lsock)==0);
+
+	for(unsigned int chunk = 64; chunk <= 4*KiB; chunk *= 4) {
+		Fid_t fid[2][2];
+		pipe_t pipe;
+		ASSERT(Pipe(&pipe)==0);
+		fid[0][0] = pipe.read;
+		fid[0][1] = pipe.write;
+		connect_pair(lsock, 101, &fid[1][1], &fid[1][0]);
+
+		double mbs[2];
+		for(int i = 0; i < 2; i++) {
+			struct stream_args W = { fid[i][1], chunk, total };
+			struct stream_args R = { fid[i][0], chunk, total };
+
+			double t0 = wtime();
+			Tid_t t = CreateThread(stream_writer, sizeof(W), &W);
+			ASSERT(t != NOTHREAD);
+			unsigned long count = stream_reader(&R);
+			double t1 = wtime();
+			ThreadJoin(t, NULL);
+			Close(fid[i][0]);
+
+			ASSERT(count == total);
+			mbs[i] = total / (t1-t0) / MiB;
+		}
+		MSG("write size %4u bytes: pipe %8.1f MB/s, socket %8.1f MB/s\n", chunk, mbs[0], mbs[1]);
+	}
+	return 0;
+}
+
+
+/* Arguments to an echo thread */
+struct echo_args {
+	Fid_t in, out;			/* Read requests from 'in', and write the replies to 'out' */
+	unsigned int size;		/* The size of a message */
+};
+
+/* Write back each message read, until EOF */
+static int echo_server(int argl, void* args)
+{
+	struct echo_args* A = args;
+	char buf[A->size];
+
+	/* The first byte is read alone, to see the EOF */
+	while(Read(A->in, buf, 1) == 1) {
+		iovec_t iov = { buf+1, A->size-1 };
+		transfer_all(read1, A->in, &iov, 1);
+		iov = (iovec_t) { buf, A->size };
+		transfer_all(write1, A->out, &iov, 1);
+	}
+	return 0;
+}
+
+static int compare_doubles(const void* a, const void* b)
+{
+	double x = *(const double*) a, y = *(const double*) b;
+	return (x > y) - (x < y);
+}
+
+
+BOOT_TEST(bench_stream_latency,
+	"Measure the round-trip time (p50 and p99) of 64-byte request/response messages to an echo thread, over a pair of pipes and over a socket.",
+	.timeout = 120
+	)
+{
+	const unsigned int count = 20000, size = 64;
+	double* rtt = xmalloc(count * sizeof(double));
+
+	Fid_t lsock = Socket(105);
+	ASSERT(Listen(lsock)==0);
+
+	for(int i = 0; i < 2; i++) {
+		Fid_t cin, cout;
+		struct echo_args E = { NOFILE, NOFILE, size };
+		if(i == 0) {
+			pipe_t p1, p2;
+			ASSERT(Pipe(&p1)==0 && Pipe(&p2)==0);
+			cout = p1.write; E.in = p1.read;
+			E.out = p2.write; cin = p2.read;
+		} else {
+			connect_pair(lsock, 105, &cin, &E.in);
+			cout = cin; E.out = E.in;
+		}
+		Tid_t t = CreateThread(echo_server, sizeof(E), &E);
+		ASSERT(t != NOTHREAD);
+
+		char buf[size];
+		memset(buf, 'x', size);
+		for(unsigned int k = 0; k < count; k++) {
+			double t0 = wtime();
+			iovec_t iov = { buf, size };
+			transfer_all(write1, cout, &iov, 1);
+			iov = (iovec_t) { buf, size };
+			transfer_all(read1, cin, &iov, 1);
+			rtt[k] = wtime() - t0;
+		}
+
+		Close(cout);
+		ThreadJoin(t, NULL);
+		if(i == 0) {
+			Close(cin);
+			Close(E.in);
+			Close(E.out);
+		} else
+			Close(E.in);
+
+		qsort(rtt, count, sizeof(double), compare_doubles);
+		MSG("%-6s: p50 %6.2f usec, p99 %6.2f usec round trip\n", (i == 0) ? "pipes" : "socket",
+			rtt[count/2] * 1E6, rtt[count*99/100] * 1E6);
+	}
+
+	free(rtt);
+	Close(lsock);
+	return 0;
+}
+
+
+BOOT_TEST(bench_socket_rcvlowat,
+	"Measure the throughput (MB/s) of 64-byte writes over a socket, and the bytes returned by each Read, for several values of SOCKOPT_RCVLOWAT.",
+	.timeout = 120
+	)
+{
+	const unsigned long total = 16*MiB;
+
+	Fid_t lsock = Socket(106);
+	ASSERT(Listen(lsock)==0);
+
+	for(unsigned int lowat = 1; lowat <= 4*KiB; lowat *= 64) {
+		Fid_t cli, srv;
+		connect_pair(lsock, 106, &cli, &srv);
+		ASSERT(SetSockOpt(srv, SOCKOPT_RCVLOWAT, lowat)==0);
+
+		struct stream_args W = { cli, 64, total };
+		char* buffer = xmalloc(16*KiB);
+		unsigned long count = 0, reads = 0;
+		int rc;
+
+		double t0 = wtime();
+		Tid_t t = CreateThread(stream_writer, sizeof(W), &W);
+		ASSERT(t != NOTHREAD);
+		while((rc = Read(srv, buffer, 16*KiB)) > 0) {
+			count += rc;
+			reads++;
+		}
+		double t1 = wtime();
+		ThreadJoin(t, NULL);
+
+		ASSERT(count == total);
+		free(buffer);
+		Close(srv);
+		MSG("low-water mark %4u bytes: %8.1f MB/s, %7.1f bytes/Read\n", lowat, total / (t1-t0) / MiB, (double) count / reads);
+	}
+
+	Close(lsock);
+	return 0;
+}
+
+
+BOOT_TEST(bench_socket_cork,
+	"Measure the throughput (MB/s) of 64-byte writes over a socket, and the times the reader blocks per MB, for several values of SOCKOPT_CORK.",
+	.minimum_cores = 2, .timeout = 120
+	)
+{
+	const unsigned long total = 16*MiB;
+
+	Fid_t lsock = Socket(107);
+	ASSERT(Listen(lsock)==0);
+
+	for(unsigned int cork = 0; cork <= 4*KiB; cork = (cork == 0) ? 256 : cork*4) {
+		Fid_t cli, srv;
+		connect_pair(lsock, 107, &cli, &srv);
+		ASSERT(SetSockOpt(cli, SOCKOPT_CORK, cork)==0);
+
+		struct stream_args W = { cli, 64, total };
+		struct stream_args R = { srv, 16*KiB, total };
+
+		double t0 = wtime();
+		Tid_t t = CreateThread(stream_writer, sizeof(W), &W);
+		ASSERT(t != NOTHREAD);
+		unsigned long count = stream_reader(&R);
+		double t1 = wtime();
+		ThreadJoin(t, NULL);
+		ASSERT(count == total);
+
+		unsigned int wakeups;
+		ASSERT(GetSockOpt(srv, SOCKOPT_RCVWAKEUPS, &wakeups)==0);
+		Close(srv);
+		MSG("cork %4u bytes: %8.1f MB/s, %8.1f reader wakeups/MB\n", cork, total / (t1-t0) / MiB, (double) wakeups * MiB / total);
+	}
+
+	Close(lsock);
+	return 0;
+}
+
+
+BOOT_TEST(bench_socket_churn,
+	"Measure the rate of short-lived socket connections (connect, accept, one exchange, close), and report the kernel object pools.",
+	.timeout = 120
+	)
+{
+	const unsigned int count = 20000;
+
+	Fid_t lsock = Socket(102);
+	ASSERT(Listen(lsock)==0);
+
+	double t0 = wtime();
+	for(unsigned int i = 0; i < count; i++) {
+		Fid_t cli, srv;
+		connect_pair(lsock, 102, &cli, &srv);
+
+		char c = 'x';
+		ASSERT(Write(cli, &c, 1)==1 && Read(srv, &c, 1)==1);
+		Close(cli);
+		Close(srv);
+	}
+	double t1 = wtime();
+	Close(lsock);
+
+	MSG("%u connections: %8.0f connections/sec\n", count, count / (t1-t0));
+
+	pool_stats ps;
+	for(unsigned int i = 0; PoolStats(i, &ps)==0; i++)
+		MSG("pool %-20s size %5u: allocs %7lu, peak %3u, in use %3u, slabs %u\n",
+			ps.name, ps.object_size, ps.allocs, ps.peak, ps.in_use, ps.slabs);
+	return 0;
+}
+
+
+/* Accept connections on lsock 'argl' and close them, until the listener is closed */
+static int acceptor(int argl, void* args)
+{
+	Fid_t sock;
+	while((sock = Accept(argl)) != NOFILE)
+		Close(sock);
+	return 0;
+}
+
+
+BOOT_TEST(bench_socket_acceptors,
+	"Measure the connection rate to a port served by many threads in Accept, on one listener or on four listeners sharing the port (SOCKOPT_REUSEPORT).",
+	.timeout = 120
+	)
+{
+	const unsigned int count = 10000;
+
+	for(unsigned int listeners = 1; listeners <= 4; listeners *= 4) {
+		for(unsigned int threads = 4; threads <= 64; threads *= 4) {
+			Fid_t lsock[4];
+			for(unsigned int i = 0; i < listeners; i++) {
+				lsock[i] = Socket(103);
+				ASSERT(SetSockOpt(lsock[i], SOCKOPT_REUSEPORT, 1)==0);
+				ASSERT(Listen(lsock[i])==0);
+			}
+			Tid_t tid[64];
+			for(unsigned int i = 0; i < threads; i++)
+				tid[i] = CreateThread(acceptor, lsock[i % listeners], NULL);
+
+			double t0 = wtime();
+			for(unsigned int i = 0; i < count; i++) {
+				Fid_t sock = Socket(NOPORT);
+				ASSERT(Connect(sock, 103, 1000)==0);
+				Close(sock);
+			}
+			double t1 = wtime();
+
+			for(unsigned int i = 0; i < listeners; i++)
+				Close(lsock[i]);
+			for(unsigned int i = 0; i < threads; i++)
+				ThreadJoin(tid[i], NULL);
+
+			MSG("%u listener(s), %2u acceptors: %8.0f connections/sec\n", listeners, threads, count / (t1-t0));
+		}
+	}
+	return 0;
+}
+
+
+/* Accept connections on lsock 'argl' in batches and close them, until the listener is closed */
+static int batch_acceptor(int argl, void* args)
+{
+	Fid_t socks[8];
+	int n;
+	while((n = AcceptBatch(argl, socks, 8, 0)) != NOFILE)
+		for(int i = 0; i < n; i++)
+			Close(socks[i]);
+	return 0;
+}
+
+/* Make 'argl' connections to port 104, and return the number of those refused */
+static int burst_client(int argl, void* args)
+{
+	int refused = 0;
+	for(int i = 0; i < argl; i++) {
+		Fid_t sock = Socket(NOPORT);
+		if(Connect(sock, 104, 1000) != 0)
+			refused++;
+		Close(sock);
+	}
+	return refused;
+}
+
+
+BOOT_TEST(bench_socket_burst,
+	"Measure the connection rate of bursts of clients to one acceptor thread, with Accept or AcceptBatch, and the requests refused by a short backlog.",
+	.timeout = 120
+	)
+{
+	const int clients = 6, count = 2000;
+	struct { const char* name; Task server; unsigned int backlog; } conf[] = {
+		{ "Accept",      acceptor,       LISTEN_BACKLOG },
+		{ "AcceptBatch", batch_acceptor, LISTEN_BACKLOG },
+		{ "AcceptBatch", batch_acceptor, 2 }
+	};
+
+	for(unsigned int c = 0; c < sizeof(conf)/sizeof(conf[0]); c++) {
+		Fid_t lsock = Socket(104);
+		ASSERT(ListenEx(lsock, conf[c].backlog)==0);
+		Tid_t server = CreateThread(conf[c].server, lsock, NULL);
+
+		double t0 = wtime();
+		Tid_t tid[clients];
+		for(int i = 0; i < clients; i++)
+			tid[i] = CreateThread(burst_client, count, NULL);
+		int refused = 0;
+		for(int i = 0; i < clients; i++) {
+			int r;
+			ThreadJoin(tid[i], &r);
+			refused += r;
+		}
+		double t1 = wtime();
+
+		listen_stats ls;
+		ASSERT(ListenStats(lsock, &ls)==0);
+		ASSERT(ls.rejected == (unsigned long) refused);
+		Close(lsock);
+		ThreadJoin(server, NULL);
+
+		MSG("%-11s backlog %3u: %8.0f connections/sec, peak queue %u, %d refused\n", 
+			conf[c].name, conf[c].backlog, (clients*count - refused) / (t1-t0), ls.peak, refused);
+	}
+	return 0;
+}
+
+
+/* Receive connections on the control socket A->in, and serve each one as an echo server, until the supervisor shuts it down */
+static int handoff_worker(int argl, void* args)
+{
+	struct echo_args* A = args;
+	Fid_t sock;
+	while((sock = RecvFid(A->in)) != NOFILE) {
+		struct echo_args E = { sock, sock, A->size };
+		echo_server(0, &E);
+		Close(sock);
+	}
+	return 0;
+}
+
+struct handoff_client_args {
+	unsigned int count;		/* connections to make */
+	unsigned int size;		/* the size of the request */
+};
+
+/* Make connections to port 108, each sending one request and reading back the reply */
+static int handoff_client(int argl, void* args)
+{
+	struct handoff_client_args* A = args;
+	char buf[A->size];
+	memset(buf, 'x', A->size);
+	for(unsigned int i = 0; i < A->count; i++) {
+		Fid_t sock = Socket(NOPORT);
+		ASSERT(Connect(sock, 108, 1000)==0);
+		iovec_t iov = { buf, A->size };
+		transfer_all(write1, sock, &iov, 1);
+		iov = (iovec_t) { buf, A->size };
+		transfer_all(read1, sock, &iov, 1);
+		Close(sock);
+	}
+	return 0;
+}
+
+
+BOOT_TEST(bench_socket_handoff,
+	"Measure the rate of connections served by a pool of worker processes, when the acceptor passes each connection to a worker with SendFid, and when it proxies the bytes to the worker.",
+	.timeout = 120
+	)
+{
+	const unsigned int count = 5000, workers = 4;
+	const unsigned int size = 1*KiB;
+
+	for(int handoff = 1; handoff >= 0; handoff--) {
+		Fid_t lsock = Socket(108);
+		ASSERT(Listen(lsock)==0);
+
+		/* The control connections to the workers */
+		Fid_t ctl[workers], wctl[workers];
+		Pid_t pid[workers];
+		for(unsigned int i = 0; i < workers; i++)
+			connect_pair(lsock, 108, &ctl[i], &wctl[i]);
+		for(unsigned int i = 0; i < workers; i++) {
+			struct echo_args E = { wctl[i], wctl[i], size };
+			pid[i] = Exec(handoff ? handoff_worker : echo_server, sizeof(E), &E);
+			ASSERT(pid[i] != NOPROC);
+		}
+
+		struct handoff_client_args C = { count, size };
+		double t0 = wtime();
+		Tid_t t = CreateThread(handoff_client, sizeof(C), &C);
+		char buf[size];
+		for(unsigned int i = 0; i < count; i++) {
+			Fid_t sock = Accept(lsock);
+			ASSERT(sock != NOFILE);
+			if(handoff)
+				ASSERT(SendFid(ctl[i % workers], sock)==0);
+			else {
+				iovec_t iov = { buf, size };
+				transfer_all(read1, sock, &iov, 1);
+				iov = (iovec_t) { buf, size };
+				transfer_all(write1, ctl[i % workers], &iov, 1);
+				iov = (iovec_t) { buf, size };
+				transfer_all(read1, ctl[i % workers], &iov, 1);
+				iov = (iovec_t) { buf, size };
+				transfer_all(write1, sock, &iov, 1);
+			}
+			Close(sock);
+		}
+		ThreadJoin(t, NULL);
+		double t1 = wtime();
+
+		for(unsigned int i = 0; i < workers; i++) {
+			ShutDown(ctl[i], SHUTDOWN_WRITE);
+			WaitChild(pid[i], NULL);
+			Close(ctl[i]);
+			Close(wctl[i]);
+		}
+		Close(lsock);
+
+		MSG("%s: %8.0f connections/sec\n", handoff ? "SendFid handoff" : "proxied bytes  ", count / (t1-t0));
+	}
+	return 0;
+}
+
+
+TEST_SUITE(socket_benchmarks,
+	"Benchmarks for sockets."
+	)
+{
+	&bench_socket_header_body,
+	&bench_stream_cross_core,
+	&bench_stream_latency,
+	&bench_socket_rcvlowat,
+	&bench_socket_cork,
+	&bench_socket_churn,
+	&bench_socket_acceptors,
+	&bench_socket_burst,
+	&bench_socket_handoff,
+	NULL
+};
+
+
+
+/*********************************************
+ *
+ *  File table benchmarks
+ *
+ *********************************************/
+
+
+BOOT_TEST(bench_fid_alloc,
+	"Measure the time to close and reopen a file id, when the lowest free fid is the last one of a full file table, for several table sizes.",
+	.timeout = 120
+	)
+{
+	const unsigned int count = 200000;
+
+	for(unsigned int limit = MAX_FILEID; limit <= MAX_FILE_LIMIT; limit *= 4) {
+		ASSERT(SetFileLimit(limit)==0);
+		Fid_t last = NOFILE, fid;
+		while((fid = OpenNull()) != NOFILE)
+			last = fid;
+		ASSERT(last == (Fid_t) limit-1);
+
+		double t0 = wtime();
+		for(unsigned int i = 0; i < count; i++) {
+			Close(last);
+			ASSERT(OpenNull()==last);
+		}
+		double t1 = wtime();
+
+		for(Fid_t f = 0; f < (Fid_t) limit; f++)
+			Close(f);
+		MSG("%4u fids: %6.0f nsec per Close and OpenNull\n", limit, 1E9 * (t1-t0) / count);
+	}
+	return 0;
+}
+
+
+/* Open and close a stream 'argl' times */
+static int open_close(int argl, void* args)
+{
+	for(int i = 0; i < argl; i++) {
+		Fid_t fid = OpenNull();
+		ASSERT(fid != NOFILE);
+		Close(fid);
+	}
+	return 0;
+}
+
+
+BOOT_TEST(bench_fcb_churn,
+	"Measure the rate of OpenNull and Close pairs, by 1 to 8 threads at once.",
+	.timeout = 120
+	)
+{
+	const int count = 400000;
+
+	for(int threads = 1; threads <= 8; threads *= 2) {
+		Tid_t tid[8];
+		double t0 = wtime();
+		for(int i = 0; i < threads; i++)
+			tid[i] = CreateThread(open_close, count / threads, NULL);
+		for(int i = 0; i < threads; i++)
+			ThreadJoin(tid[i], NULL);
+		double t1 = wtime();
+		MSG("%d threads: %6.0f nsec per OpenNull and Close\n", threads, 1E9 * (t1-t0) / count);
+	}
+	return 0;
+}
+
+
+/* Read 64 bytes 'argl' times from a null device stream of its own */
+static int null_reader(int argl, void* args)
+{
+	char buf[64];
+	Fid_t fid = OpenNull();
+	ASSERT(fid != NOFILE);
+	for(int i = 0; i < argl; i++)
+		Read(fid, buf, sizeof(buf));
+	Close(fid);
+	return 0;
+}
+
+
+BOOT_TEST(bench_null_read,
+	"Measure the rate of 64-byte reads from the null device, by 1 to 8 threads reading their own streams at once.",
+	.timeout = 120
+	)
+{
+	const int count = 1000000;
+
+	for(int threads = 1; threads <= 8; threads *= 2) {
+		Tid_t tid[8];
+		double t0 = wtime();
+		for(int i = 0; i < threads; i++)
+			tid[i] = CreateThread(null_reader, count / threads, NULL);
+		for(int i = 0; i < threads; i++)
+			ThreadJoin(tid[i], NULL);
+		double t1 = wtime();
+		MSG("%d threads: %6.2f million reads/sec\n", threads, count / (t1-t0) / 1E6);
+	}
+	return 0;
+}
+
+
+TEST_SUITE(file_benchmarks,
+	"Benchmarks for the file table and streams."
+	)
+{
+	&bench_fid_alloc,
+	&bench_fcb_churn,
+	&bench_null_read,
+	NULL
+};
+
+
+
+/*********************************************
+ *
+ *  Process benchmarks
+ *
+ *********************************************/
+
+
+static int exit_at_once(int argl, void* args)
+{
+	return 0;
+}
+
+
+BOOT_TEST(bench_exec_wait,
+	"Measure the rate of Exec and WaitChild pairs, for children that exit at once, with small and large arguments and several open files.",
+	.timeout = 120
+	)
+{
+	const int count = 50000;
+	char argbuf[256] = { 0 };
+
+	ASSERT(SetFileLimit(256)==0);
+	for(unsigned int files = 0; files <= 128; files += 128) {
+		for(unsigned int f = 0; f < files; f++)
+			ASSERT(OpenNull() != NOFILE);
+
+		for(int argl = 16; argl <= 256; argl *= 16) {
+			double t0 = wtime();
+			for(int i = 0; i < count; i++) {
+				Pid_t pid = Exec(exit_at_once, argl, argbuf);
+				ASSERT(pid != NOPROC);
+				WaitChild(pid, NULL);
+			}
+			double t1 = wtime();
+			MSG("%3u open files, %3d bytes of args: %6.0f processes/sec\n", files, argl, count / (t1-t0));
+		}
+
+		for(Fid_t f = 0; f < 256; f++)
+			Close(f);
+	}
+	return 0;
+}
+
+
+/* Copy fid 0 to fid 1, until end of file */
+static int pipeline_stage(int argl, void* args)
+{
+	char buf[256];
+	int n;
+	while((n = Read(0, buf, sizeof(buf))) > 0)
+		Write(1, buf, n);
+	return 0;
+}
+
+
+/* Start a pipeline of processes from fid 'in' to fid 'out', with Exec and Dup2 around it */
+static void exec_pipeline(int stages, Fid_t in, Fid_t out, Pid_t* pid)
+{
+	Fid_t savein = OpenNull(), saveout = OpenNull();
+	Dup2(0, savein);
+	Dup2(1, saveout);
+	Dup2(in, 0);
+	Close(in);
+	for(int i = 0; i < stages; i++) {
+		pipe_t p;
+		if(i < stages-1) {
+			Pipe(&p);
+			Dup2(p.write, 1);
+			Close(p.write);
+		} else 
+			Dup2(out, 1);
+		pid[i] = Exec(pipeline_stage, 0, NULL);
+		if(i < stages-1) {
+			Dup2(p.read, 0);
+			Close(p.read);
+		}
+	}
+	Close(out);
+	Dup2(savein, 0);
+	Dup2(saveout, 1);
+	Close(savein);
+	Close(saveout);
+}
+
+
+/* Start a pipeline of processes from fid 'in' to fid 'out', with Spawn */
+static void spawn_pipeline(int stages, Fid_t in, Fid_t out, Pid_t* pid)
+{
+	for(int i = 0; i < stages; i++) {
+		pipe_t p;
+		if(i < stages-1)
+			Pipe(&p);
+		else
+			p.read = p.write = out;
+		spawn_file_action act[] = {
+			{ SPAWN_DUP2, in, 0 },
+			{ SPAWN_DUP2, p.write, 1 },
+			{ SPAWN_CLOSE, in, NOFILE },
+			{ SPAWN_CLOSE, p.write, NOFILE },
+			{ SPAWN_CLOSE, p.read, NOFILE }
+		};
+		pid[i] = Spawn(pipeline_stage, 0, NULL, act, 5);
+		Close(in);
+		Close(p.write);
+		in = p.read;
+	}
+}
+
+
+BOOT_TEST(bench_pipeline,
+	"Measure the rate of starting 4-stage pipelines and passing a line through them, when the pipelines are built with Exec and Dup2, or with Spawn.",
+	.timeout = 120
+	)
+{
+	const int count = 5000, stages = 4;
+	const char* method[] = { "Exec+Dup2", "Spawn" };
+
+	/* Keep fids 0 and 1 open, as a shell would */
+	OpenNull();
+	OpenNull();
+
+	for(int m = 0; m < 2; m++) {
+		double t0 = wtime();
+		for(int i = 0; i < count; i++) {
+			pipe_t in, out;
+			Pid_t pid[stages];
+			Pipe(&in);
+			Pipe(&out);
+			Write(in.write, "a line\n", 7);
+			Close(in.write);
+			if(m == 0)
+				exec_pipeline(stages, in.read, out.write, pid);
+			else
+				spawn_pipeline(stages, in.read, out.write, pid);
+
+			char buf[16];
+			ASSERT(Read(out.read, buf, sizeof(buf))==7);
+			ASSERT(Read(out.read, buf, sizeof(buf))==0);
+			Close(out.read);
+			for(int s = 0; s < stages; s++)
+				WaitChild(pid[s], NULL);
+		}
+		double t1 = wtime();
+		MSG("%-10s: %6.0f pipelines/sec\n", method[m], count / (t1-t0));
+	}
+	Close(0);
+	Close(1);
+	return 0;
+}
+
+
+/* Wait for the end of file on fid 'argl', and exit */
+static int exit_on_eof(int argl, void* args)
+{
+	char c;
+	while(Read(argl, &c, 1) > 0)
+		;
+	return 0;
+}
+
+
+BOOT_TEST(bench_reap_children,
+	"Measure the cost of reaping 10000 children that have exited at the same time, by WaitChild on each pid (newest first), by WaitChild(NOPROC), and by WaitChildren in batches of 256.",
+	.timeout = 300
+	)
+{
+	const int count = 10000;
+	static Pid_t pid[10000];
+	const char* method[] = { "by pid", "any child", "batch" };
+
+	for(int m = 0; m < 3; m++) {
+		pipe_t p;
+		ASSERT(Pipe(&p)==0);
+
+		spawn_file_action close_write = { SPAWN_CLOSE, p.write, NOFILE };
+		double t0 = wtime();
+		for(int i = 0; i < count; i++)
+			ASSERT((pid[i] = Spawn(exit_on_eof, p.read, NULL, &close_write, 1)) != NOPROC);
+		double t1 = wtime();
+
+		/* Let them all go, and give them time to exit */
+		Close(p.read);
+		Close(p.write);
+		Mutex mx = MUTEX_INIT;
+		CondVar cv = COND_INIT;
+		Mutex_Lock(&mx);
+		Cond_TimedWait(&mx, &cv, 500);
+		Mutex_Unlock(&mx);
+
+		double t2 = wtime();
+		if(m == 0) {
+			for(int i = count-1; i >= 0; i--)
+				ASSERT(WaitChild(pid[i], NULL)==pid[i]);
+		} else if(m == 1) {
+			for(int i = 0; i < count; i++)
+				ASSERT(WaitChild(NOPROC, NULL)!=NOPROC);
+		} else {
+			int n;
+			for(int i = 0; i < count; i += n)
+				ASSERT((n = WaitChildren(pid, NULL, 256, (timeout_t)-1)) > 0);
+		}
+		double t3 = wtime();
+		MSG("%-9s: %6.2f usec per Exec, %6.3f usec per reaped child\n", 
+			method[m], 1E6 * (t1-t0) / count, 1E6 * (t3-t2) / count);
+	}
+	return 0;
+}
+
+
+BOOT_TEST(bench_procinfo,
+	"Measure the time to list 2000 processes through an info stream, reading 1 or 64 records at a time, and to find the zombies among them with a filter.",
+	.timeout = 120
+	)
+{
+	const int count = 2000, scans = 100;
+	static procinfo pi[64];
+
+	pipe_t p;
+	ASSERT(Pipe(&p)==0);
+	spawn_file_action close_write = { SPAWN_CLOSE, p.write, NOFILE };
+	for(int i = 0; i < count; i++)
+		ASSERT(Spawn(exit_on_eof, p.read, NULL, &close_write, 1) != NOPROC);
+
+	procinfo_filter zombies = { .match = PROCINFO_MATCH_STATE, .alive = 0 };
+	const char* method[] = { "1 per Read", "64 per Read", "zombies only" };
+	for(int m = 0; m < 3; m++) {
+		int records = 0;
+		double t0 = wtime();
+		for(int s = 0; s < scans; s++) {
+			Fid_t info = (m == 2) ? OpenInfoEx(&zombies) : OpenInfo();
+			unsigned int size = (m == 0) ? sizeof(procinfo) : sizeof(pi);
+			int n;
+			while((n = Read(info, (char*) pi, size)) > 0)
+				records += n / sizeof(procinfo);
+			Close(info);
+		}
+		double t1 = wtime();
+		MSG("%-12s: %8.1f usec per scan (%d records)\n", method[m], 1E6 * (t1-t0) / scans, records / scans);
+	}
+
+	Close(p.read);
+	Close(p.write);
+	while(WaitChild(NOPROC, NULL) != NOPROC)
+		;
+	return 0;
+}
+
+
+TEST_SUITE(process_benchmarks,
+	"Benchmarks for process creation."
+	)
+{
+	&bench_exec_wait,
+	&bench_pipeline,
+	&bench_reap_children,
+	&bench_procinfo,
+	NULL
+};
+
+
+
+/*********************************************
+ *
+ *  Main program
+ *
+ *********************************************/
+
+
+TEST_SUITE(all_benchmarks,
+	"A suite containing all benchmarks.")
+{
+	&pipe_benchmarks,
+	&socket_benchmarks,
+	&file_benchmarks,
+	&process_benchmarks,
+	NULL
+};
+
+
+int main(int argc, char** argv)
+{
+	register_test(&all_benchmarks);
+	return run_program(argc, argv, &all_benchmarks);
+}
@@ -55,6 +55,12 @@ void Mutex_Lock(Mutex* lock)
 }
 
 
+int Mutex_TryLock(Mutex* lock)
+{
+  return ! __atomic_test_and_set(lock, __ATOMIC_ACQUIRE);
+}
+
+
 void Mutex_Unlock(Mutex* lock)
 {
   __atomic_clear(lock, __ATOMIC_RELEASE);
@@ -32,6 +32,15 @@
 
 
 
+/**
+	@brief Try to lock a mutex without waiting.
+
+	@returns 1 if the mutex was locked by this call, 0 if it was already locked.
+	@see Mutex_Lock
+ */
+int Mutex_TryLock(Mutex* lock);
+
+
 /*
  * Kernel preemption control.
  * These are wrappers for the kernel monitor.
@@ -36,6 +36,24 @@ int nulldev_write(void* dev, const char* buf, unsigned int size)
     return size;
 }
 
+int nulldev_readv(void* dev, const iovec_t* iov, int iovcnt)
+{
+  int count = 0;
+  for(int i=0; i<iovcnt; i++) {
+    memset(iov[i].base, 0, iov[i].len);
+    count += iov[i].len;
+  }
+  return count;
+}
+
+int nulldev_writev(void* dev, const iovec_t* iov, int iovcnt)
+{
+  int count = 0;
+  for(int i=0; i<iovcnt; i++)
+    count += iov[i].len;
+  return count;
+}
+
 
 int nulldev_close(void* dev) 
 {
@@ -51,7 +69,10 @@ static file_ops nulldev_fops = {
   .Open = nulldev_open,
   .Read = nulldev_read,
   .Write = nulldev_write,
-  .Close = nulldev_close
+  .Close = nulldev_close,
+  .ReadV = nulldev_readv,
+  .WriteV = nulldev_writev,
+  .flags = FOPS_UNLOCKED    /* the methods share no state */
 };
 
 
@@ -96,9 +117,11 @@ void serial_rx_handler()
 }
 
 /*
-  Read from the device, sleeping if needed.
+  Read from the device into a number of buffers, sleeping if needed.
+  Only the first byte is waited for; then, the buffers are filled with 
+  whatever is available.
  */
-int serial_read(void* dev, char *buf, unsigned int size)
+int serial_readv(void* dev, const iovec_t* iov, int iovcnt)
 {
   serial_dcb_t* dcb = (serial_dcb_t*)dev;
 
@@ -106,24 +129,40 @@ int serial_read(void* dev, char *buf, unsigned int size)
 
   uint count =  0;
 
-  while(count<size) {
-    int valid = bios_read_serial(dcb->devno, &buf[count]);
+  for(int i=0; i<iovcnt; i++) {
+    char* buf = iov[i].base;
+    uint pos = 0;
+
+    while(pos<iov[i].len) {
+      int valid = bios_read_serial(dcb->devno, &buf[pos]);
     
-    if (valid) {
-      count++;
-    }
-    else if(count==0) {
-      kernel_wait(&dcb->rx_ready, SCHED_IO);
+      if (valid) {
+        pos++;
+        count++;
+      }
+      else if(count==0) {
+        kernel_wait(&dcb->rx_ready, SCHED_IO);
+      }
+      else
+        goto done;
     }
-    else
-      break;
   }
 
+done:
   preempt_on;           /* Restart preemption */
 
   return count;
 }
 
+/*
+  Read from the device, sleeping if needed.
+ */
+int serial_read(void* dev, char *buf, unsigned int size)
+{
+  iovec_t iov = { buf, size };
+  return serial_readv(dev, &iov, 1);
+}
+
 
 /*
   A polling driver for serial writes
@@ -136,31 +175,43 @@ void serial_tx_handler()
 }
 
 /* 
-  Write call 
+  Write call, from a number of buffers
   This is currently a polling driver.
 */
-int serial_write(void* dev, const char* buf, unsigned int size)
+int serial_writev(void* dev, const iovec_t* iov, int iovcnt)
 {
   serial_dcb_t* dcb = (serial_dcb_t*)dev;
 
   unsigned int count = 0;
-  while(count < size) {
-    int success = bios_write_serial(dcb->devno, buf[count] );
-
-    if(success) {
-      count++;
-    } 
-    else if(count==0)
-    {
-      yield(SCHED_IO);
+  for(int i=0; i<iovcnt; i++) {
+    const char* buf = iov[i].base;
+    unsigned int pos = 0;
+
+    while(pos < iov[i].len) {
+      int success = bios_write_serial(dcb->devno, buf[pos] );
+
+      if(success) {
+        pos++;
+        count++;
+      } 
+      else if(count==0)
+      {
+        yield(SCHED_IO);
+      }
+      else
+        return count;
     }
-    else
-      break;
   }
 
   return count;  
 }
 
+int serial_write(void* dev, const char* buf, unsigned int size)
+{
+  iovec_t iov = { (char*) buf, size };
+  return serial_writev(dev, &iov, 1);
+}
+
 
 int serial_close(void* dev) 
 {
@@ -180,7 +231,9 @@ file_ops serial_fops = {
   .Open = serial_open,
   .Read = serial_read,
   .Write = serial_write,
-  .Close = serial_close
+  .Close = serial_close,
+  .ReadV = serial_readv,
+  .WriteV = serial_writev
 };
 
 
@@ -92,9 +92,38 @@ typedef struct file_operations {
     - There was a I/O runtime problem.
      */
     int (*Close)(void* this);
+
+  /** @brief Vectored read operation (optional).
+
+    Read into the 'iovcnt' buffers of 'iov', like a single Read into their
+    concatenation. If this is NULL, ReadV calls Read for each buffer.
+  */
+    int (*ReadV)(void* this, const iovec_t* iov, int iovcnt);
+
+  /** @brief Vectored write operation (optional).
+
+    Write the 'iovcnt' buffers of 'iov', like a single Write of their
+    concatenation. If this is NULL, WriteV calls Write for each buffer.
+  */
+    int (*WriteV)(void* this, const iovec_t* iov, int iovcnt);
+
+  /** @brief Stream capabilities (e.g. @c FOPS_UNLOCKED). */
+    int flags;
 } file_ops;
 
 
+/**
+  @brief The I/O methods of the stream are called without the kernel lock.
+
+  Read, Write, ReadV and WriteV of a stream with this flag do their own
+  synchronization, and are called by the system calls without holding the
+  kernel lock (the FCB is pinned by @ref FCB_pin instead). They must never be
+  called with the kernel lock held. Open and Close are always called with the
+  kernel lock held.
+*/
+#define FOPS_UNLOCKED 1
+
+
 
 /**
   @brief The device type.
@@ -2,118 +2,1192 @@
 #include "kernel_streams.h"
 #include "kernel_cc.h"
 #include "kernel_pipe.h"
+#include "kernel_socket.h"
+#include "kernel_pool.h"
 
 // Write FCB
 static file_ops W = {
     .Open = NULL,
     .Read = NULL, // Write end doesn't need read implementation
-    .Write = pipe_write,
-    .Close = pipe_writer_close
+    .Write = pipe_write_unlocked,
+    .Close = pipe_writer_close,
+    .WriteV = pipe_writev_unlocked,
+    .flags = FOPS_UNLOCKED
 };
 
 // Read FCB
 static file_ops R = {
     .Open = NULL,
-    .Read = pipe_read,
+    .Read = pipe_read_unlocked,
     .Write = NULL, // Read end doesn't need read implementation
-    .Close = pipe_reader_close
+    .Close = pipe_reader_close,
+    .ReadV = pipe_readv_unlocked,
+    .flags = FOPS_UNLOCKED
+};
+
+// Write FCB of a segmented pipe, whose segment chain is protected by the kernel lock
+static file_ops SW = {
+    .Open = NULL,
+    .Read = NULL,
+    .Write = pipe_write,
+    .Close = pipe_writer_close,
+    .WriteV = pipe_writev
 };
 
+// Read FCB of a segmented pipe
+static file_ops SR = {
+    .Open = NULL,
+    .Read = pipe_read,
+    .Write = NULL,
+    .Close = pipe_reader_close,
+    .ReadV = pipe_readv
+};
+
+/*
+	The buffer is a ring of pipe->size bytes, allocated separately from the
+	pipeCB. The read and write positions are free-running counters, so the
+	number of stored bytes is their difference and the buffer index of a
+	position is its remainder by the buffer size. Buffer sizes are always
+	powers of two, so that the remainder stays consistent when the counters
+	wrap around.
+
+	The buffer starts at PIPE_MIN_SIZE bytes. It grows (up to pipe->limit)
+	when a write does not fit, and shrinks back when the reader drains it
+	while it was mostly unused.
+
+	A PIPE_SEGMENTED pipe has no ring; see "Segmented pipes" below. Its
+	counters are maintained in the same way, and its size equals its limit.
+
+	A PIPE_MESSAGE pipe stores each message in the ring as a header, holding
+	the message length, followed by the message bytes. A message is written
+	only when all of it fits, and read (or discarded) all at once.
+*/
+
+// Fields shared by the reader and the writer side are accessed atomically
+#define LOAD(x)      __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define STORE(x, v)  __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+
+#define PIPE_USED(p)  (LOAD((p)->w_position) - LOAD((p)->r_position))
+
+// The size of the header of a message
+#define MSG_HEADER  sizeof(unsigned int)
+
+// Round a requested buffer size to a legal power of two
+static unsigned int pipe_round_size(unsigned int size){
+	if(size < PIPE_MIN_SIZE)
+		size = PIPE_MIN_SIZE;
+	if(size > PIPE_MAX_SIZE)
+		size = PIPE_MAX_SIZE;
+
+	unsigned int rounded = PIPE_MIN_SIZE;
+	while(rounded < size)
+		rounded *= 2;
+	return rounded;
+}
+
+// The number of bytes that can be written without growing the buffer
+static unsigned int pipe_space(pipeCB* pipe){
+	unsigned int size = LOAD(pipe->size), limit = LOAD(pipe->limit);
+	unsigned int capacity = (size < limit) ? size : limit;
+	unsigned int used = PIPE_USED(pipe) + LOAD(pipe->reserved) + LOAD(pipe->lent);
+	return (used < capacity) ? capacity - used : 0;
+}
+
+// Copy n bytes out of the ring, starting at position pos (at most two spans)
+static void ring_copy_out(pipeCB* pipe, unsigned int pos, char* buf, unsigned int n){
+	unsigned int idx = pos % pipe->size;
+	unsigned int span = pipe->size - idx;
+
+	if(n <= span)
+		memcpy(buf, pipe->buffer + idx, n);
+	else {
+		memcpy(buf, pipe->buffer + idx, span);
+		memcpy(buf + span, pipe->buffer, n - span);
+	}
+}
+
+// Copy n bytes into the ring, starting at position pos (at most two spans)
+static void ring_copy_in(pipeCB* pipe, unsigned int pos, const char* buf, unsigned int n){
+	unsigned int idx = pos % pipe->size;
+	unsigned int span = pipe->size - idx;
+
+	if(n <= span)
+		memcpy(pipe->buffer + idx, buf, n);
+	else {
+		memcpy(pipe->buffer + idx, buf, span);
+		memcpy(pipe->buffer, buf + span, n - span);
+	}
+}
+
+// An iterator over the bytes of an array of iovecs
+typedef struct {
+	const iovec_t* iov;
+	unsigned int off;		/* offset into *iov */
+} iov_iter;
+
+// Return the next contiguous span of at most n > 0 bytes, and advance past it
+static unsigned int iov_next(iov_iter* it, char** base, unsigned int n){
+	while(it->off == it->iov->len) {
+		it->iov++;
+		it->off = 0;
+	}
+
+	unsigned int k = it->iov->len - it->off;
+	if(k > n)
+		k = n;
+	*base = (char*) it->iov->base + it->off;
+	it->off += k;
+	return k;
+}
+
+static unsigned int iov_size(const iovec_t* iov, int iovcnt){
+	unsigned int size = 0;
+	for(int i = 0; i < iovcnt; i++)
+		size += iov[i].len;
+	return size;
+}
+
+/*
+	Pipe control blocks and the small buffers, up to PIPE_BUFFER_SIZE bytes, 
+	come from pools, since pipes (and sockets) are often short-lived.
+*/
+static object_pool pipe_pool = POOL_INIT("pipeCB", sizeof(pipeCB), CACHE_LINE);
+
+static object_pool buffer_pools[] = {
+	POOL_INIT("pipe buffer 512", 512, CACHE_LINE),
+	POOL_INIT("pipe buffer 1K", 1024, CACHE_LINE),
+	POOL_INIT("pipe buffer 2K", 2048, CACHE_LINE),
+	POOL_INIT("pipe buffer 4K", 4096, CACHE_LINE),
+	POOL_INIT("pipe buffer 8K", 8192, CACHE_LINE)
+};
+#define BUFFER_POOLS  (sizeof(buffer_pools)/sizeof(object_pool))
+_Static_assert(PIPE_MIN_SIZE << (BUFFER_POOLS-1) == PIPE_BUFFER_SIZE, "buffer_pools do not match PIPE_BUFFER_SIZE");
+
+// The pool for buffers of the given size (a power of two), or NULL
+static object_pool* buffer_pool(unsigned int size){
+	for(unsigned int i = 0; i < BUFFER_POOLS; i++)
+		if(buffer_pools[i].size == size)
+			return &buffer_pools[i];
+	return NULL;
+}
+
+static char* buffer_alloc(unsigned int size){
+	object_pool* pool = buffer_pool(size);
+	return (pool != NULL) ? pool_alloc(pool) : xmalloc(size);
+}
+
+static void buffer_free(char* buffer, unsigned int size){
+	object_pool* pool = buffer_pool(size);
+	if(pool != NULL)
+		pool_free(pool, buffer);
+	else
+		free(buffer);
+}
+
+// Move the contents of the pipe to a new buffer of the given size, holding both side locks
+static void pipe_resize(pipeCB* pipe, unsigned int size){
+	unsigned int used = PIPE_USED(pipe);
+	assert(used <= size);
+	assert(!(pipe->flags & PIPE_SEGMENTED));
+
+	char* buffer = buffer_alloc(size);
+	ring_copy_out(pipe, pipe->r_position, buffer, used);
+	buffer_free(pipe->buffer, pipe->size);
+
+	pipe->buffer = buffer;
+	STORE(pipe->size, size);
+	STORE(pipe->r_position, 0);
+	STORE(pipe->w_position, used);
+}
+
+/*
+	Segmented pipes.
+
+	The data of a segmented pipe is kept in a chain of segments, in the order
+	it was written. A write of at least PIPE_SEGMENT_SIZE bytes is copied into a
+	segment of its own, while smaller writes fill up the last segment of the 
+	chain. Read copies data out of the first segments, and frees them once they
+	are used up; the last segment is kept around for reuse.
+
+	ReadZC instead lends the reader a pointer into the first segment, and 
+	records the lease in the leased list. A segment is freed when it has been
+	removed from the chain and all its leases have been returned by ReleaseZC.
+	The lent bytes still count against the limit of the pipe, so a reader 
+	that does not release its data stops the writers.
+*/
+
+typedef struct pipe_segment {
+	rlnode node;			/* in pipe->segments, if in_chain */
+	int in_chain;
+	unsigned int leases;	/* pointers returned by ReadZC and not released */
+	unsigned int capacity;
+	unsigned int length;	/* bytes written */
+	unsigned int offset;	/* bytes read */
+	char data[];
+} pipe_segment;
+
+// A pointer returned by ReadZC
+typedef struct pipe_lease {
+	rlnode node;			/* in pipe->leased */
+	pipe_segment* seg;
+	const char* data;
+	unsigned int length;
+} pipe_lease;
+
+static pipe_segment* segment_create(unsigned int capacity){
+	pipe_segment* seg = xmalloc(sizeof(pipe_segment) + capacity);
+	rlnode_init(&seg->node, seg);
+	seg->in_chain = 0;
+	seg->leases = 0;
+	seg->capacity = capacity;
+	seg->length = 0;
+	seg->offset = 0;
+	return seg;
+}
+
+// Free a segment, if it is not in use any more
+static void segment_release(pipe_segment* seg){
+	if(!seg->in_chain && seg->leases == 0)
+		free(seg);
+}
+
+// Remove a segment from the chain
+static void segment_unchain(pipe_segment* seg){
+	rlist_remove(&seg->node);
+	seg->in_chain = 0;
+	segment_release(seg);
+}
+
+// Account for n bytes read from the first segment of the chain
+static void segment_consumed(pipeCB* pipe, pipe_segment* seg, unsigned int n){
+	seg->offset += n;
+
+	// A used up segment is dropped, unless it is the last one and can be reused
+	if(seg->offset == seg->length && (seg->node.next != &pipe->segments || seg->leases > 0))
+		segment_unchain(seg);
+}
+
+// Copy n bytes to the end of the chain
+static void segments_copy_in(pipeCB* pipe, const char* buf, unsigned int n){
+	pipe_segment* tail = is_rlist_empty(&pipe->segments) ? NULL : pipe->segments.prev->obj;
+
+	// A used up segment at the end of the chain is reset, or dropped for a large write
+	if(tail != NULL && tail->offset == tail->length) {
+		if(n < PIPE_SEGMENT_SIZE) 
+			tail->offset = tail->length = 0;
+		else {
+			segment_unchain(tail);
+			tail = NULL;
+		}
+	}
+
+	// Small writes are packed into the last segment
+	if(tail != NULL && n < PIPE_SEGMENT_SIZE) {
+		unsigned int k = tail->capacity - tail->length;
+		if(k > n)
+			k = n;
+		memcpy(tail->data + tail->length, buf, k);
+		tail->length += k;
+		buf += k;
+		n -= k;
+	}
+
+	if(n > 0) {
+		pipe_segment* seg = segment_create((n < PIPE_SEGMENT_SIZE) ? PIPE_SEGMENT_SIZE : n);
+		memcpy(seg->data, buf, n);
+		seg->length = n;
+		seg->in_chain = 1;
+		rlist_push_back(&pipe->segments, &seg->node);
+	}
+}
+
+// Copy n bytes from the start of the chain
+static void segments_copy_out(pipeCB* pipe, char* buf, unsigned int n){
+	while(n > 0) {
+		pipe_segment* seg = pipe->segments.next->obj;
+		unsigned int k = seg->length - seg->offset;
+		if(k > n)
+			k = n;
+		memcpy(buf, seg->data + seg->offset, k);
+		buf += k;
+		n -= k;
+		segment_consumed(pipe, seg, k);
+	}
+}
+
+// Copy n bytes from the iovecs into the pipe, at position pos
+static void pipe_copy_in(pipeCB* pipe, unsigned int pos, iov_iter* it, unsigned int n){
+	while(n > 0) {
+		char* base;
+		unsigned int k = iov_next(it, &base, n);
+		if(pipe->flags & PIPE_SEGMENTED)
+			segments_copy_in(pipe, base, k);
+		else
+			ring_copy_in(pipe, pos, base, k);
+		pos += k;
+		n -= k;
+	}
+}
+
+// Copy n bytes out of the pipe into the iovecs, from position pos
+static void pipe_copy_out(pipeCB* pipe, unsigned int pos, iov_iter* it, unsigned int n){
+	while(n > 0) {
+		char* base;
+		unsigned int k = iov_next(it, &base, n);
+		if(pipe->flags & PIPE_SEGMENTED)
+			segments_copy_out(pipe, base, k);
+		else
+			ring_copy_out(pipe, pos, base, k);
+		pos += k;
+		n -= k;
+	}
+}
+
+void pipe_init(pipeCB* pipe_cb, FCB* reader, FCB* writer, unsigned int limit, int flags){
+	pipe_cb->rlock = MUTEX_INIT;
+	pipe_cb->wlock = MUTEX_INIT;
+	pipe_cb->reader = reader;
+	pipe_cb->writer = writer;
+	pipe_cb->has_space = (pipe_waitq) { COND_INIT, 0, 0, 0 };
+	pipe_cb->has_data = (pipe_waitq) { COND_INIT, 0, 0, 0 };
+	pipe_cb->limit = pipe_round_size(limit);
+	pipe_cb->peak = 0;
+	pipe_cb->claimed = 0;
+	pipe_cb->rcvlowat = 1;
+	pipe_cb->rcvtimeo = NO_TIMEOUT;
+	pipe_cb->sndtimeo = NO_TIMEOUT;
+	pipe_cb->cork = 0;
+	pipe_cb->reserved = 0;
+	pipe_cb->flags = flags;
+	rlnode_new(&pipe_cb->segments);
+	rlnode_new(&pipe_cb->leased);
+	pipe_cb->lent = 0;
+	if(flags & PIPE_SEGMENTED) {
+		pipe_cb->size = pipe_cb->limit;
+		pipe_cb->buffer = NULL;
+	} else {
+		pipe_cb->size = PIPE_MIN_SIZE;
+		pipe_cb->buffer = buffer_alloc(pipe_cb->size);
+	}
+	pipe_cb->r_position = 0;
+	pipe_cb->w_position = 0;
+}
+
+pipeCB* pipe_create(FCB* reader, FCB* writer, unsigned int limit, int flags){
+	pipeCB* pipe_cb = pool_alloc(&pipe_pool);
+	pipe_init(pipe_cb, reader, writer, limit, flags);
+	return pipe_cb;
+}
+
+void pipe_set_limit(pipeCB* pipe, unsigned int limit){
+	Mutex_Lock(&pipe->wlock);
+	Mutex_Lock(&pipe->rlock);
+
+	STORE(pipe->limit, pipe_round_size(limit));
+	if(pipe->flags & PIPE_SEGMENTED)
+		STORE(pipe->size, pipe->limit);
+
+	// Shrink now if the data fits, else the buffer shrinks when it is drained
+	if(pipe->size > pipe->limit && PIPE_USED(pipe) <= pipe->limit && pipe->claimed == 0 && pipe->reserved == 0)
+		pipe_resize(pipe, pipe->limit);
+
+	Mutex_Unlock(&pipe->rlock);
+	Mutex_Unlock(&pipe->wlock);
+
+	// A raised limit may let blocked writers proceed
+	kernel_broadcast(&pipe->has_space.cv);
+}
+
+void pipe_release(pipeCB* pipe){
+	while(! is_rlist_empty(&pipe->segments))
+		segment_unchain(pipe->segments.next->obj);
+	while(! is_rlist_empty(&pipe->leased)) {
+		pipe_lease* lease = rlist_pop_front(&pipe->leased)->obj;
+		lease->seg->leases--;
+		segment_release(lease->seg);
+		free(lease);
+	}
+	if(pipe->buffer != NULL)
+		buffer_free(pipe->buffer, pipe->size);
+}
+
+void pipe_set_reader_options(pipeCB* pipe, unsigned int lowat, TimerDuration timeout){
+	STORE(pipe->rcvlowat, (lowat > 0) ? lowat : 1);
+	STORE(pipe->rcvtimeo, timeout);
+
+	// A lowered mark may let blocked readers proceed
+	kernel_broadcast(&pipe->has_data.cv);
+}
+
+void pipe_set_writer_options(pipeCB* pipe, TimerDuration timeout, unsigned int cork){
+	STORE(pipe->sndtimeo, timeout);
+
+	// Uncorking lets the readers see the stored data
+	if(pipe->cork != 0 && cork == 0)
+		kernel_broadcast(&pipe->has_data.cv);
+	STORE(pipe->cork, cork);
+}
+
+unsigned long pipe_reader_sleeps(pipeCB* pipe){
+	return pipe->has_data.sleeps;
+}
+
+// Free the pipe when both ends are closed
+static void pipe_destroy(pipeCB* pipe){
+	pipe_release(pipe);
+	pool_free(&pipe_pool, pipe);
+}
+
 // Initialize new Pipe
-int sys_Pipe(pipe_t* pipe){	
-	pipeCB* pipe_cb = xmalloc(sizeof(pipeCB));
-	
+int sys_PipeEx(pipe_t* pipe, unsigned int size, int flags){
 	Fid_t fid[2];
 	FCB* fcb[2];
 
+	if(size < PIPE_MIN_SIZE || size > PIPE_MAX_SIZE || (flags & ~(PIPE_SEGMENTED|PIPE_MESSAGE)))
+		return -1;
+	if((flags & PIPE_SEGMENTED) && (flags & PIPE_MESSAGE))
+		return -1;
+
 	// Reserve R and W FCB's with given FID's at currporc's FIDT
-	if(FCB_reserve(2, fid, fcb) != 1) 
+	if(FCB_reserve(2, fid, fcb) != 1)
 		return -1;
-	
+
 	// Initialize Pipe_CB
-	pipe_cb->pipe_ends = pipe;	
-	pipe_cb->pipe_ends->read = fid[0];
-	pipe_cb->pipe_ends->write = fid[1];
-	pipe_cb->reader = fcb[0];
-	pipe_cb->writer = fcb[1];
-	pipe_cb->has_space = COND_INIT;
-	pipe_cb->has_data = COND_INIT;
-	pipe_cb->r_position = PIPE_BUFFER_SIZE-1;
-	pipe_cb->w_position = 0;
+	pipeCB* pipe_cb = pipe_create(fcb[0], fcb[1], size, flags);
 	pipe_cb->reader->streamobj = pipe_cb;
 	pipe_cb->writer->streamobj = pipe_cb;
-	pipe_cb->reader->streamfunc = &R;
-	pipe_cb->writer->streamfunc = &W;
+
+	// Publish the methods last, for the system calls that look without the kernel lock
+	int segmented = flags & PIPE_SEGMENTED;
+	__atomic_store_n(&pipe_cb->reader->streamfunc, segmented ? &SR : &R, __ATOMIC_RELEASE);
+	__atomic_store_n(&pipe_cb->writer->streamfunc, segmented ? &SW : &W, __ATOMIC_RELEASE);
+
+	pipe->read = fid[0];
+	pipe->write = fid[1];
 
 	return 0;
 }
 
-int pipe_read(void* pipe, char* buf, unsigned int size){
-	pipeCB* pipe_in_use = (pipeCB*) pipe;
-	
-	// if reader is closed return -1
-	if(pipe_in_use->reader==NULL)
-		return -1;
-	
-	// if there is no data to read from buffer and writer is closed return 0 (EOF)
-	if(pipe_in_use->r_position == pipe_in_use->w_position && pipe_in_use->writer==NULL)
-		return 0;
-	
-	int i;
-	for(i = 0; i < size; i++){
-		// Increase r_position
-		pipe_in_use->r_position = (pipe_in_use->r_position + 1) % PIPE_BUFFER_SIZE; // % PIPE_BUFFER_SIZE -> Circular Buffer
-
-		//if all data is read wait until writer writes more data
-		while(pipe_in_use->r_position == pipe_in_use->w_position && pipe_in_use->writer!=NULL){
-			kernel_broadcast(&pipe_in_use->has_space);
-			kernel_wait(&pipe_in_use->has_data, SCHED_PIPE);
+int sys_Pipe(pipe_t* pipe){
+	return sys_PipeEx(pipe, PIPE_BUFFER_SIZE, 0);
+}
+
+/*
+	Synchronization.
+
+	The reader side of a pipe (r_position and claimed) is protected by 
+	pipe->rlock, and the writer side (w_position, peak and reserved) by pipe->wlock. The 
+	two sides share only the positions, which are published with release stores
+	and read with acquire loads. Thus, a single reader and a single writer
+	stream through the ring without ever waiting for each other, and several
+	readers (or writers) serialize on their side lock. Resizing the buffer moves
+	both positions, so it takes both side locks, the write lock first.
+
+	The methods of plain pipes run without the kernel lock (FOPS_UNLOCKED), and
+	take it only to sleep, when the ring is empty (or full), and to wake up
+	sleepers. A thread about to sleep announces itself in the 'waiting' count 
+	of its wait queue and then checks its condition again under the kernel
+	lock, while a thread that changes the condition publishes the change and
+	then checks for sleepers. With sequentially consistent ordering, either
+	the sleeper sees the change or the waker sees the sleeper, so no wakeup 
+	is lost, and the kernel lock is not touched while nobody sleeps.
+
+	Wakeups are coalesced: the waker that wakes the sleepers of a queue sets
+	its 'woken' flag, and later wakers skip the queue while the flag is set,
+	since the woken threads will look at the pipe again anyway. A thread that
+	goes to sleep clears the flag, in the same way as it announces itself, so
+	it is never skipped. Thus a burst of small writes costs the reader a 
+	single wakeup, without delaying it.
+
+	A writer may also hold back the wakeups of readers until 'cork' bytes 
+	are stored (see SOCKOPT_CORK). It wakes them anyway before it sleeps for
+	space, so that a corked pipe never stalls.
+
+	A reader waits until the pipe holds rcvlowat bytes (for sockets, see
+	SOCKOPT_RCVLOWAT), and a writer wakes readers only once there are as many.
+	A reader that reaches EOF, or cannot wait any longer, takes what is there.
+
+	The waiting functions take a timeout in usec: 0 for a non-blocking caller,
+	NO_TIMEOUT to wait for ever. If the timeout expires before anything is
+	transferred, the caller gets WOULDBLOCK.
+
+	Connected sockets use the same methods. Splice and segmented pipes call
+	the same code holding the kernel lock, which is passed along as 'locked'. Side locks are held only for 
+	short copies, never while sleeping or taking the kernel lock.
+*/
+
+// The bytes a reader waits for; a message is always taken whole
+static unsigned int read_threshold(pipeCB* pipe){
+	if(pipe->flags & PIPE_MESSAGE)
+		return 1;
+	unsigned int lowat = LOAD(pipe->rcvlowat), limit = LOAD(pipe->limit);
+	return (lowat < limit) ? lowat : limit;
+}
+
+static int reader_must_wait(pipeCB* pipe, unsigned int minimum){
+	return LOAD(pipe->writer) != NULL && (LOAD(pipe->claimed) > 0 || PIPE_USED(pipe) < read_threshold(pipe));
+}
+
+static int writer_must_wait(pipeCB* pipe, unsigned int minimum){
+	return LOAD(pipe->reader) != NULL && pipe_space(pipe) < minimum
+		&& (LOAD(pipe->size) >= LOAD(pipe->limit) || LOAD(pipe->claimed) > 0);
+}
+
+// Sleep on q for up to timeout usec, unless the condition has changed since the caller looked
+static void pipe_park(pipeCB* pipe, pipe_waitq* q,
+	int (*must_wait)(pipeCB*, unsigned int), unsigned int minimum, TimerDuration timeout, int locked)
+{
+	if(!locked) kernel_lock();
+
+	__atomic_add_fetch(&q->waiting, 1, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&q->woken, 0, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if(must_wait(pipe, minimum)) {
+		q->sleeps++;
+		kernel_timedwait(&q->cv, SCHED_PIPE, timeout);
+	}
+	__atomic_sub_fetch(&q->waiting, 1, __ATOMIC_SEQ_CST);
+
+	if(!locked) kernel_unlock();
+}
+
+// Wake up the sleepers on q, after a change published by the caller, unless they are awake already
+static void pipe_wake(pipe_waitq* q, int locked){
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&q->waiting, __ATOMIC_RELAXED) == 0)
+		return;
+	if(__atomic_exchange_n(&q->woken, 1, __ATOMIC_SEQ_CST))
+		return;
+
+	if(!locked) kernel_lock();
+	kernel_broadcast(&q->cv);
+	if(!locked) kernel_unlock();
+}
+
+static void park_reader(pipeCB* pipe, TimerDuration timeout, int locked){
+	pipe_park(pipe, &pipe->has_data, reader_must_wait, 0, timeout, locked);
+}
+
+static void park_writer(pipeCB* pipe, unsigned int minimum, TimerDuration timeout, int locked){
+	pipe_park(pipe, &pipe->has_space, writer_must_wait, minimum, timeout, locked);
+}
+
+// Readers are not woken below the low-water mark, as they would only go back to sleep,
+// nor below the cork of the writer
+static void wake_readers(pipeCB* pipe, int locked){
+	unsigned int mark = read_threshold(pipe), cork = LOAD(pipe->cork);
+	if(cork > mark)
+		mark = (cork < pipe->limit) ? cork : pipe->limit;
+	if(PIPE_USED(pipe) >= mark)
+		pipe_wake(&pipe->has_data, locked);
+}
+
+static void wake_writers(pipeCB* pipe, int locked){
+	pipe_wake(&pipe->has_space, locked);
+}
+
+/*
+	The time that a caller with the given timeout may still wait. The deadline
+	is set when the caller first has to wait.
+*/
+static TimerDuration wait_time(TimerDuration timeout, TimerDuration* deadline){
+	if(timeout == 0 || timeout == NO_TIMEOUT)
+		return timeout;
+
+	TimerDuration now = bios_clock();
+	if(*deadline == NO_TIMEOUT)
+		*deadline = now + timeout;
+	return (now < *deadline) ? *deadline - now : 0;
+}
+
+/*
+	Lock the reader side, once a reader may take data from the pipe. Return 1 
+	(holding rlock) if there is data, 0 at EOF, or WOULDBLOCK if the caller 
+	cannot wait (any longer). While a Splice holds a claim on the head of the
+	buffer, other readers wait.
+*/
+static int reader_lock(pipeCB* pipe, TimerDuration timeout, int locked){
+	TimerDuration deadline = NO_TIMEOUT;
+
+	Mutex_Lock(&pipe->rlock);
+	while(pipe->claimed > 0 || PIPE_USED(pipe) < read_threshold(pipe)){
+		// if the writer is closed, take what is left, or return 0 (EOF).
+		// The writer publishes its data before it closes, so look at the data last.
+		if(pipe->claimed == 0 && LOAD(pipe->writer) == NULL) {
+			if(PIPE_USED(pipe) > 0)
+				return 1;
+			Mutex_Unlock(&pipe->rlock);
+			return 0;
+		}
+
+		// A reader that cannot wait takes the data below the low-water mark, if any
+		TimerDuration left = wait_time(timeout, &deadline);
+		if(left == 0) {
+			if(pipe->claimed == 0 && PIPE_USED(pipe) > 0)
+				return 1;
+			Mutex_Unlock(&pipe->rlock);
+			return WOULDBLOCK;
 		}
 
-		// All contents of buffer was read, wait for writer to write new data at buffer
-		if(size == PIPE_BUFFER_SIZE) 
+		Mutex_Unlock(&pipe->rlock);
+		park_reader(pipe, left, locked);
+		Mutex_Lock(&pipe->rlock);
+	}
+	return 1;
+}
+
+// Grow the buffer under write pressure (not while a Splice points into it)
+static void pipe_grow(pipeCB* pipe, unsigned int wanted){
+	Mutex_Lock(&pipe->rlock);
+	if(pipe->claimed == 0) {
+		unsigned int newsize = pipe_round_size(PIPE_USED(pipe) + pipe->reserved + wanted);
+		pipe_resize(pipe, (newsize < pipe->limit) ? newsize : pipe->limit);
+	}
+	Mutex_Unlock(&pipe->rlock);
+}
+
+/*
+	Lock the writer side, once a writer may add data to the pipe, growing the
+	buffer towards room for 'wanted' bytes as far as the limit allows. If 'all'
+	is set, wait until all the wanted bytes fit. Return 1 (holding wlock) if 
+	there is space, -1 if the reader is closed or the wanted bytes can never
+	fit, or WOULDBLOCK if the caller cannot wait (any longer).
+*/
+static int writer_lock(pipeCB* pipe, unsigned int wanted, int all, TimerDuration timeout, int locked){
+	unsigned int minimum = all ? wanted : 1;
+	TimerDuration deadline = NO_TIMEOUT;
+
+	Mutex_Lock(&pipe->wlock);
+	while(LOAD(pipe->reader) != NULL) {
+		if(pipe_space(pipe) < wanted && pipe->size < pipe->limit)
+			pipe_grow(pipe, wanted);
+
+		if(pipe_space(pipe) >= minimum)
+			return 1;
+		if(minimum > pipe->limit)
 			break;
 
-		//if all data is read and write end is closed then return i
-		if(pipe_in_use->r_position == pipe_in_use->w_position && pipe_in_use->writer == NULL)
-			return i;
-		
-		// Read data from pipe buffer
-		buf[i] = pipe_in_use->BUFFER[pipe_in_use->r_position];
+		Mutex_Unlock(&pipe->wlock);
+
+		// A corked writer lets the readers make room
+		if(pipe->cork != 0 && PIPE_USED(pipe) > 0)
+			pipe_wake(&pipe->has_data, locked);
+
+		TimerDuration left = wait_time(timeout, &deadline);
+		if(left == 0)
+			return WOULDBLOCK;
+
+		// the buffer is full, sleep until some data is read
+		park_writer(pipe, minimum, left, locked);
+		Mutex_Lock(&pipe->wlock);
 	}
 
-	// Wake up writer end
-	kernel_broadcast(&pipe_in_use->has_space);
-	return i;
+	Mutex_Unlock(&pipe->wlock);
+	return -1;
 }
 
-int pipe_write(void* pipe, const char* buf, unsigned int size){
-	pipeCB* pipe_in_use = (pipeCB*) pipe;
-	
+// Remove n bytes from the head of the pipe, holding rlock
+static void reader_consumed(pipeCB* pipe, unsigned int n){
+	unsigned int r = pipe->r_position + n;
+	STORE(pipe->r_position, r);
+
+	// The pipe was drained; shrink the buffer if it was mostly unused. This needs the
+	// write lock as well, and is skipped if a writer has it, as it will refill the buffer,
+	// or if a Splice has reserved space in it.
+	if(!(pipe->flags & PIPE_SEGMENTED) && LOAD(pipe->w_position) == r && Mutex_TryLock(&pipe->wlock)) {
+		if(pipe->w_position == r && pipe->reserved == 0) {
+			if(pipe->size > pipe->limit)
+				pipe_resize(pipe, pipe->limit);
+			else if(pipe->size > PIPE_MIN_SIZE && pipe->peak <= pipe->size/4)
+				pipe_resize(pipe, pipe->size/2);
+			pipe->peak = 0;
+		}
+		Mutex_Unlock(&pipe->wlock);
+	}
+}
+
+// Append n bytes, already copied into the ring, to the tail of the pipe, holding wlock
+static void writer_produced(pipeCB* pipe, unsigned int n){
+	unsigned int w = pipe->w_position + n;
+	unsigned int used = w - LOAD(pipe->r_position);
+
+	if(used > pipe->peak)
+		pipe->peak = used;
+	STORE(pipe->w_position, w);
+}
+
+static int pipe_do_readv(pipeCB* pipe, const iovec_t* iov, int iovcnt, int locked){
+	// if reader is closed return -1 (a socket may shut it down meanwhile, so look once)
+	FCB* reader = LOAD(pipe->reader);
+	if(reader == NULL)
+		return -1;
+
+	// An empty read takes no message, as an empty write sends none
+	unsigned int size = iov_size(iov, iovcnt);
+	if(size == 0 && (pipe->flags & PIPE_MESSAGE))
+		return 0;
+
+	// wait until there is data to read
+	int rc = reader_lock(pipe, (LOAD(reader->flags) & FID_NONBLOCK) ? 0 : LOAD(pipe->rcvtimeo), locked);
+	if(rc <= 0)
+		return rc;
+
+	iov_iter it = { iov, 0 };
+	unsigned int n;
+
+	if(pipe->flags & PIPE_MESSAGE) {
+		// Read the next message, discarding what does not fit
+		unsigned int len;
+		ring_copy_out(pipe, pipe->r_position, (char*) &len, MSG_HEADER);
+		n = (size < len) ? size : len;
+
+		pipe_copy_out(pipe, pipe->r_position + MSG_HEADER, &it, n);
+		reader_consumed(pipe, MSG_HEADER + len);
+	} else {
+		// Read as much as is available, up to size
+		unsigned int used = PIPE_USED(pipe);
+		n = (size < used) ? size : used;
+
+		pipe_copy_out(pipe, pipe->r_position, &it, n);
+		reader_consumed(pipe, n);
+	}
+
+	Mutex_Unlock(&pipe->rlock);
+
+	// Wake up writer end, only if it is waiting for space
+	wake_writers(pipe, locked);
+	return n;
+}
+
+static int pipe_do_writev(pipeCB* pipe, const iovec_t* iov, int iovcnt, int locked){
 	// if write or read end are closed return -1
-	if(pipe_in_use->writer==NULL || pipe_in_use->reader==NULL)
+	FCB* writer = LOAD(pipe->writer);
+	if(writer == NULL || LOAD(pipe->reader) == NULL)
 		return -1;
-	
-	int i;
-	for(i = 0; i < size; i++){
-		// if read end is open and next block of buffer has not been read sleep until its read
-		while(pipe_in_use->reader != NULL && pipe_in_use->r_position == (pipe_in_use->w_position + 1) % PIPE_BUFFER_SIZE){
-			kernel_broadcast(&pipe_in_use->has_data);
-			kernel_wait(&pipe_in_use->has_space, SCHED_PIPE);
-		}
 
-		// if read end is closed return i
-		if(pipe_in_use->reader == NULL)  
-			return i;
-		
-		// Write data to pipe buffer and increase w_position
-		pipe_in_use->BUFFER[pipe_in_use->w_position] = buf[i];
-		pipe_in_use->w_position = (pipe_in_use->w_position + 1) % PIPE_BUFFER_SIZE;
+	unsigned int size = iov_size(iov, iovcnt);
+	iov_iter it = { iov, 0 };
+	TimerDuration timeout = (LOAD(writer->flags) & FID_NONBLOCK) ? 0 : LOAD(pipe->sndtimeo);
+
+	// Write a message all at once, after waiting for room for all of it
+	if(pipe->flags & PIPE_MESSAGE) {
+		if(size == 0)
+			return 0;
+		if(size > pipe->limit - MSG_HEADER)
+			return -1;
+
+		int rc = writer_lock(pipe, MSG_HEADER + size, 1, timeout, locked);
+		if(rc <= 0)
+			return rc;
+
+		ring_copy_in(pipe, pipe->w_position, (char*) &size, MSG_HEADER);
+		pipe_copy_in(pipe, pipe->w_position + MSG_HEADER, &it, size);
+		writer_produced(pipe, MSG_HEADER + size);
+
+		Mutex_Unlock(&pipe->wlock);
+		wake_readers(pipe, locked);
+		return size;
+	}
+
+	unsigned int count = 0;
+	while(count < size){
+		int rc = writer_lock(pipe, size - count, 0, timeout, locked);
+
+		// A writer that cannot wait, or whose reader has closed, returns what it has written
+		if(rc <= 0)
+			return (count > 0) ? count : rc;
+
+		// Write as much as fits to pipe buffer and increase w_position
+		unsigned int n = pipe_space(pipe);
+		if(n > size - count)
+			n = size - count;
+
+		pipe_copy_in(pipe, pipe->w_position, &it, n);
+		writer_produced(pipe, n);
+		count += n;
+
+		// Wake up reader end, only if it is waiting for data
+		Mutex_Unlock(&pipe->wlock);
+		wake_readers(pipe, locked);
 	}
 
-	// Wake up reader end
-	kernel_broadcast(& pipe_in_use->has_data);
-	return i;
+	return count;
+}
+
+int pipe_readv(void* pipe, const iovec_t* iov, int iovcnt){
+	return pipe_do_readv(pipe, iov, iovcnt, 1);
+}
+
+int pipe_writev(void* pipe, const iovec_t* iov, int iovcnt){
+	return pipe_do_writev(pipe, iov, iovcnt, 1);
+}
+
+int pipe_read(void* pipe, char* buf, unsigned int size){
+	iovec_t iov = { buf, size };
+	return pipe_do_readv(pipe, &iov, 1, 1);
+}
+
+int pipe_write(void* pipe, const char* buf, unsigned int size){
+	iovec_t iov = { (char*) buf, size };
+	return pipe_do_writev(pipe, &iov, 1, 1);
+}
+
+int pipe_readv_unlocked(void* pipe, const iovec_t* iov, int iovcnt){
+	return pipe_do_readv(pipe, iov, iovcnt, 0);
+}
+
+int pipe_writev_unlocked(void* pipe, const iovec_t* iov, int iovcnt){
+	return pipe_do_writev(pipe, iov, iovcnt, 0);
+}
+
+int pipe_read_unlocked(void* pipe, char* buf, unsigned int size){
+	iovec_t iov = { buf, size };
+	return pipe_do_readv(pipe, &iov, 1, 0);
+}
+
+int pipe_write_unlocked(void* pipe, const char* buf, unsigned int size){
+	iovec_t iov = { (char*) buf, size };
+	return pipe_do_writev(pipe, &iov, 1, 0);
+}
+
+
+// The timeout of a caller that waits for ever, unless it is non-blocking
+#define NONBLOCK_TIMEOUT(nb)  ((nb) ? 0 : NO_TIMEOUT)
+
+/*
+	Splice and Tee.
+
+	When both ends are pipes, the data is copied from one ring buffer to the 
+	other directly. When only the source is a pipe, its buffer is handed to the 
+	Write method of the destination device. Since the device may block, the bytes
+	are claimed first: other readers wait and the buffer is not resized until 
+	the device returns, but writers keep filling the rest of the buffer.
+	Any other source, including a segmented pipe, is read into a bounce buffer.
+	Message pipes are not supported, since the message boundaries would be lost.
+
+	Splice holds the kernel lock, as it is a locked system call. The methods 
+	of a FOPS_UNLOCKED device are called after releasing it, as they expect;
+	the references taken on the FCBs keep the streams open meanwhile. Pipe 
+	destinations are written directly, with their side locks. A Splice from a
+	device into a pipe reserves space in the pipe before it reads the device,
+	so that the bytes it reads always fit, and it never waits after it has 
+	taken them from the device.
+*/
+
+// Splice/Tee transfers from a non-pipe source at most this many bytes per call
+#define SPLICE_BOUNCE_SIZE  PIPE_BUFFER_SIZE
+
+// Call the Read method of a device, without the kernel lock if it is FOPS_UNLOCKED
+static int device_read(FCB* fcb, char* buf, unsigned int size){
+	if(!(fcb->streamfunc->flags & FOPS_UNLOCKED))
+		return fcb->streamfunc->Read(fcb->streamobj, buf, size);
+
+	kernel_unlock();
+	int rc = fcb->streamfunc->Read(fcb->streamobj, buf, size);
+	kernel_lock();
+	return rc;
+}
+
+// Call the Write method of a device, without the kernel lock if it is FOPS_UNLOCKED
+static int device_write(FCB* fcb, const char* buf, unsigned int size){
+	if(!(fcb->streamfunc->flags & FOPS_UNLOCKED))
+		return fcb->streamfunc->Write(fcb->streamobj, buf, size);
+
+	kernel_unlock();
+	int rc = fcb->streamfunc->Write(fcb->streamobj, buf, size);
+	kernel_lock();
+	return rc;
+}
+
+// The pipe read by a FCB, or NULL if it is not a pipe (or connected socket)
+static pipeCB* pipe_source(FCB* fcb){
+	return (fcb->streamfunc == &R || fcb->streamfunc == &SR) ? fcb->streamobj : socket_read_pipe(fcb);
+}
+
+// The pipe written by a FCB, or NULL if it is not a pipe (or connected socket)
+static pipeCB* pipe_sink(FCB* fcb){
+	return (fcb->streamfunc == &W || fcb->streamfunc == &SW) ? fcb->streamobj : socket_write_pipe(fcb);
+}
+
+// Move (or copy, for Tee) bytes from the head of src to the tail of dst
+static int splice_pipe_to_pipe(pipeCB* src, pipeCB* dst, unsigned int size, 
+	int nb_in, int nb_out, int consume)
+{
+	// Lock both sides, but do not sleep for space in dst holding the lock of src
+	for(;;) {
+		int rc = reader_lock(src, NONBLOCK_TIMEOUT(nb_in), 1);
+		if(rc <= 0)
+			return rc;
+
+		unsigned int used = PIPE_USED(src);
+		rc = writer_lock(dst, (size < used) ? size : used, 0, 0, 1);
+		if(rc > 0)
+			break;
+
+		Mutex_Unlock(&src->rlock);
+		if(rc != WOULDBLOCK || nb_out)
+			return rc;
+		park_writer(dst, 1, NO_TIMEOUT, 1);
+	}
+
+	unsigned int n = pipe_space(dst);
+	unsigned int used = PIPE_USED(src);
+	if(n > used) n = used;
+	if(n > size) n = size;
+
+	// Copy the (at most two) spans of src into dst
+	unsigned int idx = src->r_position % src->size;
+	unsigned int span = src->size - idx;
+	if(n <= span)
+		ring_copy_in(dst, dst->w_position, src->buffer + idx, n);
+	else {
+		ring_copy_in(dst, dst->w_position, src->buffer + idx, span);
+		ring_copy_in(dst, dst->w_position + span, src->buffer, n - span);
+	}
+
+	if(consume)
+		reader_consumed(src, n);
+	writer_produced(dst, n);
+
+	Mutex_Unlock(&dst->wlock);
+	Mutex_Unlock(&src->rlock);
+
+	if(consume)
+		wake_writers(src, 1);
+	wake_readers(dst, 1);
+	return n;
+}
+
+// Move bytes from the head of src to a device, by calling its Write method on the ring
+static int splice_pipe_to_device(pipeCB* src, FCB* out, unsigned int size, int nb_in){
+	int rc = reader_lock(src, NONBLOCK_TIMEOUT(nb_in), 1);
+	if(rc <= 0)
+		return rc;
+
+	// The claim keeps the buffer in place after the reader side is unlocked
+	unsigned int used = PIPE_USED(src);
+	unsigned int n = (size < used) ? size : used;
+	unsigned int pos = src->r_position;
+	STORE(src->claimed, n);
+	Mutex_Unlock(&src->rlock);
+
+	unsigned int count = 0;
+	while(count < n) {
+		unsigned int idx = (pos + count) % src->size;
+		unsigned int span = src->size - idx;
+		if(span > n - count)
+			span = n - count;
+
+		rc = device_write(out, src->buffer + idx, span);
+		if(rc <= 0)
+			break;
+		count += rc;
+	}
+
+	// Bytes that the device did not take stay in the pipe
+	Mutex_Lock(&src->rlock);
+	STORE(src->claimed, 0);
+	reader_consumed(src, count);
+	Mutex_Unlock(&src->rlock);
+
+	wake_writers(src, 1);
+	wake_readers(src, 1);
+
+	return (count > 0) ? count : rc;
+}
+
+// Move the bytes read from a device into the space reserved for them in dst
+static int splice_commit(pipeCB* dst, const char* buffer, unsigned int reserved, int rc){
+	Mutex_Lock(&dst->wlock);
+	STORE(dst->reserved, dst->reserved - reserved);
+	if(rc > 0) {
+		if(LOAD(dst->reader) != NULL) {
+			ring_copy_in(dst, dst->w_position, buffer, rc);
+			writer_produced(dst, rc);
+		} else
+			rc = -1;
+	}
+	Mutex_Unlock(&dst->wlock);
+
+	// Space that was reserved but not used is free again
+	if(rc < (int) reserved)
+		wake_writers(dst, 1);
+	if(rc > 0)
+		wake_readers(dst, 1);
+	return rc;
+}
+
+// Move bytes from a device to any stream, through a bounce buffer
+static int splice_device(FCB* in, FCB* out, pipeCB* dst, unsigned int size, int nb_out){
+	if(size > SPLICE_BOUNCE_SIZE)
+		size = SPLICE_BOUNCE_SIZE;
+
+	// Reserve room in the destination pipe for the data taken from the device
+	if(dst != NULL) {
+		int rc = writer_lock(dst, size, 0, NONBLOCK_TIMEOUT(nb_out), 1);
+		if(rc <= 0)
+			return rc;
+		if(size > pipe_space(dst))
+			size = pipe_space(dst);
+		STORE(dst->reserved, dst->reserved + size);
+		Mutex_Unlock(&dst->wlock);
+	}
+
+	char buffer[SPLICE_BOUNCE_SIZE];
+	int rc = device_read(in, buffer, size);
+	if(dst != NULL)
+		return splice_commit(dst, buffer, size, rc);
+	if(rc <= 0)
+		return rc;
+
+	unsigned int n = rc, count = 0;
+	while(count < n) {
+		rc = device_write(out, buffer + count, n - count);
+		if(rc <= 0)
+			break;
+		count += rc;
+	}
+
+	return (count > 0) ? count : rc;
+}
+
+static int do_splice(Fid_t fin, Fid_t fout, unsigned int size, int flags, int consume){
+	FCB* in = get_fcb(fin);
+	FCB* out = get_fcb(fout);
+
+	if(in == NULL || out == NULL || (flags & ~SPLICE_NONBLOCK))
+		return -1;
+	if(in->streamfunc->Read == NULL || out->streamfunc->Write == NULL)
+		return -1;
+
+	pipeCB* src = pipe_source(in);
+	pipeCB* dst = pipe_sink(out);
+
+	// Splicing a pipe into itself never makes progress
+	if(src != NULL && src == dst)
+		return -1;
+	// Message boundaries would be lost
+	if((src != NULL && (src->flags & PIPE_MESSAGE)) || (dst != NULL && (dst->flags & PIPE_MESSAGE)))
+		return -1;
+
+	// Segmented pipes are accessed as plain streams
+	if(src != NULL && (src->flags & PIPE_SEGMENTED))
+		src = NULL;
+	if(dst != NULL && (dst->flags & PIPE_SEGMENTED))
+		dst = NULL;
+
+	// Tee only copies between pipes
+	if(!consume && (src == NULL || dst == NULL))
+		return -1;
+	if(size == 0)
+		return 0;
+
+	int nb_in = (flags & SPLICE_NONBLOCK) || (in->flags & FID_NONBLOCK);
+	int nb_out = (flags & SPLICE_NONBLOCK) || (out->flags & FID_NONBLOCK);
+
+	/* make sure that the streams will not be closed (by another thread) 
+	   while we are using them! */
+	FCB_incref(in);
+	FCB_incref(out);
+
+	int rc;
+	if(src != NULL && dst != NULL)
+		rc = splice_pipe_to_pipe(src, dst, size, nb_in, nb_out, consume);
+	else if(src != NULL)
+		rc = splice_pipe_to_device(src, out, size, nb_in);
+	else
+		rc = splice_device(in, out, dst, size, nb_out);
+
+	FCB_decref(in);
+	FCB_decref(out);
+	return rc;
+}
+
+int sys_Splice(Fid_t in, Fid_t out, unsigned int size, int flags){
+	return do_splice(in, out, size, flags, 1);
+}
+
+int sys_Tee(Fid_t in, Fid_t out, unsigned int size, int flags){
+	return do_splice(in, out, size, flags, 0);
+}
+
+// The segmented pipe read by a FCB, or NULL
+static pipeCB* segmented_source(FCB* fcb){
+	return (fcb != NULL && fcb->streamfunc == &SR) ? fcb->streamobj : NULL;
+}
+
+int sys_ReadZC(Fid_t fd, const char** data, unsigned int size){
+	FCB* fcb = get_fcb(fd);
+	pipeCB* pipe = segmented_source(fcb);
+	if(pipe == NULL || data == NULL)
+		return -1;
+	if(size == 0)
+		return 0;
+
+	FCB_incref(fcb);
+
+	int rc = reader_lock(pipe, NONBLOCK_TIMEOUT(fcb->flags & FID_NONBLOCK), 1);
+	if(rc > 0) {
+		// Lend out as much of the first segment as requested
+		pipe_segment* seg = pipe->segments.next->obj;
+		unsigned int n = seg->length - seg->offset;
+		if(n > size)
+			n = size;
+
+		pipe_lease* lease = xmalloc(sizeof(pipe_lease));
+		rlnode_init(&lease->node, lease);
+		lease->seg = seg;
+		lease->data = *data = seg->data + seg->offset;
+		lease->length = n;
+		rlist_push_back(&pipe->leased, &lease->node);
+		seg->leases++;
+		STORE(pipe->lent, pipe->lent + n);
+
+		segment_consumed(pipe, seg, n);
+		reader_consumed(pipe, n);
+		Mutex_Unlock(&pipe->rlock);
+
+		wake_writers(pipe, 1);
+		rc = n;
+	}
+
+	FCB_decref(fcb);
+	return rc;
+}
+
+int sys_ReleaseZC(Fid_t fd, const char* data){
+	pipeCB* pipe = segmented_source(get_fcb(fd));
+	if(pipe == NULL)
+		return -1;
+
+	// Each pointer is released once; an unknown pointer is an error
+	for(rlnode* p = pipe->leased.next; p != &pipe->leased; p = p->next) {
+		pipe_lease* lease = p->obj;
+		if(lease->data == data) {
+			rlist_remove(&lease->node);
+			STORE(pipe->lent, pipe->lent - lease->length);
+			lease->seg->leases--;
+			segment_release(lease->seg);
+			free(lease);
+
+			// The released bytes make room for writers
+			wake_writers(pipe, 1);
+			return 0;
+		}
+	}
+	return -1;
+}
+
+void pipe_shut_reader(pipeCB* pipe){
+	STORE(pipe->reader, NULL);
+	// wake up write end
+	kernel_broadcast(&pipe->has_space.cv);
+}
+
+void pipe_shut_writer(pipeCB* pipe){
+	STORE(pipe->writer, NULL);
+	// wake up read end
+	kernel_broadcast(&pipe->has_data.cv);
 }
 
 // Close reader end
@@ -123,15 +1197,12 @@ int pipe_reader_close(void* pipe){
 		return NOFILE;
 
 	pipeCB* pipe_in_use = (pipeCB*) pipe;
-	pipe_in_use->reader = NULL;
+	pipe_shut_reader(pipe_in_use);
 
+	// If both ends are closed, free pipe
 	if(pipe_in_use->writer == NULL)
-		// If both ends are closed, free pipe
-		free(pipe_in_use);
-	else
-		// else wake up write end
-		kernel_broadcast(&pipe_in_use->has_space);
-	
+		pipe_destroy(pipe_in_use);
+
 	return 0;
 }
 
@@ -142,14 +1213,11 @@ int pipe_writer_close(void* pipe){
 		return NOFILE;
 
 	pipeCB* pipe_in_use = (pipeCB*) pipe;
-	pipe_in_use->writer = NULL;
-	
+	pipe_shut_writer(pipe_in_use);
+
+	// If both ends are closed, free pipe
 	if(pipe_in_use->reader == NULL)
-		// If both ends are closed, free pipe
-		free(pipe_in_use);
-	else
-		// else wake up read end
-		kernel_broadcast(&pipe_in_use->has_data);
+		pipe_destroy(pipe_in_use);
 
 	return 0;
-}
\ No newline at end of file
+}
@@ -5,10 +5,79 @@
 #include "tinyos.h"
 #include "util.h"
 
-// References
+/**
+	@brief Create a pipe control block between two FCBs.
+
+	The buffer of the new pipe starts small and grows on demand up to
+	@c limit bytes (rounded to a power of two between @c PIPE_MIN_SIZE 
+	and @c PIPE_MAX_SIZE). The @c flags are those of @c PipeEx.
+	The caller must connect the FCBs to the pipe.
+*/
+pipeCB* pipe_create(FCB* reader, FCB* writer, unsigned int limit, int flags);
+
+/**
+	@brief Initialize a pipe control block in memory owned by the caller.
+
+	This is @ref pipe_create for a pipe embedded in another object (e.g. 
+	a socket connection). Closing both ends of such a pipe does not free it; 
+	the owner calls @ref pipe_release instead, once the pipe is unused.
+*/
+void pipe_init(pipeCB* pipe, FCB* reader, FCB* writer, unsigned int limit, int flags);
+
+/**
+	@brief Free the buffers of a pipe initialized by @ref pipe_init.
+*/
+void pipe_release(pipeCB* pipe);
+
+/**
+	@brief Set the options of the reader side of a pipe (see @c SetSockOpt).
+
+	Readers wait until the pipe holds @c lowat bytes (at least 1), or for at
+	most @c timeout usec (@c NO_TIMEOUT for no limit).
+*/
+void pipe_set_reader_options(pipeCB* pipe, unsigned int lowat, TimerDuration timeout);
+
+/**
+	@brief Set the options of the writer side of a pipe.
+
+	Writers wait for space for at most @c timeout usec (@c NO_TIMEOUT for no limit).
+	If @c cork is not 0, writers wake up the readers only once @c cork bytes
+	are stored, or before they sleep for space.
+*/
+void pipe_set_writer_options(pipeCB* pipe, TimerDuration timeout, unsigned int cork);
+
+/**
+	@brief The number of times a reader of the pipe has slept, waiting for data.
+*/
+unsigned long pipe_reader_sleeps(pipeCB* pipe);
+
+/**
+	@brief Close one end of a pipe, without freeing the pipe.
+
+	Readers see EOF once the writer is shut, and writers fail once the
+	reader is shut, exactly as when the end is closed. These are called 
+	with the kernel lock held.
+*/
+void pipe_shut_reader(pipeCB* pipe);
+void pipe_shut_writer(pipeCB* pipe);
+
+/**
+	@brief Change the buffer size limit of a pipe.
+*/
+void pipe_set_limit(pipeCB* pipe, unsigned int limit);
+
+// References; the I/O functions are called with the kernel lock held (e.g. by sockets)
 int pipe_read(void* pipe, char* buf, unsigned int size);
 int pipe_write(void* pipe, const char* buf, unsigned int size);
+int pipe_readv(void* pipe, const iovec_t* iov, int iovcnt);
+int pipe_writev(void* pipe, const iovec_t* iov, int iovcnt);
 int pipe_reader_close(void* pipe);
 int pipe_writer_close(void* pipe);
 
+// The same I/O functions, called without the kernel lock
+int pipe_read_unlocked(void* pipe, char* buf, unsigned int size);
+int pipe_write_unlocked(void* pipe, const char* buf, unsigned int size);
+int pipe_readv_unlocked(void* pipe, const iovec_t* iov, int iovcnt);
+int pipe_writev_unlocked(void* pipe, const iovec_t* iov, int iovcnt);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,215 @@
+#include "kernel_pool.h"
+#include "kernel_sys.h"
+#include "kernel_cc.h"
+
+/* The pools that have been used, in order of first use */
+static object_pool* pool_list = NULL;
+static object_pool** pool_list_tail = &pool_list;
+static Mutex pool_list_lock = MUTEX_INIT;
+
+/* The space taken by each object in a slab */
+static unsigned int pool_stride(object_pool* pool)
+{
+	unsigned int size = (pool->size < sizeof(void*)) ? sizeof(void*) : pool->size;
+	return (size + pool->align - 1) & ~(pool->align - 1);
+}
+
+/* Add a slab of free objects to the pool, holding its lock */
+static void pool_grow(object_pool* pool)
+{
+	unsigned int stride = pool_stride(pool);
+	unsigned int count = (stride < POOL_SLAB_SIZE) ? POOL_SLAB_SIZE / stride : 1;
+	char* slab = xmalloc_aligned(pool->align, (size_t) count * stride);
+
+	for(unsigned int i = count; i > 0; i--) {
+		void** obj = (void**) (slab + (size_t)(i-1) * stride);
+		*obj = pool->free_list;
+		pool->free_list = obj;
+	}
+	pool->stats.slabs++;
+	pool->stats.cached += count;
+
+	/* List the pool for PoolStats, on its first slab */
+	if(! pool->registered) {
+		pool->registered = 1;
+		strncpy(pool->stats.name, pool->name, sizeof(pool->stats.name)-1);
+		pool->stats.object_size = pool->size;
+
+		Mutex_Lock(&pool_list_lock);
+		*pool_list_tail = pool;
+		pool_list_tail = &pool->next;
+		Mutex_Unlock(&pool_list_lock);
+	}
+}
+
+
+/*
+	Per-core caches. A core moves POOL_CACHE_SIZE/2 objects between its cache
+	and the free list at a time, holding the lock of the pool. For the counters
+	under the lock, the objects in the caches are in use; PoolStats corrects 
+	this.
+
+	Turning preemption off costs a system call of the host, so a cache has
+	a lock of its own instead. It is only contended when a thread is 
+	preempted, or moves to another core, while using the cache. Then the 
+	other thread uses the free list of the pool.
+ */
+#define POOL_BATCH (POOL_CACHE_SIZE/2)
+
+/* The cache of the current core, locked, or NULL if it is busy */
+static pool_cache* lock_cache(object_pool* pool)
+{
+	pool_cache* caches = __atomic_load_n(&pool->caches, __ATOMIC_ACQUIRE);
+	if(caches == NULL) {
+		Mutex_Lock(&pool->lock);
+		if(pool->caches == NULL) {
+			caches = xmalloc_aligned(CACHE_LINE, MAX_CORES * sizeof(pool_cache));
+			memset(caches, 0, MAX_CORES * sizeof(pool_cache));
+			__atomic_store_n(&pool->caches, caches, __ATOMIC_RELEASE);
+		}
+		caches = pool->caches;
+		Mutex_Unlock(&pool->lock);
+	}
+
+	pool_cache* cache = &caches[cpu_core_id];
+	return Mutex_TryLock(&cache->lock) ? cache : NULL;
+}
+
+/* Fill an empty cache with a batch of objects, holding the lock */
+static void cache_refill(object_pool* pool, pool_cache* cache)
+{
+	while(cache->count < POOL_BATCH) {
+		if(pool->free_list == NULL)
+			pool_grow(pool);
+		void** obj = pool->free_list;
+		pool->free_list = *obj;
+		cache->obj[cache->count++] = obj;
+	}
+	pool->stats.cached -= POOL_BATCH;
+	pool->stats.in_use += POOL_BATCH;
+	if(pool->stats.in_use > pool->stats.peak)
+		pool->stats.peak = pool->stats.in_use;
+}
+
+/* Return a batch of objects from a full cache, holding the lock */
+static void cache_flush(object_pool* pool, pool_cache* cache)
+{
+	for(unsigned int i = 0; i < POOL_BATCH; i++) {
+		void** obj = cache->obj[--cache->count];
+		*obj = pool->free_list;
+		pool->free_list = obj;
+	}
+	pool->stats.cached += POOL_BATCH;
+	pool->stats.in_use -= POOL_BATCH;
+}
+
+/* Allocate from the cache of the current core; return NULL if it is busy */
+static void* cache_alloc(object_pool* pool)
+{
+	pool_cache* cache = lock_cache(pool);
+	if(cache == NULL)
+		return NULL;
+
+	if(cache->count == 0) {
+		Mutex_Lock(&pool->lock);
+		cache_refill(pool, cache);
+		Mutex_Unlock(&pool->lock);
+	}
+	void* obj = cache->obj[--cache->count];
+	cache->allocs++;
+	Mutex_Unlock(&cache->lock);
+	return obj;
+}
+
+/* Free to the cache of the current core; return 0 if it is busy */
+static int cache_free(object_pool* pool, void* obj)
+{
+	pool_cache* cache = lock_cache(pool);
+	if(cache == NULL)
+		return 0;
+
+	if(cache->count == POOL_CACHE_SIZE) {
+		Mutex_Lock(&pool->lock);
+		cache_flush(pool, cache);
+		Mutex_Unlock(&pool->lock);
+	}
+	cache->obj[cache->count++] = obj;
+	Mutex_Unlock(&cache->lock);
+	return 1;
+}
+
+
+void* pool_alloc(object_pool* pool)
+{
+	if(pool->percore) {
+		void* obj = cache_alloc(pool);
+		if(obj != NULL)
+			return obj;
+	}
+
+	Mutex_Lock(&pool->lock);
+
+	if(pool->free_list == NULL)
+		pool_grow(pool);
+
+	void** obj = pool->free_list;
+	pool->free_list = *obj;
+
+	pool->stats.cached--;
+	pool->stats.in_use++;
+	pool->stats.allocs++;
+	if(pool->stats.in_use > pool->stats.peak)
+		pool->stats.peak = pool->stats.in_use;
+
+	Mutex_Unlock(&pool->lock);
+	return obj;
+}
+
+
+void pool_free(object_pool* pool, void* obj)
+{
+	assert(obj != NULL);
+	if(pool->percore && cache_free(pool, obj))
+		return;
+
+	Mutex_Lock(&pool->lock);
+
+	*(void**) obj = pool->free_list;
+	pool->free_list = obj;
+	pool->stats.in_use--;
+	pool->stats.cached++;
+
+	Mutex_Unlock(&pool->lock);
+}
+
+
+int sys_PoolStats(unsigned int index, pool_stats* stats)
+{
+	if(stats == NULL)
+		return -1;
+
+	Mutex_Lock(&pool_list_lock);
+	object_pool* pool = pool_list;
+	while(pool != NULL && index > 0) {
+		pool = pool->next;
+		index--;
+	}
+	Mutex_Unlock(&pool_list_lock);
+
+	if(pool == NULL)
+		return -1;
+
+	Mutex_Lock(&pool->lock);
+	*stats = pool->stats;
+	if(pool->caches != NULL) {
+		/* The counts of other cores may be changing; this is a snapshot */
+		for(unsigned int c = 0; c < MAX_CORES; c++) {
+			unsigned int count = __atomic_load_n(&pool->caches[c].count, __ATOMIC_RELAXED);
+			stats->cached += count;
+			stats->in_use -= count;
+			stats->allocs += __atomic_load_n(&pool->caches[c].allocs, __ATOMIC_RELAXED);
+		}
+	}
+	Mutex_Unlock(&pool->lock);
+	return 0;
+}
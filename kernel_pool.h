@@ -0,0 +1,98 @@
+#ifndef __KERNEL_POOL_H
+#define __KERNEL_POOL_H
+
+#include "tinyos.h"
+#include "util.h"
+
+/**
+	@file kernel_pool.h
+	@brief Object pools for kernel control blocks.
+
+	@defgroup pools Object pools.
+	@ingroup kernel
+	@brief Object pools for kernel control blocks.
+
+	Kernel objects that are created and destroyed at a high rate (e.g. the
+	control blocks of pipes and sockets) are allocated from pools of
+	fixed-size objects. A pool takes memory from the heap in slabs of
+	many objects, and keeps freed objects for reuse, so that churn does
+	not fragment the heap. Slabs are never returned to the heap, thus the
+	memory of a pool is bounded by the peak number of its objects.
+
+	A pool is declared statically with @ref POOL_INIT, and is safe to use
+	with or without the kernel lock. Its usage counters are returned to
+	programs by @c PoolStats.
+
+	A pool declared with @ref POOL_INIT_PERCORE also keeps a small cache
+	of free objects for each core. Allocation and release use the cache 
+	of the current core, and take the lock of the pool only to move half
+	a cache of objects at a time.
+
+	@{
+*/
+
+#define CACHE_LINE 64	/* alignment that keeps fields written by different cores apart */
+
+/** @brief The number of free objects in a per-core cache. */
+#define POOL_CACHE_SIZE 32
+
+/** @brief The free objects of a pool kept by one core. */
+typedef struct pool_cache
+{
+	_Alignas(CACHE_LINE) Mutex lock;	/**< @brief Taken by the core using the cache */
+	unsigned int count;			/**< @brief The number of objects in @c obj */
+	unsigned long allocs;		/**< @brief Allocations from this cache */
+	void* obj[POOL_CACHE_SIZE];	/**< @brief The free objects */
+} pool_cache;
+
+/** @brief A pool of objects of the same size. */
+typedef struct object_pool
+{
+	const char* name;			/**< @brief The kind of object, reported by @c PoolStats */
+	unsigned int size;			/**< @brief The object size */
+	unsigned int align;			/**< @brief The object alignment, a power of two */
+
+	Mutex lock;					/**< @brief Protects the fields below */
+	void* free_list;			/**< @brief Free objects, linked through their first word */
+	pool_stats stats;			/**< @brief Usage counters */
+	int registered;				/**< @brief Set when the pool is listed for @c PoolStats */
+	struct object_pool* next;	/**< @brief The next listed pool */
+	int percore;				/**< @brief Set if the pool has per-core caches */
+	pool_cache* caches;			/**< @brief The cache of each core, allocated on first use */
+} object_pool;
+
+/** 
+	@brief Static initializer for a pool of objects of @c SIZE bytes, aligned to @c ALIGN bytes.
+ */
+#define POOL_INIT(NAME, SIZE, ALIGN) \
+	{ .name = (NAME), .size = (SIZE), .align = (ALIGN), .lock = MUTEX_INIT, \
+	  .free_list = NULL, .registered = 0, .next = NULL }
+
+/** 
+	@brief Static initializer for a pool with per-core caches.
+
+	The objects in the caches count as in use for @c peak, which is 
+	updated when a cache is refilled.
+ */
+#define POOL_INIT_PERCORE(NAME, SIZE, ALIGN) \
+	{ .name = (NAME), .size = (SIZE), .align = (ALIGN), .lock = MUTEX_INIT, \
+	  .free_list = NULL, .registered = 0, .next = NULL, .percore = 1, .caches = NULL }
+
+/** @brief The size of the slabs that pools take from the heap. */
+#define POOL_SLAB_SIZE (64*1024)
+
+/**
+	@brief Allocate an object from a pool.
+
+	The contents of the object are undefined.
+*/
+void* pool_alloc(object_pool* pool);
+
+/**
+	@brief Return an object to its pool.
+*/
+void pool_free(object_pool* pool, void* obj);
+
+/** @} */
+
+#endif
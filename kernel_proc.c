@@ -23,18 +23,49 @@ static file_ops procinfo_ops = {
     .Close = procinfo_close,
 };
 
-/* The process table */
-PCB PT[MAX_PROC];
+/* 
+  The process table.
+
+  The table is an array of chunks of PCBs, allocated as more processes
+  are needed. A pid is the index of its PCB in the table, plus a 
+  generation number (above PID_INDEX_BITS) that changes every time the 
+  PCB is released. Thus a stale pid does not match the PCB when it is
+  reused, and get_pcb() returns NULL.
+
+  Free PCBs are kept in a FIFO list (linked by their parent field), so 
+  that a PCB is reused as late as possible.
+ */
+#define PID_INDEX_BITS 20
+#define PID_INDEX_MASK ((1u << PID_INDEX_BITS) - 1)
+#define PID_GENERATIONS (1u << (31 - PID_INDEX_BITS))
+#define PT_CHUNK 1024
+
+_Static_assert(MAX_PROC <= (1u << PID_INDEX_BITS), "MAX_PROC must fit in the index of a pid");
+
+static PCB* PT[MAX_PROC / PT_CHUNK];
+static unsigned int PT_size;	/* PCBs allocated */
 unsigned int process_count;
 
+static PCB* pcb_freelist;
+static PCB* pcb_freelist_tail;
+
+/* The used (alive or zombie) PCBs, in the order of creation, for OpenInfo */
+static rlnode live_pcbs;
+
 PCB* get_pcb(Pid_t pid)
 {
-  return PT[pid].pstate==FREE ? NULL : &PT[pid];
+  if(pid < 0) return NULL;
+
+  unsigned int index = pid & PID_INDEX_MASK;
+  if(index >= PT_size) return NULL;
+
+  PCB* pcb = &PT[index / PT_CHUNK][index % PT_CHUNK];
+  return (pcb->pstate==FREE || pcb->pid != pid) ? NULL : pcb;
 }
 
 Pid_t get_pid(PCB* pcb)
 {
-  return pcb==NULL ? NOPROC : pcb-PT;
+  return pcb==NULL ? NOPROC : pcb->pid;
 }
 
 /* Initialize a PCB */
@@ -46,34 +77,61 @@ static inline void initialize_PCB(PCB* pcb)
   //new
   pcb->thread_count = 0;
 
-  for(int i=0;i<MAX_FILEID;i++)
-    pcb->FIDT[i] = NULL;
+  pcb->FIDT = NULL;
+  pcb->fid_limit = MAX_FILEID;
 
   rlnode_init(& pcb->children_list, NULL);
   rlnode_init(& pcb->exited_list, NULL);
   rlnode_init(& pcb->children_node, pcb);
   rlnode_init(& pcb->exited_node, pcb);
   rlnode_init(& pcb->ptcb_list, NULL);
+  rlnode_init(& pcb->live_node, pcb);
   pcb->child_exit = COND_INIT;
+  pcb->exit_cv = COND_INIT;
 }
 
 
-static PCB* pcb_freelist;
+/* Append a free PCB to the free list */
+static void pcb_freelist_append(PCB* pcb)
+{
+  pcb->parent = NULL;
+  if(pcb_freelist == NULL)
+    pcb_freelist = pcb;
+  else
+    pcb_freelist_tail->parent = pcb;
+  pcb_freelist_tail = pcb;
+}
 
-void initialize_processes(){
-  /* initialize the PCBs */
-  for(Pid_t p=0; p<MAX_PROC; p++) {
-    initialize_PCB(&PT[p]);
+
+/* Add a chunk of free PCBs to the process table, if it is not full */
+static int grow_PT()
+{
+  if(PT_size == MAX_PROC)
+    return 0;
+
+  PCB* chunk = xmalloc(PT_CHUNK * sizeof(PCB));
+  PT[PT_size / PT_CHUNK] = chunk;
+  for(unsigned int i=0; i<PT_CHUNK; i++) {
+    initialize_PCB(&chunk[i]);
+    chunk[i].pid = PT_size + i;
+    pcb_freelist_append(&chunk[i]);
   }
+  PT_size += PT_CHUNK;
+  return 1;
+}
+
 
-  /* use the parent field to build a free list */
-  PCB* pcbiter;
-  pcb_freelist = NULL;
-  for(pcbiter = PT+MAX_PROC; pcbiter!=PT; ) {
-    --pcbiter;
-    pcbiter->parent = pcb_freelist;
-    pcb_freelist = pcbiter;
+void initialize_processes(){
+  /* Drop the table of a previous boot */
+  for(unsigned int c=0; c < PT_size / PT_CHUNK; c++) {
+    free(PT[c]);
+    PT[c] = NULL;
   }
+  PT_size = 0;
+  pcb_freelist = pcb_freelist_tail = NULL;
+  rlnode_init(& live_pcbs, NULL);
+
+  grow_PT();
 
   process_count = 0;
 
@@ -89,10 +147,12 @@ void initialize_processes(){
 PCB* acquire_PCB(){
   PCB* pcb = NULL;
 
-  if(pcb_freelist != NULL) {
+  if(pcb_freelist != NULL || grow_PT()) {
     pcb = pcb_freelist;
     pcb->pstate = ALIVE;
     pcb_freelist = pcb_freelist->parent;
+    memset(&pcb->usage, 0, sizeof(rusage_t));
+    rlist_push_back(& live_pcbs, & pcb->live_node);
     process_count++;
   }
 
@@ -103,9 +163,13 @@ PCB* acquire_PCB(){
   Must be called with kernel_mutex held
 */
 void release_PCB(PCB* pcb){
+  /* The next pid of this PCB is in the next generation */
+  unsigned int generation = ((unsigned int) pcb->pid >> PID_INDEX_BITS) + 1;
+  pcb->pid = ((generation % PID_GENERATIONS) << PID_INDEX_BITS) | (pcb->pid & PID_INDEX_MASK);
+
   pcb->pstate = FREE;
-  pcb->parent = pcb_freelist;
-  pcb_freelist = pcb;
+  rlist_remove(& pcb->live_node);
+  pcb_freelist_append(pcb);
   process_count--;
 }
 
@@ -135,9 +199,11 @@ void start_main_thread()
 
 
 /*
-	System call to create a new process.
+	Create a new process, for Exec and Spawn.
  */
-Pid_t sys_Exec(Task call, int argl, void* args){
+static Pid_t create_process(Task call, int argl, void* args,
+  const spawn_file_action* actions, unsigned int nactions)
+{
   PCB *curproc, *newproc;
   
   /* The new process PCB */
@@ -158,23 +224,29 @@ Pid_t sys_Exec(Task call, int argl, void* args){
     /* Add new process to the parent's child list */
     newproc->parent = curproc;
     rlist_push_front(& curproc->children_list, & newproc->children_node);
+  }
 
-    /* Inherit file streams from parent */
-    for(int i=0; i<MAX_FILEID; i++) {
-       newproc->FIDT[i] = curproc->FIDT[i];
-       if(newproc->FIDT[i])
-          FCB_incref(newproc->FIDT[i]);
-    }
+  /* Inherit file streams from parent */
+  initialize_FIDT(newproc, newproc->parent);
+
+  /* Apply the file actions of Spawn, or undo everything */
+  if(apply_file_actions(newproc, actions, nactions) != 0) {
+    release_FIDT(newproc);
+    if(newproc->parent != NULL)
+      rlist_remove(& newproc->children_node);
+    release_PCB(newproc);
+    return NOPROC;
   }
 
 
   /* Set the main thread's function */
   newproc->main_task = call;
 
-  /* Copy the arguments to new storage, owned by the new process */
+  /* Copy the arguments to new storage, owned by the new process.
+     Small arguments are kept in the PCB. */
   newproc->argl = argl;
   if(args!=NULL) {
-    newproc->args = malloc(argl);
+    newproc->args = (argl <= PCB_INLINE_ARGS) ? newproc->argbuf : xmalloc(argl);
     memcpy(newproc->args, args, argl);
   }
   else
@@ -186,38 +258,9 @@ Pid_t sys_Exec(Task call, int argl, void* args){
     the initialization of the PCB.
    */
 
-  /**PTCB Initialization**/
-
   if(call != NULL) {
-
-    /*Here we dont change any values of the main_thread (already initialized in CreateThread). 
-    We only make tcb point to newproc and add new ptcb to newprocs ptcb list*/
-
-    //initialization of new ptcb
-    PTCB* ptcb = (PTCB*)xmalloc(sizeof(PTCB)); //acquire space for ptcb
-    
-    ptcb->task = call;
-    ptcb->argl = argl;
-    ptcb->args = (args == NULL ? NULL : args);
-
-    ptcb->refcount = 0;
-    ptcb->exited = 0;
-    ptcb->detached = 0;
-    ptcb->exit_cv = COND_INIT;
-
-    //initialization of new tcb
-    TCB* tcb  = spawn_thread(newproc, start_main_thread); 
-    
-    newproc->main_thread = tcb;
-    tcb->ptcb = ptcb;
-    ptcb->tcb = tcb;
-
-    //adding ptcb to newprocs ptcb list
-    rlnode_init(&ptcb->ptcb_list_node, ptcb); //Init the PTCB node, make it point itself!
-    rlist_push_back(&newproc->ptcb_list, &ptcb->ptcb_list_node); // Insert the new PTCB at the list of current PCB.
-
-    // +1 thread to PCB
-    newproc->thread_count++;
+    PTCB* ptcb = spawn_ptcb(newproc, call, argl, newproc->args, start_main_thread);
+    newproc->main_thread = ptcb->tcb;
 
     // make new thread(tcb) READY
     wakeup(ptcb->tcb);
@@ -228,6 +271,24 @@ Pid_t sys_Exec(Task call, int argl, void* args){
 }
 
 
+/*
+	System call to create a new process.
+ */
+Pid_t sys_Exec(Task call, int argl, void* args)
+{
+  return create_process(call, argl, args, NULL, 0);
+}
+
+
+Pid_t sys_Spawn(Task call, int argl, void* args,
+  const spawn_file_action* actions, unsigned int nactions)
+{
+  if(nactions > 0 && actions == NULL)
+    return NOPROC;
+  return create_process(call, argl, args, actions, nactions);
+}
+
+
 /* System call */
 Pid_t sys_GetPid()
 {
@@ -248,6 +309,7 @@ static void cleanup_zombie(PCB* pcb, int* status)
 
   rlist_remove(& pcb->children_node);
   rlist_remove(& pcb->exited_node);
+  release_ptcbs(pcb);
 
   release_PCB(pcb);
 }
@@ -256,12 +318,6 @@ static void cleanup_zombie(PCB* pcb, int* status)
 static Pid_t wait_for_specific_child(Pid_t cpid, int* status)
 {
 
-  /* Legality checks */
-  if((cpid<0) || (cpid>=MAX_PROC)) {
-    cpid = NOPROC;
-    goto finish;
-  }
-
   PCB* parent = CURPROC;
   PCB* child = get_pcb(cpid);
   if( child == NULL || child->parent != parent)
@@ -270,9 +326,16 @@ static Pid_t wait_for_specific_child(Pid_t cpid, int* status)
     goto finish;
   }
 
-  /* Ok, child is a legal child of mine. Wait for it to exit. */
-  while(child->pstate == ALIVE)
-    kernel_wait(& parent->child_exit, SCHED_USER);
+  /* Ok, child is a legal child of mine. Wait for it to exit. If another
+     thread reaps it meanwhile, the PCB may be reused, under a new pid. */
+  while(child->pid == cpid && child->pstate == ALIVE && child->parent == parent)
+    kernel_wait(& child->exit_cv, SCHED_USER);
+
+  /* Another thread may have reaped it meanwhile */
+  if(child->pid != cpid || child->pstate != ZOMBIE || child->parent != parent) {
+    cpid = NOPROC;
+    goto finish;
+  }
   
   cleanup_zombie(child, status);
   
@@ -311,6 +374,45 @@ static Pid_t wait_for_any_child(int* status)
 }
 
 
+int sys_WaitChildren(Pid_t* pids, int* status, unsigned int max, timeout_t timeout)
+{
+  if(pids == NULL || max == 0)
+    return -1;
+
+  PCB* parent = CURPROC;
+
+  /* The timeout is in msec, and a negative timeout means no timeout */
+  TimerDuration deadline = ((long) timeout < 0) ? NO_TIMEOUT : bios_clock() + timeout*1000ul;
+
+  /* Wait for some child to exit */
+  while(is_rlist_empty(& parent->exited_list)) {
+    if(is_rlist_empty(& parent->children_list))
+      return -1;
+
+    TimerDuration wait = NO_TIMEOUT;
+    if(deadline != NO_TIMEOUT) {
+      TimerDuration now = bios_clock();
+      if(now >= deadline)
+        return 0;
+      wait = deadline - now;
+    }
+    kernel_timedwait(& parent->child_exit, SCHED_USER, wait);
+  }
+
+  /* Reap as many as we can */
+  unsigned int count = 0;
+  while(count < max && ! is_rlist_empty(& parent->exited_list)) {
+    PCB* child = parent->exited_list.next->pcb;
+    assert(child->pstate == ZOMBIE);
+    pids[count] = get_pid(child);
+    cleanup_zombie(child, (status != NULL) ? &status[count] : NULL);
+    count++;
+  }
+
+  return count;
+}
+
+
 Pid_t sys_WaitChild(Pid_t cpid, int* status)
 {
   /* Wait for specific child. */
@@ -344,51 +446,92 @@ void sys_Exit(int exitval)
 }
 
 
-int procinfo_read(void* procinfo, char *buf, unsigned int size){
+/* Check a PCB against the filter of an info stream */
+static int procinfo_match(const procinfo_filter* f, PCB* pcb)
+{
+  /* The idle process is not shown */
+  if(pcb->pid == 0)
+    return 0;
+  if((f->match & PROCINFO_MATCH_PPID) && get_pid(pcb->parent) != f->ppid)
+    return 0;
+  if((f->match & PROCINFO_MATCH_STATE) && (pcb->pstate == ALIVE) != (f->alive != 0))
+    return 0;
+  if((f->match & PROCINFO_MATCH_PIDS) && (pcb->pid < f->min_pid || pcb->pid > f->max_pid))
+    return 0;
+  return 1;
+}
 
-  procinfo_cb* info = (procinfo_cb *)procinfo;
 
-  if(info == NULL)
-    return NOFILE;
+/* Add the usage counters of a thread, read atomically, to a sum */
+void rusage_fold(rusage_t* sum, const rusage_t* usage)
+{
+  unsigned long* dst = (unsigned long*) sum;
+  const unsigned long* src = (const unsigned long*) usage;
+  for(unsigned int i = 0; i < sizeof(rusage_t)/sizeof(unsigned long); i++)
+    dst[i] += __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+}
 
-  //Loop to scan PT array
-  while(info->pcb_cursor < MAX_PROC){
-    
-    if(PT[info->pcb_cursor].pstate != FREE){
+/* The usage of a process: its exited threads, plus the live ones */
+static void rusage_copy(PCB* pcb, rusage_t* usage)
+{
+  *usage = pcb->usage;
+  for(rlnode* n = pcb->ptcb_list.next; n != &pcb->ptcb_list; n = n->next) {
+    PTCB* ptcb = n->obj;
+    if(! ptcb->exited)
+      rusage_fold(usage, &ptcb->tcb->usage);
+  }
+}
 
-      PCB* current_pcb = &PT[info->pcb_cursor];  
-      
-      //Take information from PCB
-      info->process_info.pid = get_pid(current_pcb);
-      info->process_info.ppid = get_pid(current_pcb->parent);   
+/* Fill in the record of a PCB */
+static void procinfo_fill(PCB* pcb, procinfo* pi)
+{
+  pi->pid = get_pid(pcb);
+  pi->ppid = get_pid(pcb->parent);
 
-      //Zombie or Alive?
-      info->process_info.alive = current_pcb->pstate == ZOMBIE ? 0 : 1;
+  //Zombie or Alive?
+  pi->alive = pcb->pstate == ZOMBIE ? 0 : 1;
 
-      //Passing PCB's args
-      info->process_info.main_task = current_pcb->main_task;
-      info->process_info.argl = current_pcb->argl;
-      info->process_info.thread_count = current_pcb->thread_count;
+  //Passing PCB's args
+  pi->main_task = pcb->main_task;
+  pi->argl = pcb->argl;
+  pi->thread_count = pcb->thread_count;
+  rusage_copy(pcb, &pi->usage);
 
-      if(current_pcb->args != NULL){
-        memcpy(info->process_info.args, current_pcb->args, info->process_info.argl);
-      }
+  if(pcb->args != NULL)
+    memcpy(pi->args, pcb->args, 
+      (pcb->argl < PROCINFO_MAX_ARGS_SIZE) ? pcb->argl : PROCINFO_MAX_ARGS_SIZE);
+}
 
-      //Storing data from procinfo to the buffer
-      memcpy(buf, (char *)&info->process_info, sizeof(info->process_info));
 
-      //Increase Cursor Pointer
-      info->pcb_cursor++;
+int procinfo_read(void* procinfo_obj, char *buf, unsigned int size){
 
-      return sizeof(info->process_info);
-    }
+  procinfo_cb* info = (procinfo_cb *)procinfo_obj;
 
-    //If pstate is FREE just increase the cursor pointer by 1
-    info->pcb_cursor++;
+  if(info == NULL || size < sizeof(procinfo))
+    return NOFILE;
+
+  /* 
+    Scan the used PCBs after the cursor, for as many records as fit in buf. 
+    Nodes with a NULL pcb are the cursors of other streams.
+   */
+  unsigned int count = 0;
+  rlnode* node = info->cursor.next;
+  while(node != &live_pcbs && (count+1) * sizeof(procinfo) <= size) {
+    PCB* pcb = node->pcb;
+    if(pcb != NULL && procinfo_match(&info->filter, pcb)) {
+      procinfo pi;
+      procinfo_fill(pcb, &pi);
+      memcpy(buf + count*sizeof(procinfo), &pi, sizeof(procinfo));
+      count++;
+    }
+    node = node->next;
   }
 
-  //Having checked the entire array, return -1
-  return NOFILE;
+  /* Move the cursor just before the next node to scan */
+  rlist_remove(&info->cursor);
+  rl_splice(node->prev, &info->cursor);
+
+  return count * sizeof(procinfo);
 }
 
 int procinfo_close(void* procinfo){
@@ -398,34 +541,35 @@ int procinfo_close(void* procinfo){
   if(proc_info == NULL)
     return NOFILE;
   else{
+    rlist_remove(&proc_info->cursor);
     free(proc_info);
     return 0;
   }
 }
 
 
-Fid_t sys_OpenInfo()
+Fid_t sys_OpenInfoEx(const procinfo_filter* filter)
 {
   Fid_t fid;
   FCB* fcb;
 
+  if(filter != NULL && (filter->match & ~(PROCINFO_MATCH_PPID|PROCINFO_MATCH_STATE|PROCINFO_MATCH_PIDS)))
+    return NOFILE;
+
   //Reserve a position for the FCB
-  int exit_value = FCB_reserve(1, &fid, &fcb);
-  
-  if(exit_value == 0){
+  if(! FCB_reserve(1, &fid, &fcb))
     return NOFILE;
-  }
 
   //Procinfo Block Creation
   procinfo_cb* info = (procinfo_cb *)xmalloc(sizeof(procinfo_cb));
-  
-  if(info == NULL){
-    return NOFILE;
-  }
-  else{
-    //Set the cursor at the top of the array
-    info->pcb_cursor = 1;
-  }
+  if(filter != NULL)
+    info->filter = *filter;
+  else
+    memset(&info->filter, 0, sizeof(info->filter));
+
+  //Set the cursor at the top of the list
+  rlnode_init(&info->cursor, NULL);
+  rlist_push_front(&live_pcbs, &info->cursor);
 
   //FCB_Init
   fcb->streamobj= info; 
@@ -434,3 +578,20 @@ Fid_t sys_OpenInfo()
   //Return the Id
   return fid;
 }
+
+
+Fid_t sys_OpenInfo()
+{
+  return sys_OpenInfoEx(NULL);
+}
+
+
+int sys_GetRusage(Pid_t pid, rusage_t* usage)
+{
+  PCB* pcb = (pid == NOPROC) ? CURPROC : get_pcb(pid);
+  if(pcb == NULL || usage == NULL)
+    return -1;
+
+  rusage_copy(pcb, usage);
+  return 0;
+}
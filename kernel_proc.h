@@ -31,6 +31,9 @@ typedef enum pid_state_e {
   ZOMBIE  /**< @brief The PID is held by a zombie */
 } pid_state;
 
+/** @brief Arguments of @c Exec up to this size are stored in the PCB */
+#define PCB_INLINE_ARGS 64
+
 /**
   @brief Process Control Block.
 
@@ -38,6 +41,7 @@ typedef enum pid_state_e {
  */
 typedef struct process_control_block {
   pid_state  pstate;      /**< @brief The pid state for this PCB */
+  Pid_t pid;              /**< @brief The pid of the process (see kernel_proc.c) */
 
   PCB* parent;            /**< @brief Parent's pcb. */
   int exitval;            /**< @brief The exit value of the process */
@@ -46,6 +50,7 @@ typedef struct process_control_block {
   Task main_task;         /**< @brief The main thread's function */
   int argl;               /**< @brief The main thread's argument length */
   void* args;             /**< @brief The main thread's argument string */
+  char argbuf[PCB_INLINE_ARGS]; /**< @brief Storage for small @c args */
 
   rlnode children_list;   /**< @brief List of children */
   rlnode exited_list;     /**< @brief List of exited children */
@@ -54,6 +59,7 @@ typedef struct process_control_block {
   rlnode exited_node;     /**< @brief Intrusive node for @c exited_list */
 
   rlnode ptcb_list;       /**< @brief List of PTCBs*/
+  rlnode live_node;       /**< @brief Intrusive node for the list of used PCBs (see @c OpenInfo) */
 
 
   int thread_count;       /**< @brief Number of threads under this process */
@@ -62,9 +68,20 @@ typedef struct process_control_block {
 
                              This condition variable is  broadcast each time a child
                              process terminates. It is used in the implementation of
-                             @c WaitChild() */
+                             @c WaitChild(NOPROC) */
+
+  CondVar exit_cv;        /**< @brief Broadcast when this process terminates.
+
+                             A @c WaitChild for this process waits here, so that 
+                             it is not woken by the exit of the other children. */
 
-  FCB* FIDT[MAX_FILEID];  /**< @brief The fileid table of the process */
+  struct fid_table* FIDT; /**< @brief The fileid table of the process (see kernel_streams.h) */
+  unsigned int fid_limit; /**< @brief The limit of file ids, set by @c SetFileLimit */
+
+  rusage_t usage;         /**< @brief Resource usage of the exited threads.
+
+                             Each thread counts its own usage in its TCB, and adds it
+                             here when it exits (see @c GetRusage). */
 
 } PCB;
 
@@ -80,9 +97,9 @@ int procinfo_close(void* procinfo);
  * */
 typedef struct procinfo_cb {
   
-  procinfo process_info;  //Process Information
+  procinfo_filter filter; //The processes to return
   
-  int pcb_cursor;         //cursor of a PCB on PT(Process Table)
+  rlnode cursor;          //Position in the list of live PCBs, after the last PCB returned
 
 } procinfo_cb;
 
@@ -119,6 +136,46 @@ PCB* get_pcb(Pid_t pid);
 */
 Pid_t get_pid(PCB* pcb);
 
+/**
+  @brief Create a thread in a process, with its PTCB.
+
+  The thread is added to the threads of @c pcb, but it is not woken up.
+
+  @param pcb the process of the new thread
+  @param task the function of the thread, called with @c argl and @c args
+  @param func the function run by the new TCB (see @c spawn_thread)
+  @returns the new PTCB
+*/
+PTCB* spawn_ptcb(PCB* pcb, Task task, int argl, void* args, void (*func)());
+
+/**
+  @brief Free the PTCBs left in a process that has exited.
+*/
+void release_ptcbs(PCB* pcb);
+
+/**
+  @brief Add to a usage counter of the current thread.
+
+  Only the thread changes its counters, without the kernel lock. 
+  Others may read them at any time (see @ref rusage_fold), so the
+  counter is stored whole, but without a locked instruction.
+
+  @param counter a field of the @c usage of the current TCB
+  @param n the amount to add
+*/
+static inline void rusage_add(unsigned long* counter, unsigned long n)
+{
+  __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+/**
+  @brief Add the usage counters of a thread to a sum.
+
+  @param sum the sum, e.g. the @c usage of a PCB
+  @param usage the @c usage of a TCB, which may be changing
+*/
+void rusage_fold(rusage_t* sum, const rusage_t* usage);
+
 /** @} */
 
 #endif
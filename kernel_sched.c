@@ -173,6 +173,7 @@ TCB* spawn_thread(PCB* pcb, void (*func)())
 	tcb->rts = QUANTUM;
 	tcb->last_cause = SCHED_IDLE;
 	tcb->curr_cause = SCHED_IDLE;
+	tcb->usage = (rusage_t) { 0 };
 
 	tcb->priority = PRIORITY_QUEUES - 1; /**Every new thread has the highest priority*/
 
@@ -303,6 +304,23 @@ static void sched_make_ready(TCB* tcb)
 		sched_queue_add(tcb);
 }
 
+/*
+  Move every ready thread to the next higher priority queue.
+
+  *** MUST BE CALLED WITH sched_spinlock HELD ***
+*/
+static void sched_boost_priorities()
+{
+	// Starting from the 2nd highest to the lowest priority queue
+	for (int i = PRIORITY_QUEUES - 2; i >= 0; i--){
+		while (!is_rlist_empty(&SCHED[i])){
+			rlnode* rlnode_tcb = rlist_pop_front(&SCHED[i]);
+			rlnode_tcb->tcb->priority++;
+			rlist_push_back(&SCHED[i+1], rlnode_tcb);
+		}
+	}
+}
+
 /*
   Scan the \c TIMEOUT_LIST for threads whose timeout has expired, and
   wake them up.
@@ -412,14 +430,37 @@ void sleep_releasing(Thread_state state, Mutex* mx, enum SCHED_CAUSE cause,
 		preempt_on;
 }
 
+/* 
+	Add the time used by a thread since the start of its time slice, or
+	its last charge, to its usage. The timer counts down from rts.
+*/
+static inline void sched_charge(TCB* tcb, TimerDuration remaining)
+{
+	if (tcb->rts > remaining)
+		rusage_add(&tcb->usage.cpu_time, tcb->rts - remaining);
+}
+
+void sched_charge_exit()
+{
+	int preempt = preempt_off;
+
+	TCB* current = CURTHREAD;
+	TimerDuration remaining = bios_cancel_timer();
+	sched_charge(current, remaining);
+	current->rts = remaining;
+
+	/* Keep the rest of the slice; a timer of 0 would never expire */
+	bios_set_timer(remaining > 0 ? remaining : 1);
+
+	if (preempt)
+		preempt_on;
+}
+
 /* This function is the entry point to the scheduler's context switching */
 
 void yield(enum SCHED_CAUSE cause)
 {
 
-	/*Increase yield() counter*/
-	yield_counter++;
-
 	/* Reset the timer, so that we are not interrupted by ALARM */
 	TimerDuration remaining = bios_cancel_timer();
 
@@ -434,6 +475,12 @@ void yield(enum SCHED_CAUSE cause)
 	if (current->state == RUNNING)
 		current->state = READY;
 
+	/* Charge the time on the core since the start of the slice, or the
+	   last charge. An exited thread was charged by sched_charge_exit(),
+	   and its usage has been added to its process. */
+	if (current->state != EXITED)
+		sched_charge(current, remaining);
+
 	/* Update CURTHREAD scheduler data */
 	current->rts = remaining;
 	current->last_cause = current->curr_cause;
@@ -470,10 +517,22 @@ void yield(enum SCHED_CAUSE cause)
 			break;
 	}
 
+	/* Boost priority of all threads after BOOST_PRIORITY amount of yields are called */
+	if(++yield_counter >= BOOST_PRIORITY){
+		sched_boost_priorities();
+		yield_counter = 0;
+	}
+
 	/* Get next */
 	TCB* next = sched_queue_select(current);
 	assert(next != NULL);
 
+	if (current != next && current->state != EXITED) {
+		rusage_add(&current->usage.switches, 1);
+		if (cause == SCHED_QUANTUM)
+			rusage_add(&current->usage.preemptions, 1);
+	}
+
 	/* Save the current TCB for the gain phase */
 	CURCORE.previous_thread = current;
 
@@ -486,31 +545,6 @@ void yield(enum SCHED_CAUSE cause)
 	}
 	/**At this line because of swap_context, the next thread is executed.**/
 
-	// Boost priority of all threads after BOOST_PRIORITY amount of yields are called
-	if(yield_counter >= BOOST_PRIORITY){
-		// helper rlnode pointer and tcb pointer
-		rlnode* rlnode_tcb;
-		TCB* tcb;
-    
-    	// Increase priority of all threads by 1 queue
-		// Starting from the 2nd highest to the lowest priority queue
-		for (int i = PRIORITY_QUEUES - 2; i >= 0; i--){
-      		// Checks if queue is empty
-			if (!is_rlist_empty(&SCHED[i])){
-        		// For each thread inside the queue, pop queue -> get popped rlnode -> push_back rlnode to higher priority queue
-				for(int j = 0; j < rlist_len(&SCHED[i]); j++){
-					rlnode_tcb = rlist_pop_front(&SCHED[i]);
-					tcb = rlnode_tcb->tcb;
-					rlist_push_back(&SCHED[i+1], rlnode_tcb);
-					tcb->priority++;
-				}
-			}	
-		}
-
-		// Reset yield_counter
-		yield_counter = 0;
-	}
-
 	/* This is where we get after we are switched back on! A long time
 	   may have passed. Start a new timeslice...
 	  */
@@ -145,6 +145,7 @@ typedef struct thread_control_block {
 	rlnode sched_node; /**< @brief Node to use when queueing in the scheduler queue */
 	TimerDuration its; /**< @brief Initial time-slice for this thread */
 	TimerDuration rts; /**< @brief Remaining time-slice for this thread */
+	rusage_t usage; /**< @brief Resource usage of the thread (see @c GetRusage) */
 
 	enum SCHED_CAUSE curr_cause; /**< @brief The endcause for the current time-slice */
 	enum SCHED_CAUSE last_cause; /**< @brief The endcause for the last time-slice */
@@ -287,6 +288,16 @@ void sleep_releasing(Thread_state newstate, Mutex* mx, enum SCHED_CAUSE cause, T
  */
 void yield(enum SCHED_CAUSE cause);
 
+/**
+  @brief Charge the current thread's time on the core to its usage.
+
+  The scheduler charges each thread at the end of its time slices. 
+  An exiting thread calls this to charge the partial slice, before
+  its usage is added to its process. The thread keeps the rest of its slice.
+  @see GetRusage
+ */
+void sched_charge_exit();
+
 /**
   @brief Enter the scheduler.
 
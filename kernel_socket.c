@@ -3,27 +3,216 @@
 #include "kernel_socket.h"
 #include "kernel_cc.h"
 #include "kernel_pipe.h"
+#include "kernel_pool.h"
 
 //static int counter=0;
 
+// Sockets and connection requests are allocated from pools, as connections are often short-lived
+static object_pool socket_pool = POOL_INIT("socketCB", sizeof(socketCB), sizeof(void*));
+static object_pool request_pool = POOL_INIT("connection_request", sizeof(connection_request), sizeof(void*));
+static object_pool connection_pool = POOL_INIT("connection", sizeof(connection), CACHE_LINE);
+
+/*
+	The port map is a hash table of the ports that have listeners. Each entry
+	lists the listeners of its port. A port has more than one listener only
+	if they all set SOCKOPT_REUSEPORT.
+*/
+#define PORT_BUCKETS 256
+
+static port_entry* port_map[PORT_BUCKETS];
+static object_pool port_pool = POOL_INIT("port_entry", sizeof(port_entry), sizeof(void*));
+
+// The link to the entry of a port in its bucket (pointing to NULL if there is none)
+static port_entry** port_slot(port_t port){
+	port_entry** slot = &port_map[port % PORT_BUCKETS];
+	while(*slot != NULL && (*slot)->port != port)
+		slot = &(*slot)->next;
+	return slot;
+}
+
+static void port_add_listener(socketCB* socket){
+	port_entry** slot = port_slot(socket->port);
+	if(*slot == NULL) {
+		port_entry* entry = pool_alloc(&port_pool);
+		entry->port = socket->port;
+		rlnode_new(&entry->listeners);
+		entry->next = NULL;
+		*slot = entry;
+	}
+	rlnode_init(&socket->listener_s.port_node, socket);
+	rlist_push_back(&(*slot)->listeners, &socket->listener_s.port_node);
+}
+
+static void port_remove_listener(socketCB* socket){
+	port_entry** slot = port_slot(socket->port);
+	port_entry* entry = *slot;
+
+	rlist_remove(&socket->listener_s.port_node);
+	if(is_rlist_empty(&entry->listeners)) {
+		*slot = entry->next;
+		pool_free(&port_pool, entry);
+	}
+}
+
+/*
+	Choose the listener of a port for a new connection request, or return NULL.
+	A listener with an idle acceptor is preferred, else the one with the fewest
+	pending requests. The chosen listener goes to the back of the list, so that 
+	ties are broken in round-robin order. Listeners with a full queue are 
+	skipped.
+*/
+static socketCB* port_listener(port_t port){
+	port_entry* entry = *port_slot(port);
+	if(entry == NULL)
+		return NULL;
+
+	socketCB* best = NULL;
+	for(rlnode* p = entry->listeners.next; p != &entry->listeners; p = p->next) {
+		socketCB* lsocket = p->obj;
+		if(lsocket->listener_s.pending >= lsocket->listener_s.backlog)
+			continue;
+		if(lsocket->listener_s.acceptors > lsocket->listener_s.pending) {
+			best = lsocket;
+			break;
+		}
+		if(best == NULL || lsocket->listener_s.pending < best->listener_s.pending)
+			best = lsocket;
+	}
+
+	// All the queues are full; the first listener will refuse the request
+	if(best == NULL)
+		return entry->listeners.next->obj;
+
+	rlist_remove(&best->listener_s.port_node);
+	rlist_push_back(&entry->listeners, &best->listener_s.port_node);
+	return best;
+}
+
+// Buffer size limit for the pipe from socket src to socket dst
+static unsigned int buffer_limit(socketCB* src, socketCB* dst){
+	if(dst->rcvbuf != 0)
+		return dst->rcvbuf;
+	if(src->sndbuf != 0)
+		return src->sndbuf;
+	return PIPE_BUFFER_SIZE;
+}
+
+/*
+	The I/O methods of sockets run without the kernel lock (FOPS_UNLOCKED), 
+	directly on the rings of the connection. Accept publishes the pipes of
+	a socket before it makes it a peer, and ShutDown clears them, but the 
+	pipes stay allocated until the socket is closed.
+*/
+static pipeCB* peer_read_pipe(socketCB* socket){
+	if(__atomic_load_n(&socket->type, __ATOMIC_ACQUIRE) != SOCKET_PEER)
+		return NULL;
+	return __atomic_load_n(&socket->peer_s.read_pipe, __ATOMIC_ACQUIRE);
+}
+
+static pipeCB* peer_write_pipe(socketCB* socket){
+	if(__atomic_load_n(&socket->type, __ATOMIC_ACQUIRE) != SOCKET_PEER)
+		return NULL;
+	return __atomic_load_n(&socket->peer_s.write_pipe, __ATOMIC_ACQUIRE);
+}
+
+// A timeout option in usec, as the pipes take it
+static TimerDuration option_timeout(unsigned int msec){
+	return (msec == 0) ? NO_TIMEOUT : msec * 1000ul;
+}
+
+// Pass the options of a connected socket to its pipes
+static void apply_options(socketCB* socket){
+	if(socket->peer_s.read_pipe != NULL)
+		pipe_set_reader_options(socket->peer_s.read_pipe, socket->rcvlowat, option_timeout(socket->rcvtimeo));
+	if(socket->peer_s.write_pipe != NULL)
+		pipe_set_writer_options(socket->peer_s.write_pipe, option_timeout(socket->sndtimeo), socket->cork);
+}
+
 int socket_read(void* this, char *buf, unsigned int size){
 	
-	socketCB* socket = (socketCB*) this;
+	pipeCB* pipe = peer_read_pipe((socketCB*) this);
 
-	if(socket->type != SOCKET_PEER || socket->peer_s.read_pipe == NULL)
+	if(pipe == NULL)
 		return NOFILE;
 
-	return pipe_read(socket->peer_s.read_pipe, buf, size);
+	return pipe_read_unlocked(pipe, buf, size);
 }
 
 int socket_write(void* this, const char *buf, unsigned int size){
 	
-	socketCB* socket = (socketCB*) this;
+	pipeCB* pipe = peer_write_pipe((socketCB*) this);
 
-	if(socket->type != SOCKET_PEER || socket->peer_s.write_pipe == NULL)
+	if(pipe == NULL)
 		return NOFILE;
 
-	return pipe_write(socket->peer_s.write_pipe, buf, size);
+	return pipe_write_unlocked(pipe, buf, size);
+}
+
+int socket_readv(void* this, const iovec_t* iov, int iovcnt){
+	
+	pipeCB* pipe = peer_read_pipe((socketCB*) this);
+
+	if(pipe == NULL)
+		return NOFILE;
+
+	return pipe_readv_unlocked(pipe, iov, iovcnt);
+}
+
+int socket_writev(void* this, const iovec_t* iov, int iovcnt){
+	
+	pipeCB* pipe = peer_write_pipe((socketCB*) this);
+
+	if(pipe == NULL)
+		return NOFILE;
+
+	return pipe_writev_unlocked(pipe, iov, iovcnt);
+}
+
+// Shut down the read or write direction of a connected socket, waking up RecvFid
+static void shut_read(socketCB* socket){
+	if(socket->peer_s.read_pipe != NULL) {
+		pipe_shut_reader(socket->peer_s.read_pipe);
+		__atomic_store_n(&socket->peer_s.read_pipe, NULL, __ATOMIC_RELEASE);
+		kernel_broadcast(&socket->peer_s.recv_fids->arrived);
+	}
+}
+
+static void shut_write(socketCB* socket){
+	if(socket->peer_s.write_pipe != NULL) {
+		pipe_shut_writer(socket->peer_s.write_pipe);
+		__atomic_store_n(&socket->peer_s.write_pipe, NULL, __ATOMIC_RELEASE);
+		kernel_broadcast(&socket->peer_s.send_fids->arrived);
+	}
+}
+
+/*
+	The streams sent with SendFid wait in a fid_queue of the connection, 
+	holding a reference to their FCB, until RecvFid installs them in the
+	file table of the receiver.
+*/
+static void fid_queue_init(fid_queue* q){
+	q->head = 0;
+	q->count = 0;
+	q->arrived = COND_INIT;
+}
+
+static void fid_queue_push(fid_queue* q, FCB* fcb){
+	q->fcb[(q->head + q->count) % MAX_FILEID] = fcb;
+	q->count++;
+	kernel_signal(&q->arrived);
+}
+
+static FCB* fid_queue_pop(fid_queue* q){
+	FCB* fcb = q->fcb[q->head];
+	q->head = (q->head + 1) % MAX_FILEID;
+	q->count--;
+	return fcb;
+}
+
+// Close the streams that were never received
+static void fid_queue_drain(fid_queue* q){
+	while(q->count > 0)
+		FCB_decref(fid_queue_pop(q));
 }
 
 int socket_close(void* this){
@@ -32,14 +221,33 @@ int socket_close(void* this){
 
 	switch (socket->type){
 		case SOCKET_LISTENER:
-			PORT_MAP[socket->port] = NULL;
+			port_remove_listener(socket);
 			socket->port = NOPORT;
 			kernel_broadcast(&socket->listener_s.req_available);
+
+			// Refuse the pending requests
+			while(! is_rlist_empty(&socket->listener_s.queue)) {
+				connection_request* req = rlist_pop_front(&socket->listener_s.queue)->obj;
+				req->admitted = -1;
+				kernel_broadcast(&req->connected_cv);
+			}
+
+			// The last thread to leave Accept frees the socket
+			if(socket->listener_s.acceptors > 0)
+				return 0;
 			break;
 
 		case SOCKET_PEER:
-			pipe_reader_close(socket->peer_s.read_pipe);
-			pipe_writer_close(socket->peer_s.write_pipe);
+			shut_read(socket);
+			shut_write(socket);
+			fid_queue_drain(socket->peer_s.recv_fids);
+
+			// The second socket to close frees the connection
+			if(--socket->peer_s.conn->refcount == 0) {
+				pipe_release(&socket->peer_s.conn->pipe[0]);
+				pipe_release(&socket->peer_s.conn->pipe[1]);
+				pool_free(&connection_pool, socket->peer_s.conn);
+			}
 			break;
 
 		case SOCKET_UNBOUND:
@@ -47,7 +255,7 @@ int socket_close(void* this){
 			break;
 	}	
 
-	free(socket);
+	pool_free(&socket_pool, socket);
 	return 0;
 }
 
@@ -55,9 +263,28 @@ file_ops socket_ops = {
   .Open = NULL,
   .Read = socket_read,
   .Write = socket_write,
-  .Close = socket_close
+  .Close = socket_close,
+  .ReadV = socket_readv,
+  .WriteV = socket_writev,
+  .flags = FOPS_UNLOCKED
 };
 
+pipeCB* socket_read_pipe(FCB* fcb){
+	if(fcb->streamfunc != &socket_ops)
+		return NULL;
+
+	socketCB* socket = (socketCB*) fcb->streamobj;
+	return (socket->type == SOCKET_PEER) ? socket->peer_s.read_pipe : NULL;
+}
+
+pipeCB* socket_write_pipe(FCB* fcb){
+	if(fcb->streamfunc != &socket_ops)
+		return NULL;
+
+	socketCB* socket = (socketCB*) fcb->streamobj;
+	return (socket->type == SOCKET_PEER) ? socket->peer_s.write_pipe : NULL;
+}
+
 Fid_t sys_Socket(port_t port) {
 	//Check if port is valid
     if(port < 0 || port > MAX_PORT){
@@ -73,21 +300,38 @@ Fid_t sys_Socket(port_t port) {
 	}
 
 	// Init socketCB
-	socketCB* socket = (socketCB*) xmalloc(sizeof(socketCB));
-
-	fcb[0]->streamobj = socket;
-	fcb[0]->streamfunc = &socket_ops;
+	socketCB* socket = (socketCB*) pool_alloc(&socket_pool);
 
 	socket->port = port;
 	socket->fcb = fcb[0];
 	socket->refcount = 0;
 	socket->type = SOCKET_UNBOUND;
+	socket->sndbuf = 0;
+	socket->rcvbuf = 0;
+	socket->message = 0;
+	socket->reuseport = 0;
+	socket->rcvlowat = 1;
+	socket->rcvtimeo = 0;
+	socket->sndtimeo = 0;
+	socket->cork = 0;
+
+	// Unlocked I/O may pin the FCB as soon as it has its methods, so publish
+	// them last: a recycled socketCB must not be seen before it is initialized
+	fcb[0]->streamobj = socket;
+	__atomic_store_n(&fcb[0]->streamfunc, &socket_ops, __ATOMIC_RELEASE);
 
     return fid[0];
 }
 
 int sys_Listen(Fid_t sock) {
+	return sys_ListenEx(sock, LISTEN_BACKLOG);
+}
+
+int sys_ListenEx(Fid_t sock, unsigned int backlog) {
 	
+	if(backlog < 1 || backlog > MAX_BACKLOG)
+		return NOFILE;
+
 	FCB* fcb = get_fcb(sock); // Get FCB from Fid table
 	
 	// Verify FCB valid and refers to a socket
@@ -107,125 +351,180 @@ int sys_Listen(Fid_t sock) {
 	// Port of socket
 	port_t port = socket->port;
 
-	// Check if port is bound by another listener 
-	if(PORT_MAP[port] != NULL && PORT_MAP[port]->type == SOCKET_LISTENER) 
-		return NOFILE;
+	// Check if port is bound by another listener, unless they all reuse the port
+	port_entry* entry = *port_slot(port);
+	if(entry != NULL) {
+		socketCB* other = entry->listeners.next->obj;
+		if(!(socket->reuseport && other->reuseport))
+			return NOFILE;
+	}
 
-	// Install socket to PORT_MAP and mark it as listener
+	// Install socket to the port map and mark it as listener
 	socket->type = SOCKET_LISTENER;
 	rlnode_init(&socket->listener_s.queue, NULL);
 	socket->listener_s.req_available = COND_INIT;
-	PORT_MAP[port] = socket;
+	socket->listener_s.pending = 0;
+	socket->listener_s.backlog = backlog;
+	socket->listener_s.peak = 0;
+	socket->listener_s.acceptors = 0;
+	socket->listener_s.accepted = 0;
+	socket->listener_s.rejected = 0;
+	port_add_listener(socket);
 
 	return 0;
 }
 
-Fid_t sys_Accept(Fid_t lsock) {
-	
+/*
+	Wait until a listener has a pending request. Returns the listener, or NULL
+	if lsock is not a listener, or it is non-blocking and has no requests, or
+	it was closed while we waited.
+*/
+static socketCB* wait_request(Fid_t lsock) {
+
 	FCB* lsocket_fcb = get_fcb(lsock); // Get FCB from Fid table
 	
 	// Verify FCB valid and refers to a socket
 	if(lsocket_fcb == NULL || lsocket_fcb->streamfunc != &socket_ops)
-		return NOFILE;
+		return NULL;
 
 	socketCB* lsocket = (socketCB*)lsocket_fcb->streamobj; // Get lsocket from streamobj of FCB
 
 	// Socket must be bound to a port
 	if(lsocket->port == NOPORT)
-		return NOFILE;
+		return NULL;
 
 	// Socket must be listener socket
 	if(lsocket->type != SOCKET_LISTENER)
-		return NOFILE;
+		return NULL;
 
-	// While reqest queue is empty wait for signal
-	while (is_rlist_empty(&lsocket->listener_s.queue)){ 
-		kernel_wait(&lsocket->listener_s.req_available, SCHED_PIPE);
-		
-		// Check if port is still valid
-		if(lsocket->port == NOPORT)
-			return NOFILE;
+	// Non-blocking listener does not wait for requests
+	if(is_rlist_empty(&lsocket->listener_s.queue) && (lsocket_fcb->flags & FID_NONBLOCK))
+		return NULL;
 
+	// While request queue is empty wait for signal (one acceptor is signalled per request)
+	while (is_rlist_empty(&lsocket->listener_s.queue) && lsocket->port != NOPORT){ 
+		lsocket->listener_s.acceptors++;
+		kernel_wait(&lsocket->listener_s.req_available, SCHED_PIPE);
+		lsocket->listener_s.acceptors--;
 	}
 
-	if(PORT_MAP[lsocket->port] == NULL){
-		lsocket = NULL;
-		return NOFILE;
+	// Check if port is still valid; the socket was closed while we waited
+	if(lsocket->port == NOPORT) {
+		if(lsocket->listener_s.acceptors == 0)
+			pool_free(&socket_pool, lsocket);
+		return NULL;
 	}
-	
+
+	return lsocket;
+}
+
+/*
+	Connect the first pending request of a listener to a new socket. 
+	Returns the file id of the new socket, or NOFILE if it cannot be created.
+*/
+static Fid_t admit_request(socketCB* lsocket) {
+
 	// Create new peer socket to connect with socket that sent the connect request
 	Fid_t peer1_fid = sys_Socket(lsocket->port);
-	if(peer1_fid == NOFILE)
+	if(peer1_fid == NOFILE) {
+		// Pass the request on to another acceptor
+		kernel_signal(&lsocket->listener_s.req_available);
 		return NOFILE;
+	}
 
 	FCB* peer1_FCB = get_fcb(peer1_fid);
 	socketCB* peer1 = (socketCB*) peer1_FCB->streamobj;
 
-	if(peer1 == NULL)
-		return NOFILE;
-
 	// Get connection request from listener's queue
 	connection_request* req = (connection_request*) rlist_pop_front(&lsocket->listener_s.queue)->obj;	
 	assert(req != NULL);	
+	lsocket->listener_s.pending--;
+	lsocket->listener_s.accepted++;
 
 	// Request was admitted
 	req->admitted = 1;
 
 	// Initialize new peer socket from connection request
-	Fid_t peer2_fid = req->peer_fid;
 	FCB* peer2_FCB = req->peer->fcb;
 	socketCB* peer2 = (socketCB*) req->peer;
 
-	if(peer2 == NULL)
-		return NOFILE;
-
-	// Create pipes to connect sockets
-	// Init pipe 1
-	pipeCB* pipe1 = (pipeCB*) xmalloc(sizeof(pipeCB));
-	pipe_t pipe1_ends;
-	pipe1->reader = peer2_FCB;
-	pipe1->writer = peer1_FCB;
-	pipe1->pipe_ends = &pipe1_ends;
-	pipe1->pipe_ends->read = peer2_fid;
-	pipe1->pipe_ends->write = peer1_fid;
-	pipe1->r_position = PIPE_BUFFER_SIZE-1;
-	pipe1->w_position = 0;
-	pipe1->has_data = COND_INIT;
-	pipe1->has_space = COND_INIT;
-
-	// Init pipe 2
-	pipeCB* pipe2 = (pipeCB*) xmalloc(sizeof(pipeCB));
-	pipe_t pipe2_ends;
-	pipe2->reader = peer1_FCB;
-	pipe2->writer = peer2_FCB;
-	pipe2->pipe_ends = &pipe2_ends;
-	pipe2->pipe_ends->read = peer1_fid;
-	pipe2->pipe_ends->write = peer2_fid;
-	pipe2->r_position = PIPE_BUFFER_SIZE-1;
-	pipe2->w_position = 0;
-	pipe2->has_data = COND_INIT;
-	pipe2->has_space = COND_INIT;
-	
-	// Connect socket with pipes and change both sockets to peer sockets
-	peer1->type = SOCKET_PEER;
-	peer1->peer_s.read_pipe = pipe2;
-	peer1->peer_s.write_pipe = pipe1;
+	// Accepted socket inherits the options of the listener
+	peer1->sndbuf = lsocket->sndbuf;
+	peer1->rcvbuf = lsocket->rcvbuf;
+	peer1->message = lsocket->message;
+	peer1->rcvlowat = lsocket->rcvlowat;
+	peer1->rcvtimeo = lsocket->rcvtimeo;
+	peer1->sndtimeo = lsocket->sndtimeo;
+	peer1->cork = lsocket->cork;
+
+	// Create the connection, whose pipes connect the sockets
+	// pipe[0]: peer1 -> peer2, pipe[1]: peer2 -> peer1
+	int flags = lsocket->message ? PIPE_MESSAGE : 0;
+	connection* conn = pool_alloc(&connection_pool);
+	conn->refcount = 2;
+	pipe_init(&conn->pipe[0], peer2_FCB, peer1_FCB, buffer_limit(peer1, peer2), flags);
+	pipe_init(&conn->pipe[1], peer1_FCB, peer2_FCB, buffer_limit(peer2, peer1), flags);
+	fid_queue_init(&conn->fids[0]);
+	fid_queue_init(&conn->fids[1]);
 	
-	peer2->type = SOCKET_PEER;
-	peer2->peer_s.read_pipe = pipe1;
-	peer2->peer_s.write_pipe = pipe2;
+	// Connect socket with pipes and change both sockets to peer sockets; 
+	// the type is published last, for the I/O methods
+	peer1->peer_s.conn = conn;
+	peer1->peer_s.read_pipe = &conn->pipe[1];
+	peer1->peer_s.write_pipe = &conn->pipe[0];
+	peer1->peer_s.send_fids = &conn->fids[0];
+	peer1->peer_s.recv_fids = &conn->fids[1];
+	__atomic_store_n(&peer1->type, SOCKET_PEER, __ATOMIC_RELEASE);
+
+	peer2->peer_s.conn = conn;
+	peer2->peer_s.read_pipe = &conn->pipe[0];
+	peer2->peer_s.write_pipe = &conn->pipe[1];
+	peer2->peer_s.send_fids = &conn->fids[1];
+	peer2->peer_s.recv_fids = &conn->fids[0];
+	__atomic_store_n(&peer2->type, SOCKET_PEER, __ATOMIC_RELEASE);
+
+	apply_options(peer1);
+	apply_options(peer2);
 
-	lsocket->refcount++;
-	
 	// Signal Connect side
 	kernel_broadcast(&req->connected_cv);
 
-	// Decrease refcount of initial socket
-	lsocket->refcount--;	
-
 	return peer1_fid;
 }
 
+Fid_t sys_Accept(Fid_t lsock) {
+
+	socketCB* lsocket = wait_request(lsock);
+	if(lsocket == NULL)
+		return NOFILE;
+
+	return admit_request(lsocket);
+}
+
+int sys_AcceptBatch(Fid_t lsock, Fid_t* socks, unsigned int max, int flags) {
+
+	// Only known flags are accepted
+	if(socks == NULL || max == 0 || (flags & ~FID_NONBLOCK))
+		return NOFILE;
+
+	socketCB* lsocket = wait_request(lsock);
+	if(lsocket == NULL)
+		return NOFILE;
+
+	// Take what is in the queue, without waiting for more
+	unsigned int count = 0;
+	while(count < max && ! is_rlist_empty(&lsocket->listener_s.queue)) {
+		Fid_t fid = admit_request(lsocket);
+		if(fid == NOFILE)
+			break;
+		// Unlocked I/O reads the flags without the kernel lock, see sys_SetFlags
+		__atomic_store_n(&get_fcb(fid)->flags, flags, __ATOMIC_RELEASE);
+		socks[count++] = fid;
+	}
+
+	return (count > 0) ? (int) count : NOFILE;
+}
+
 int sys_Connect(Fid_t sock, port_t port, timeout_t timeout) {
 	
 	// Check soon to be peer socket
@@ -245,36 +544,57 @@ int sys_Connect(Fid_t sock, port_t port, timeout_t timeout) {
         return NOFILE;
 	
 	// Get Listener socket from given port
-	socketCB* lsocket = PORT_MAP[port];
+	socketCB* lsocket = port_listener(port);
 
-	// lsocket must be listener socket
-	if(lsocket == NULL || lsocket->type != SOCKET_LISTENER)
+	// There must be a listener socket
+	if(lsocket == NULL)
 		return NOFILE;
+
+	// Both sides must agree on the kind of connection
+	if(socket->message != lsocket->message)
+		return NOFILE;
+
+	// Refuse at once if the queue of the listener is full
+	if(lsocket->listener_s.pending >= lsocket->listener_s.backlog) {
+		lsocket->listener_s.rejected++;
+		return NOFILE;
+	}
 	
 	// Create connection request to lsocket
-	connection_request* req = (connection_request*) xmalloc(sizeof(connection_request));
+	connection_request* req = (connection_request*) pool_alloc(&request_pool);
 	req->admitted = 0;
 	req->peer_fid = sock;
 	req->peer = socket;
+	req->listener = lsocket;
 	req->connected_cv = COND_INIT;
 
 	rlnode_init(&req->queue_node, req);
 	rlist_push_back(&lsocket->listener_s.queue, &req->queue_node);
+	lsocket->listener_s.pending++;
+	if(lsocket->listener_s.pending > lsocket->listener_s.peak)
+		lsocket->listener_s.peak = lsocket->listener_s.pending;
+
+	// Signal one acceptor of lsocket
+	kernel_signal(&lsocket->listener_s.req_available);
 
-	// Signal lsocket 
-	kernel_broadcast(&lsocket->listener_s.req_available);
+	// The timeout is in msec, and a negative timeout means no timeout
+	TimerDuration wait = ((long) timeout < 0) ? NO_TIMEOUT : timeout*1000ul;
 
 	// Wait for request's socket to connect, if not return NOFILE
-	while(req->admitted != 1){
-		if(!(kernel_timedwait(&req->connected_cv, SCHED_PIPE, timeout)))
-			return NOFILE;
+	while(req->admitted == 0){
+		if(!(kernel_timedwait(&req->connected_cv, SCHED_PIPE, wait)))
+			break;
 	}
 
-	// socket from request served its purposey
-	lsocket->refcount--;
-	req = NULL;
+	// The request is ours to release; a request that timed out is still queued
+	int retval = (req->admitted == 1) ? 0 : NOFILE;
+	if(req->admitted == 0) {
+		rlist_remove(&req->queue_node);
+		req->listener->listener_s.pending--;
+	}
+	pool_free(&request_pool, req);
 
-	return 0;
+	return retval;
 
 }
 
@@ -293,24 +613,261 @@ int sys_ShutDown(Fid_t sock, shutdown_mode how) {
 
     switch (how) {
         case SHUTDOWN_READ:
-            pipe_reader_close(socket->peer_s.read_pipe);
-			socket->peer_s.read_pipe = NULL;
+            shut_read(socket);
             break;
 
         case SHUTDOWN_WRITE:
-            pipe_writer_close(socket->peer_s.write_pipe);
-			socket->peer_s.write_pipe = NULL;
+            shut_write(socket);
             break;
 
         case SHUTDOWN_BOTH:
-            pipe_writer_close(socket->peer_s.write_pipe);
-			socket->peer_s.write_pipe = NULL;
-            pipe_reader_close(socket->peer_s.read_pipe);
-			socket->peer_s.read_pipe = NULL;
+            shut_write(socket);
+            shut_read(socket);
             break;
 
         default:
             assert(0);
     }
     return 0;
-}
\ No newline at end of file
+}
+
+int sys_SetSockOpt(Fid_t sock, socket_option option, unsigned int value) {
+
+	FCB* socket_fcb = get_fcb(sock); // Get FCB from Fid table
+
+	// Verify FCB valid and refers to a socket
+	if(socket_fcb == NULL || socket_fcb->streamfunc != &socket_ops)
+		return NOFILE;
+
+	socketCB* socket = (socketCB*)socket_fcb->streamobj; // Get socket from streamobj of FCB
+
+	switch (option) {
+		case SOCKOPT_SNDBUF:
+			if(value < PIPE_MIN_SIZE || value > PIPE_MAX_SIZE)
+				return -1;
+			socket->sndbuf = value;
+			if(socket->type == SOCKET_PEER && socket->peer_s.write_pipe != NULL)
+				pipe_set_limit(socket->peer_s.write_pipe, value);
+			break;
+
+		case SOCKOPT_RCVBUF:
+			if(value < PIPE_MIN_SIZE || value > PIPE_MAX_SIZE)
+				return -1;
+			socket->rcvbuf = value;
+			if(socket->type == SOCKET_PEER && socket->peer_s.read_pipe != NULL)
+				pipe_set_limit(socket->peer_s.read_pipe, value);
+			break;
+
+		case SOCKOPT_MESSAGE:
+			if(value > 1 || socket->type == SOCKET_PEER)
+				return -1;
+			socket->message = value;
+			break;
+
+		case SOCKOPT_REUSEPORT:
+			if(value > 1 || socket->type != SOCKET_UNBOUND)
+				return -1;
+			socket->reuseport = value;
+			break;
+
+		case SOCKOPT_RCVLOWAT:
+			if(value > PIPE_MAX_SIZE)
+				return -1;
+			socket->rcvlowat = (value > 0) ? value : 1;
+			break;
+
+		case SOCKOPT_RCVTIMEO:
+			socket->rcvtimeo = value;
+			break;
+
+		case SOCKOPT_SNDTIMEO:
+			socket->sndtimeo = value;
+			break;
+
+		case SOCKOPT_CORK:
+			if(value > PIPE_MAX_SIZE)
+				return -1;
+			socket->cork = value;
+			break;
+
+		default:
+			return -1;
+	}
+
+	if(socket->type == SOCKET_PEER)
+		apply_options(socket);
+	return 0;
+}
+
+// The buffer size of a direction: the size of its pipe, or what the pipe will get
+static unsigned int buffer_option(pipeCB* pipe, unsigned int size){
+	if(pipe != NULL)
+		return pipe->limit;
+	return (size != 0) ? size : PIPE_BUFFER_SIZE;
+}
+
+int sys_GetSockOpt(Fid_t sock, socket_option option, unsigned int* value) {
+
+	FCB* socket_fcb = get_fcb(sock); // Get FCB from Fid table
+
+	// Verify FCB valid and refers to a socket
+	if(value == NULL || socket_fcb == NULL || socket_fcb->streamfunc != &socket_ops)
+		return NOFILE;
+
+	socketCB* socket = (socketCB*)socket_fcb->streamobj; // Get socket from streamobj of FCB
+	int peer = (socket->type == SOCKET_PEER);
+
+	switch (option) {
+		case SOCKOPT_SNDBUF:
+			*value = buffer_option(peer ? socket->peer_s.write_pipe : NULL, socket->sndbuf);
+			break;
+
+		case SOCKOPT_RCVBUF:
+			*value = buffer_option(peer ? socket->peer_s.read_pipe : NULL, socket->rcvbuf);
+			break;
+
+		case SOCKOPT_MESSAGE:
+			*value = socket->message;
+			break;
+
+		case SOCKOPT_REUSEPORT:
+			*value = socket->reuseport;
+			break;
+
+		case SOCKOPT_RCVLOWAT:
+			*value = socket->rcvlowat;
+			break;
+
+		case SOCKOPT_RCVTIMEO:
+			*value = socket->rcvtimeo;
+			break;
+
+		case SOCKOPT_SNDTIMEO:
+			*value = socket->sndtimeo;
+			break;
+
+		case SOCKOPT_CORK:
+			*value = socket->cork;
+			break;
+
+		case SOCKOPT_RCVWAKEUPS:
+			*value = (peer && socket->peer_s.read_pipe != NULL) ? pipe_reader_sleeps(socket->peer_s.read_pipe) : 0;
+			break;
+
+		default:
+			return -1;
+	}
+	return 0;
+}
+
+int sys_ListenStats(Fid_t lsock, listen_stats* stats) {
+
+	FCB* fcb = get_fcb(lsock); // Get FCB from Fid table
+
+	// Verify FCB valid and refers to a listener socket
+	if(stats == NULL || fcb == NULL || fcb->streamfunc != &socket_ops)
+		return -1;
+
+	socketCB* socket = (socketCB*)fcb->streamobj;
+	if(socket->type != SOCKET_LISTENER)
+		return -1;
+
+	stats->backlog = socket->listener_s.backlog;
+	stats->pending = socket->listener_s.pending;
+	stats->peak = socket->listener_s.peak;
+	stats->acceptors = socket->listener_s.acceptors;
+	stats->accepted = socket->listener_s.accepted;
+	stats->rejected = socket->listener_s.rejected;
+	return 0;
+}
+
+// The connected socket of a fid, or NULL
+static socketCB* get_peer_socket(Fid_t sock){
+	FCB* fcb = get_fcb(sock);
+	if(fcb == NULL || fcb->streamfunc != &socket_ops)
+		return NULL;
+
+	socketCB* socket = (socketCB*) fcb->streamobj;
+	return (socket->type == SOCKET_PEER) ? socket : NULL;
+}
+
+/*
+	A socket can be sent only if it does not hold its own connection open
+	by doing so. Refusing sockets with queued streams is enough to avoid
+	cycles of connections that hold each other open: the send that would 
+	close a cycle always sends such a socket.
+*/
+static int can_send(socketCB* socket, FCB* fcb){
+	if(fcb->streamfunc != &socket_ops)
+		return 1;
+
+	socketCB* sent = (socketCB*) fcb->streamobj;
+	if(sent->type != SOCKET_PEER)
+		return 1;
+	return sent->peer_s.conn != socket->peer_s.conn
+		&& sent->peer_s.send_fids->count == 0
+		&& sent->peer_s.recv_fids->count == 0;
+}
+
+int sys_SendFid(Fid_t sock, Fid_t fid) {
+
+	socketCB* socket = get_peer_socket(sock);
+	FCB* fcb = get_fcb(fid);
+
+	if(socket == NULL || fcb == NULL)
+		return -1;
+
+	// Both ends must be open in this direction
+	pipeCB* pipe = socket->peer_s.write_pipe;
+	if(pipe == NULL || pipe->reader == NULL)
+		return -1;
+
+	fid_queue* q = socket->peer_s.send_fids;
+	if(q->count == MAX_FILEID || !can_send(socket, fcb))
+		return -1;
+
+	FCB_incref(fcb);
+	fid_queue_push(q, fcb);
+	return 0;
+}
+
+Fid_t sys_RecvFid(Fid_t sock) {
+
+	socketCB* socket = get_peer_socket(sock);
+	if(socket == NULL)
+		return NOFILE;
+
+	// Keep the socket open while we wait, in case another thread closes it
+	FCB* fcb = get_fcb(sock);
+	FCB_incref(fcb);
+
+	fid_queue* q = socket->peer_s.recv_fids;
+	TimerDuration wait = (fcb->flags & FID_NONBLOCK) ? 0 : option_timeout(socket->rcvtimeo);
+	TimerDuration deadline = (wait == 0 || wait == NO_TIMEOUT) ? wait : bios_clock() + wait;
+	Fid_t fid = NOFILE;
+
+	// Wait while the other end may still send
+	while(q->count == 0 && wait != 0) {
+		pipeCB* pipe = socket->peer_s.read_pipe;
+		if(pipe == NULL || pipe->writer == NULL)
+			break;
+		if(! kernel_timedwait(&q->arrived, SCHED_PIPE, wait))
+			break;
+
+		// Wakeups that bring nothing do not extend the timeout
+		if(wait != NO_TIMEOUT) {
+			TimerDuration now = bios_clock();
+			wait = (now < deadline) ? deadline - now : 0;
+		}
+	}
+
+	// The reference of the queue passes to the file table
+	if(q->count > 0 && socket->peer_s.read_pipe != NULL) {
+		fid = FCB_install(q->fcb[q->head]);
+		if(fid != NOFILE)
+			fid_queue_pop(q);
+	}
+
+	FCB_decref(fcb);
+	return fid;
+}
@@ -15,26 +15,61 @@ typedef enum {
 
 typedef struct socket_control_block socketCB;
 
-socketCB* PORT_MAP[MAX_PORT+1];
-
 typedef struct listener_socket {
     rlnode queue;
     CondVar req_available;
+    unsigned int pending;       // requests in queue
+    unsigned int backlog;       // limit of pending
+    unsigned int peak;          // max of pending
+    unsigned int acceptors;     // threads waiting in Accept
+    unsigned long accepted;
+    unsigned long rejected;     // requests refused because the queue was full
+    rlnode port_node;           // in the listeners of the port
 } listener_socket;
 
+// The listeners of a port, in the port map
+typedef struct port_entry {
+    port_t port;
+    rlnode listeners;           // in round-robin order
+    struct port_entry* next;    // in the hash bucket
+} port_entry;
+
 typedef struct unbound_socket {
     rlnode unbound_socket;
 } unbound_socket;
 
+// The streams sent with SendFid in one direction of a connection, in order
+typedef struct fid_queue {
+    FCB* fcb[MAX_FILEID];       // a ring; each FCB holds a reference
+    unsigned int head;          // the oldest stream
+    unsigned int count;
+    CondVar arrived;            // RecvFid waits here
+} fid_queue;
+
+/*
+    The two rings of a connection, allocated together. The pipes are shut
+    down by ShutDown and Close, but freed only when both sockets are closed,
+    so that a thread doing I/O on one socket, without the kernel lock, never
+    sees them go away.
+*/
+typedef struct socket_connection {
+    pipeCB pipe[2];             // pipe[0]: accepted -> connecting socket, pipe[1]: the reverse
+    fid_queue fids[2];          // the streams sent along each pipe
+    unsigned int refcount;      // the sockets of the connection not yet closed
+} connection;
+
 typedef struct peer_socket {
-    socketCB* peer;
-    pipeCB* write_pipe;
-    pipeCB* read_pipe;
+    connection* conn;
+    pipeCB* write_pipe;         // NULL after ShutDown
+    pipeCB* read_pipe;          // NULL after ShutDown
+    fid_queue* send_fids;       // the streams this socket sends
+    fid_queue* recv_fids;       // the streams this socket receives
 } peer_socket;
 
 typedef struct connection_request {
-    int admitted;
+    int admitted;           // 0 while queued, 1 if accepted, -1 if the listener closed
     socketCB* peer;
+    socketCB* listener;     // the listener whose queue holds the request
     Fid_t peer_fid;
 
     CondVar connected_cv;
@@ -48,6 +83,15 @@ typedef struct socket_control_block {
     Socket_type type;
     port_t port;
 
+    unsigned int sndbuf;    // SOCKOPT_SNDBUF, or 0 if not set
+    unsigned int rcvbuf;    // SOCKOPT_RCVBUF, or 0 if not set
+    int message;            // SOCKOPT_MESSAGE
+    int reuseport;          // SOCKOPT_REUSEPORT
+    unsigned int rcvlowat;  // SOCKOPT_RCVLOWAT
+    unsigned int rcvtimeo;  // SOCKOPT_RCVTIMEO in msec, or 0 for none
+    unsigned int sndtimeo;  // SOCKOPT_SNDTIMEO in msec, or 0 for none
+    unsigned int cork;      // SOCKOPT_CORK
+
     union {
         listener_socket listener_s;
         unbound_socket unbound_s;
@@ -56,4 +100,20 @@ typedef struct socket_control_block {
     
 } socketCB;
 
+/**
+	@brief The pipe that a connected socket reads from.
+
+	Returns NULL if the FCB is not a socket, or not connected, or its 
+	read direction has been shut down.
+*/
+pipeCB* socket_read_pipe(FCB* fcb);
+
+/**
+	@brief The pipe that a connected socket writes to.
+
+	Returns NULL if the FCB is not a socket, or not connected, or its 
+	write direction has been shut down.
+*/
+pipeCB* socket_write_pipe(FCB* fcb);
+
 #endif
\ No newline at end of file
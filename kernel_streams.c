@@ -1,3 +1,4 @@
+#include <limits.h>
 
 #include "util.h"
 #include "tinyos.h"
@@ -6,92 +7,275 @@
 #include "kernel_sched.h"
 #include "kernel_proc.h"
 
-#define MAX_FILES MAX_PROC
+/*
+  FCBs are allocated from a pool with per-core caches, so that opening and 
+  closing streams on different cores does not contend. The memory of the pool
+  is never returned to the heap, so a stale pointer to an FCB is still safe
+  to read (see FCB_pin).
+ */
+static object_pool fcb_pool = POOL_INIT_PERCORE("FCB", sizeof(FCB), sizeof(void*));
 
-FCB FT[MAX_FILES];
-rlnode FCB_freelist;
+FCB* acquire_FCB()
+{
+  FCB* fcb = pool_alloc(&fcb_pool);
+  fcb->refcount = 0;
+  fcb->flags = 0;
+  fcb->streamobj = NULL;
+  __atomic_store_n(&fcb->streamfunc, NULL, __ATOMIC_RELAXED);
+  return fcb;
+}
+
+void release_FCB(FCB* fcb)
+{
+  pool_free(&fcb_pool, fcb);
+}
 
 
-void initialize_files()
+/* 
+  Close and release an FCB whose last reference was dropped.
+  An FCB whose stream was never set (see FCB_unreserve) is just released.
+ */
+static int FCB_close(FCB* fcb)
 {
-  rlnode_init(&FCB_freelist,NULL);
-  for(int i=0;i<MAX_FILES;i++) {
+  int retval = 0;
+  if(fcb->streamfunc != NULL)
+    retval = fcb->streamfunc->Close(fcb->streamobj);
+  release_FCB(fcb);
+  return retval;
+}
 
-    FT[i].refcount = 0;
-    rlnode_init(& FT[i].freelist_node, &FT[i]);
-    rlist_push_back(&FCB_freelist, & FT[i].freelist_node);
-  }
+
+/*
+  The reference count is atomic, because FCB_pin and FCB_unpin change it 
+  without the kernel lock.
+ */
+void FCB_incref(FCB* fcb)
+{
+  assert(fcb);
+  __atomic_add_fetch(&fcb->refcount, 1, __ATOMIC_RELAXED);
+}
+
+int FCB_decref(FCB* fcb)
+{
+  assert(fcb);
+  if(__atomic_sub_fetch(&fcb->refcount, 1, __ATOMIC_ACQ_REL)==0)
+    return FCB_close(fcb);
+  else
+    return 0;
 }
 
 
-FCB* acquire_FCB()
+/*
+ *
+ *   File tables
+ *
+ */
+
+#define FIDT_INITIAL_SIZE 8
+#define BITS_PER_WORD (8*sizeof(unsigned long))
+
+static inline unsigned int bitmap_words(unsigned int size)
+{
+  return (size + BITS_PER_WORD - 1) / BITS_PER_WORD;
+}
+
+/* Allocate an empty table, for one user; the slots and the bitmap follow the header */
+static fid_table* fidt_alloc(unsigned int size)
 {
-  if(! is_rlist_empty(& FCB_freelist)) {
-    FCB* fcb = rlist_pop_front(& FCB_freelist)->fcb;
-    fcb->refcount = 0;
-    return fcb;
+  unsigned int words = bitmap_words(size);
+  fid_table* t = xmalloc(sizeof(fid_table) + size*sizeof(FCB*) + words*sizeof(unsigned long));
+  t->size = size;
+  t->slot = (FCB**) (t+1);
+  t->used = (unsigned long*) (t->slot + size);
+  t->users = 1;
+  t->refs = 1;
+  t->retired = NULL;
+  memset(t->slot, 0, size*sizeof(FCB*));
+  memset(t->used, 0, words*sizeof(unsigned long));
+  return t;
+}
+
+/* Drop a reference to a table, and free it with its retired tables when unused */
+static void fidt_put(fid_table* t)
+{
+  while(t != NULL && --t->refs == 0) {
+    fid_table* retired = t->retired;
+    free(t);
+    t = retired;
   }
+}
+
+/* 
+  Give the process a table of its own, large enough to hold fid. The FCB 
+  references pass to the new table, unless the old one is still used by 
+  others.
+ */
+static fid_table* fidt_replace(PCB* pcb, Fid_t fid)
+{
+  fid_table* old = pcb->FIDT;
+  unsigned int size = old->size;
+  while(size <= (unsigned int) fid)
+    size *= 2;
+
+  fid_table* t = fidt_alloc(size);
+  memcpy(t->slot, old->slot, old->size*sizeof(FCB*));
+  memcpy(t->used, old->used, bitmap_words(old->size)*sizeof(unsigned long));
+  if(--old->users > 0) {
+    for(unsigned int f=0; f<old->size; f++)
+      if(t->slot[f])
+        FCB_incref(t->slot[f]);
+  }
+
+  /* Our reference to the old table passes to the new one */
+  t->retired = old;
+  __atomic_store_n(& pcb->FIDT, t, __ATOMIC_RELEASE);
+
+  /* 
+    Unlocked readers of the process may still be in the retired tables, unless
+    the caller is its only thread, or it has none yet (see create_process). 
+    Then the chain is dropped at once; else it is kept until the process exits.
+   */
+  if(pcb->thread_count == 0 || (pcb->thread_count == 1 && pcb == CURPROC)) {
+    fidt_put(t->retired);
+    t->retired = NULL;
+  }
+  return t;
+}
+
+/* Store an FCB (or NULL) at a fid, growing or copying the table if needed */
+static void set_fid(PCB* pcb, Fid_t fid, FCB* fcb)
+{
+  fid_table* t = pcb->FIDT;
+  if((unsigned int) fid >= t->size || t->users > 1)
+    t = fidt_replace(pcb, fid);
+
+  unsigned long bit = 1ul << (fid % BITS_PER_WORD);
+  if(fcb)
+    t->used[fid / BITS_PER_WORD] |= bit;
   else
-    return NULL;
+    t->used[fid / BITS_PER_WORD] &= ~bit;
+  __atomic_store_n(& t->slot[fid], fcb, __ATOMIC_RELEASE);
 }
 
-void release_FCB(FCB* fcb)
+/* 
+  The lowest free fid at or above 'from', or NOFILE if there is none below 
+  the limit. The fids past the end of the table are free. 
+ */
+static Fid_t next_free_fid(PCB* pcb, Fid_t from)
 {
-  rlist_push_back(& FCB_freelist, & fcb->freelist_node);
+  fid_table* t = pcb->FIDT;
+  unsigned int f = from;
+  while(f < t->size) {
+    unsigned int w = f / BITS_PER_WORD;
+    unsigned long free = ~t->used[w] & (~0ul << (f % BITS_PER_WORD));
+    if(free) {
+      f = w*BITS_PER_WORD + __builtin_ctzl(free);
+      break;
+    }
+    f = (w+1)*BITS_PER_WORD;
+  }
+  return (f < pcb->fid_limit) ? (Fid_t) f : NOFILE;
 }
 
 
-void FCB_incref(FCB* fcb)
+void initialize_FIDT(PCB* pcb, PCB* parent)
 {
-  assert(fcb);
-  fcb->refcount++;
+  if(parent == NULL) {
+    pcb->fid_limit = MAX_FILEID;
+    pcb->FIDT = fidt_alloc(FIDT_INITIAL_SIZE);
+    return;
+  }
+
+  /* Share the table of the parent, until one of the two changes it */
+  fid_table* t = parent->FIDT;
+  t->users++;
+  t->refs++;
+  pcb->fid_limit = parent->fid_limit;
+  pcb->FIDT = t;
 }
 
-int FCB_decref(FCB* fcb)
+
+void release_FIDT(PCB* pcb)
 {
-  assert(fcb);
-  fcb->refcount --;
-  if(fcb->refcount==0) {
-    int retval = fcb->streamfunc->Close(fcb->streamobj);
-    release_FCB(fcb);
-    return retval;
+  fid_table* t = pcb->FIDT;
+  if(--t->users == 0) {
+    for(unsigned int f=0; f<t->size; f++) {
+      FCB* fcb = t->slot[f];
+      if(fcb != NULL) {
+        t->slot[f] = NULL;
+        FCB_decref(fcb);
+      }
+    }
   }
-  else
-    return 0;
+
+  pcb->FIDT = NULL;
+  fidt_put(t);
+}
+
+
+/* FCB_pin for a fid of process cur, which must be the current process */
+static FCB* pcb_fcb_pin(PCB* cur, Fid_t fid)
+{
+  fid_table* t = __atomic_load_n(& cur->FIDT, __ATOMIC_ACQUIRE);
+  if(fid < 0 || (unsigned int) fid >= t->size) return NULL;
+
+  FCB* fcb = __atomic_load_n(& t->slot[fid], __ATOMIC_ACQUIRE);
+  if(fcb == NULL) return NULL;
+
+  /* FCBs are never freed to the heap, so a stale pointer is still an FCB; but it 
+     may be free, so we only take a reference if there is one already. A free
+     FCB keeps its zero refcount, as its pool link overwrites streamobj. */
+  uint count = __atomic_load_n(&fcb->refcount, __ATOMIC_RELAXED);
+  do {
+    if(count == 0) return NULL;
+  } while(! __atomic_compare_exchange_n(&fcb->refcount, &count, count+1, 1, 
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+  /* Check that the FCB was not closed and reused in the meantime; the table
+     may have grown, so we look at the current one */
+  t = __atomic_load_n(& cur->FIDT, __ATOMIC_ACQUIRE);
+  if(__atomic_load_n(& t->slot[fid], __ATOMIC_ACQUIRE) != fcb) {
+    FCB_unpin(fcb);
+    return NULL;
+  }
+  return fcb;
 }
 
 
+FCB* FCB_pin(Fid_t fid)
+{
+  return pcb_fcb_pin(CURPROC, fid);
+}
+
+
+void FCB_unpin(FCB* fcb)
+{
+  assert(fcb);
+  if(__atomic_sub_fetch(&fcb->refcount, 1, __ATOMIC_ACQ_REL)==0) {
+    kernel_lock();
+    FCB_close(fcb);
+    kernel_unlock();
+  }
+}
+
 
 int FCB_reserve(size_t num, Fid_t *fid, FCB** fcb)
 {
     PCB* cur = CURPROC;
-    size_t f=0;
+    Fid_t f=0;
     uint i;
 
     /* Find distinct fids */
     for(i=0; i<num; i++) {
-	while(f<MAX_FILEID && cur->FIDT[f]!=NULL)
-	    f++;
-	if(f==MAX_FILEID) break;
-	fid[i] = f; f++;
+	if((fid[i] = next_free_fid(cur, f)) == NOFILE)
+	    return 0;
+	f = fid[i]+1;
     }
-    if(i<num) return 0;
     /* Allocate FCBs */
-    for(i=0;i<num;i++)
-	if((fcb[i] = acquire_FCB()) == NULL)
-	    break;
-    if(i<num) {
-	/* Roll back */
-	while(i>0) {
-	    release_FCB(fcb[i-1]);
-	    i--;
-	}
-	return 0;
-    }
-    /* Found all */
     for(i=0;i<num;i++) {
-	cur->FIDT[fid[i]]=fcb[i];
+	fcb[i] = acquire_FCB();
 	FCB_incref(fcb[i]);
+	set_fid(cur, fid[i], fcb[i]);
     }
     return 1;
 }
@@ -102,13 +286,46 @@ void FCB_unreserve(size_t num, Fid_t *fid, FCB** fcb)
 {
     PCB* cur = CURPROC;
     for(size_t i=0; i<num ; i++) {
-	assert(cur->FIDT[fid[i]]==fcb[i]);
-	cur->FIDT[fid[i]] = NULL;
-	release_FCB(fcb[i]);
+	assert(get_fcb(fid[i])==fcb[i]);
+	set_fid(cur, fid[i], NULL);
+	/* An FCB_pin in progress may hold a reference, so the stream is
+	   reset and the FCB is released with the last reference */
+	fcb[i]->streamfunc = NULL;
+	FCB_decref(fcb[i]);
     }
 }
 
 
+Fid_t FCB_install(FCB* fcb)
+{
+    PCB* cur = CURPROC;
+    Fid_t f = next_free_fid(cur, 0);
+    if(f != NOFILE)
+	set_fid(cur, f, fcb);
+    return f;
+}
+
+
+int sys_SetFileLimit(unsigned int limit)
+{
+  if(limit < 1 || limit > MAX_FILE_LIMIT)
+    return -1;
+
+  /* No open fid may be left above the limit */
+  fid_table* t = CURPROC->FIDT;
+  for(unsigned int f=limit; f<t->size; f++)
+    if(t->slot[f] != NULL)
+      return -1;
+
+  CURPROC->fid_limit = limit;
+  return 0;
+}
+
+
+unsigned int sys_GetFileLimit(void)
+{
+  return CURPROC->fid_limit;
+}
 
 
 
@@ -120,87 +337,228 @@ void FCB_unreserve(size_t num, Fid_t *fid, FCB** fcb)
  */
 
 
-FCB* get_fcb(Fid_t fid)
+/* The FCB at a fid of a process, or NULL */
+static FCB* pcb_fcb(PCB* pcb, Fid_t fid)
 {
-  if(fid < 0 || fid >= MAX_FILEID) return NULL;
+  fid_table* t = pcb->FIDT;
+  if(fid < 0 || (unsigned int) fid >= t->size) return NULL;
 
-  return CURPROC->FIDT[fid];
+  return t->slot[fid];
 }
 
 
-int sys_Read(Fid_t fd, char *buf, unsigned int size)
+FCB* get_fcb(Fid_t fid)
 {
-  int retcode = -1;
-  int (*devread)(void*,char*,uint);
-  void* sobj;
+  return pcb_fcb(CURPROC, fid);
+}
 
-  
-  /* Get the fields from the stream */
-  FCB* fcb = get_fcb(fd);
 
-  if(fcb) {
-    sobj = fcb->streamobj;
-    devread = fcb->streamfunc->Read;
+/*
+  Check the iovec arguments of ReadV and WriteV.
+  The total size must fit in the return value.
+ */
+static int iovec_legal(const iovec_t* iov, int iovcnt)
+{
+  if(iovcnt < 0 || iovcnt > MAX_IOVEC || (iovcnt > 0 && iov == NULL))
+    return 0;
 
-    /* make sure that the stream will not be closed (by another thread) 
-       while we are using it! */
-    FCB_incref(fcb);
-  
-    if(devread)
-      retcode = devread(sobj, buf, size);
+  unsigned long total = 0;
+  for(int i=0; i<iovcnt; i++) {
+    total += iov[i].len;
+    if(total > INT_MAX) return 0;
+  }
+  return 1;
+}
 
-    /* Need to decrease the reference to FCB */
-    FCB_decref(fcb);
+
+/* ReadV for streams without a native implementation: Read each buffer in turn,
+   until a short read. */
+static int readv_fallback(FCB* fcb, const iovec_t* iov, int iovcnt)
+{
+  int count = 0;
+  for(int i=0; i<iovcnt; i++) {
+    if(iov[i].len == 0) continue;
+
+    int rc = fcb->streamfunc->Read(fcb->streamobj, iov[i].base, iov[i].len);
+    if(rc <= 0)
+      return (count > 0) ? count : rc;
+    count += rc;
+    if((unsigned int)rc < iov[i].len) break;
   }
-  
-  /* We must not go into non-preemptive domain with kernel_mutex locked */
+  return count;
+}
 
 
-  return retcode;
+/* WriteV for streams without a native implementation: Write each buffer in turn,
+   until a short write. */
+static int writev_fallback(FCB* fcb, const iovec_t* iov, int iovcnt)
+{
+  int count = 0;
+  for(int i=0; i<iovcnt; i++) {
+    if(iov[i].len == 0) continue;
+
+    int rc = fcb->streamfunc->Write(fcb->streamobj, iov[i].base, iov[i].len);
+    if(rc <= 0)
+      return (count > 0) ? count : rc;
+    count += rc;
+    if((unsigned int)rc < iov[i].len) break;
+  }
+  return count;
 }
 
 
-int sys_Write(Fid_t fd, const char *buf, unsigned int size)
+/*
+  Dispatch of the I/O system calls.
+
+  These calls are entered without the kernel lock (see SYSCALL_UNLOCKED in
+  kernel_sys.h). If the stream has FOPS_UNLOCKED methods, the FCB is pinned
+  and the method is called directly. Else, the call is made as usual,
+  holding the kernel lock and a reference to the FCB, so that the stream
+  will not be closed (by another thread) while we are using it.
+
+  Thus a Close by another thread only clears the fid. The stream itself is
+  closed when the calls in progress have dropped their pins, by the last of
+  them (much like the grace period of RCU).
+ */
+typedef int (*io_call)(FCB* fcb, void* args);
+
+static inline int fcb_unlocked(FCB* fcb)
 {
-  int retcode = -1;
-  int (*devwrite)(void*, const char*, uint) = NULL;
-  void* sobj = NULL;
+  file_ops* fops = __atomic_load_n(&fcb->streamfunc, __ATOMIC_ACQUIRE);
+  return fops != NULL && (fops->flags & FOPS_UNLOCKED);
+}
 
-  
-  /* Get the fields from the stream */
-  FCB* fcb = get_fcb(fd);
+static int io_dispatch(PCB* cur, Fid_t fd, io_call call, void* args)
+{
+  int retcode = -1;
+  FCB* fcb = pcb_fcb_pin(cur, fd);
 
+  if(fcb && fcb_unlocked(fcb)) {
+    retcode = call(fcb, args);
+    FCB_unpin(fcb);
+    return retcode;
+  }
+  if(fcb) FCB_unpin(fcb);
+
+  kernel_lock();
+  fcb = pcb_fcb(cur, fd);
+  if(fcb && fcb_unlocked(fcb)) {
+    /* The stream was created after we looked, try again */
+    kernel_unlock();
+    return io_dispatch(cur, fd, call, args);
+  }
   if(fcb) {
+    FCB_incref(fcb);
+    retcode = call(fcb, args);
+    FCB_decref(fcb);
+  }
+  kernel_unlock();
 
-    sobj = fcb->streamobj;
-    devwrite = fcb->streamfunc->Write;
+  return retcode;
+}
 
-    /* make sure that the stream will not be closed (by another thread) 
-       while we are using it! */
-    FCB_incref(fcb);
-  
 
-    if(devwrite)
-      retcode = devwrite(sobj, buf, size);
+struct io_args { void* buf; unsigned int size; const iovec_t* iov; int iovcnt; };
 
-    /* Need to decrease the reference to FCB */
-    FCB_decref(fcb);
+static int read_call(FCB* fcb, void* args)
+{
+  struct io_args* a = args;
+  if(fcb->streamfunc->Read == NULL) return -1;
+  return fcb->streamfunc->Read(fcb->streamobj, a->buf, a->size);
+}
+
+static int write_call(FCB* fcb, void* args)
+{
+  struct io_args* a = args;
+  if(fcb->streamfunc->Write == NULL) return -1;
+  return fcb->streamfunc->Write(fcb->streamobj, a->buf, a->size);
+}
 
+static int readv_call(FCB* fcb, void* args)
+{
+  struct io_args* a = args;
+  if(fcb->streamfunc->Read == NULL) return -1;
+  if(fcb->streamfunc->ReadV)
+    return fcb->streamfunc->ReadV(fcb->streamobj, a->iov, a->iovcnt);
+  else
+    return readv_fallback(fcb, a->iov, a->iovcnt);
+}
+
+static int writev_call(FCB* fcb, void* args)
+{
+  struct io_args* a = args;
+  if(fcb->streamfunc->Write == NULL) return -1;
+  if(fcb->streamfunc->WriteV)
+    return fcb->streamfunc->WriteV(fcb->streamobj, a->iov, a->iovcnt);
+  else
+    return writev_fallback(fcb, a->iov, a->iovcnt);
+}
+
+
+/* Count a successful read in the usage of the current thread */
+static inline int count_read(TCB* self, int rc)
+{
+  if(rc >= 0) {
+    rusage_add(&self->usage.reads, 1);
+    rusage_add(&self->usage.read_bytes, rc);
   }
+  return rc;
+}
 
+/* Count a successful write in the usage of the current thread */
+static inline int count_write(TCB* self, int rc)
+{
+  if(rc >= 0) {
+    rusage_add(&self->usage.writes, 1);
+    rusage_add(&self->usage.write_bytes, rc);
+  }
+  return rc;
+}
 
-  return retcode;
+
+int sys_Read(Fid_t fd, char *buf, unsigned int size)
+{
+  struct io_args args = { .buf = buf, .size = size };
+  TCB* self = cur_thread();
+  return count_read(self, io_dispatch(self->owner_pcb, fd, read_call, &args));
 }
 
 
-int sys_Close(int fd)
+int sys_Write(Fid_t fd, const char *buf, unsigned int size)
 {
-  int retcode = (fd>=0 && fd<MAX_FILEID) ? 0 : -1;  /* Closing a closed fd is legal! */
+  struct io_args args = { .buf = (void*) buf, .size = size };
+  TCB* self = cur_thread();
+  return count_write(self, io_dispatch(self->owner_pcb, fd, write_call, &args));
+}
 
-  FCB* fcb = get_fcb(fd);
+
+int sys_ReadV(Fid_t fd, const iovec_t* iov, int iovcnt)
+{
+  if(! iovec_legal(iov, iovcnt)) return -1;
+  struct io_args args = { .iov = iov, .iovcnt = iovcnt };
+  TCB* self = cur_thread();
+  return count_read(self, io_dispatch(self->owner_pcb, fd, readv_call, &args));
+}
+
+
+int sys_WriteV(Fid_t fd, const iovec_t* iov, int iovcnt)
+{
+  if(! iovec_legal(iov, iovcnt)) return -1;
+  struct io_args args = { .iov = iov, .iovcnt = iovcnt };
+  TCB* self = cur_thread();
+  return count_write(self, io_dispatch(self->owner_pcb, fd, writev_call, &args));
+}
+
+
+/* Close a fid of a process */
+static int close_fid(PCB* pcb, int fd)
+{
+  int retcode = (fd>=0 && (unsigned int) fd<pcb->fid_limit) ? 0 : -1;  /* Closing a closed fd is legal! */
+
+  FCB* fcb = pcb_fcb(pcb, fd);
 
   if(fcb) {
-    CURPROC->FIDT[fd] = NULL;
+    set_fid(pcb, fd, NULL);
     retcode = FCB_decref(fcb);    
   }
 
@@ -208,36 +566,88 @@ int sys_Close(int fd)
 }
 
 
-/*
-  Copy file descriptor oldfd into file descriptor newfd.
-
-  This call returns 0 on success and -1 on failure.
-  Possible reasons for failure:
-  - Either oldfd or newfd is invalid.
- */
-int sys_Dup2(int oldfd, int newfd)
+/* Copy a fid of a process into another */
+static int dup_fid(PCB* pcb, int oldfd, int newfd)
 {
   int retcode=0;
-  if(oldfd<0 || newfd<0 || oldfd>=MAX_FILEID || newfd>=MAX_FILEID)
+  unsigned int limit = pcb->fid_limit;
+  if(oldfd<0 || newfd<0 || (unsigned int) oldfd>=limit || (unsigned int) newfd>=limit)
     return -1;
 
-  FCB* old = get_fcb(oldfd);
-  FCB* new = get_fcb(newfd);
+  FCB* old = pcb_fcb(pcb, oldfd);
+  FCB* new = pcb_fcb(pcb, newfd);
 
   if(old==NULL) {
     retcode = -1;
   }
   else if(old!=new) {
+    /* The reference to new is dropped after set_fid, which may copy a 
+       shared table */
+    FCB_incref(old);
+    set_fid(pcb, newfd, old);
     if(new)
       FCB_decref(new);
-    FCB_incref(old);
-    CURPROC->FIDT[newfd] = old;
   }
 
   return retcode;
 }
 
 
+int sys_Close(int fd)
+{
+  return close_fid(CURPROC, fd);
+}
+
+
+/*
+  Copy file descriptor oldfd into file descriptor newfd.
+
+  This call returns 0 on success and -1 on failure.
+  Possible reasons for failure:
+  - Either oldfd or newfd is invalid.
+ */
+int sys_Dup2(int oldfd, int newfd)
+{
+  return dup_fid(CURPROC, oldfd, newfd);
+}
+
+
+int apply_file_actions(PCB* pcb, const spawn_file_action* actions, unsigned int nactions)
+{
+  for(unsigned int i=0; i<nactions; i++) {
+    const spawn_file_action* a = &actions[i];
+    int rc;
+    switch(a->op) {
+      case SPAWN_DUP2:
+        rc = dup_fid(pcb, a->fid, a->newfid);
+        break;
+      case SPAWN_CLOSE:
+        rc = close_fid(pcb, a->fid);
+        break;
+      default:
+        rc = -1;
+    }
+    if(rc != 0)
+      return -1;
+  }
+  return 0;
+}
+
+
+int sys_SetFlags(Fid_t fd, int flags)
+{
+  FCB* fcb = get_fcb(fd);
+
+  /* Only known flags are accepted */
+  if(fcb==NULL || (flags & ~FID_NONBLOCK))
+    return -1;
+
+  /* Unlocked I/O methods read the flags without the kernel lock */
+  __atomic_store_n(&fcb->flags, flags, __ATOMIC_RELEASE);
+  return 0;
+}
+
+
 
 unsigned int sys_GetTerminalDevices()
 {
@@ -3,8 +3,9 @@
 
 #include "tinyos.h"
 #include "kernel_dev.h"
+#include "kernel_pool.h"
 
-#define PIPE_BUFFER_SIZE 8192
+#define PIPE_BUFFER_SIZE 8192	/* default size limit of a pipe buffer */
 
 /**
 	@file kernel_streams.h
@@ -42,31 +43,82 @@
  */
 typedef struct file_control_block
 {
+  void* streamobj;			/**< @brief The stream object (e.g., a device). It is first, 
+  								as a free FCB holds the link of its pool here (see @ref FCB_pin) */
   uint refcount;  			/**< @brief Reference counter. */
-  void* streamobj;			/**< @brief The stream object (e.g., a device) */
+  int flags;				/**< @brief Stream flags set by @c SetFlags (e.g. @c FID_NONBLOCK).
+  								Accessed atomically, as unlocked I/O methods read it */
   file_ops* streamfunc;		/**< @brief The stream implementation methods */
-  rlnode freelist_node;		/**< @brief Intrusive list node */
 } FCB;
 
 
+// The threads sleeping on one side of a pipe (see kernel_pipe.c)
+typedef struct pipe_wait_queue
+{
+	CondVar cv;
+	unsigned int waiting;	/* threads about to sleep on cv */
+	unsigned int woken;		/* set when the sleepers have been woken up */
+	unsigned long sleeps;	/* times a thread has slept on cv */
+} pipe_waitq;
+
 // Pipe control Block
 typedef struct pipe_control_block
 {
-	pipe_t* pipe_ends;
-	CondVar has_space;
-	CondVar has_data;
-	char BUFFER[PIPE_BUFFER_SIZE];
+	/* reader side, under rlock (see kernel_pipe.c) */
+	_Alignas(CACHE_LINE) Mutex rlock;
+	unsigned int r_position;	/* free-running counter */
+	unsigned int claimed;	/* bytes lent to a Splice in progress, at r_position */
+	TimerDuration rcvtimeo;	/* read timeout in usec, or NO_TIMEOUT */
+
+	/* writer side, under wlock */
+	_Alignas(CACHE_LINE) Mutex wlock;
+	unsigned int w_position;	/* free-running counter */
+	unsigned int peak;		/* max bytes stored since the buffer was last drained */
+	TimerDuration sndtimeo;	/* write timeout in usec, or NO_TIMEOUT */
+	unsigned int cork;		/* readers are woken when this many bytes are stored, if not 0 */
+	unsigned int reserved;	/* space promised to Splices reading from a device */
+
+	/* changed under both locks, or the kernel lock */
+	_Alignas(CACHE_LINE) char* buffer;	/* ring buffer, see kernel_pipe.c */
+	unsigned int size;		/* current size of buffer, a power of two */
+	unsigned int limit;		/* the buffer may grow up to this size */
+	int flags;				/* PipeEx flags */
+	unsigned int rcvlowat;	/* readers wait for this many bytes */
+	rlnode segments;		/* segment chain of a PIPE_SEGMENTED pipe */
+	rlnode leased;			/* leases of data returned by ReadZC, see kernel_pipe.c */
+	unsigned int lent;		/* bytes returned by ReadZC and not released */
 	FCB* reader;
 	FCB* writer;
-	int r_position, w_position;
+	pipe_waitq has_space;	/* writers */
+	pipe_waitq has_data;	/* readers */
 } pipeCB;
 
-/** 
-  @brief Initialization for files and streams.
+/** @brief The file table of a process.
+
+	The table starts small and doubles as file ids are used, up to the limit
+	of the process. A bitmap of the used slots lets @ref FCB_reserve find
+	the lowest free fids a word at a time.
 
-  This function is called at kernel startup.
+	A child shares the table of its parent after @c Exec. A shared table 
+	is copied by the first process that changes it. The processes that use
+	a table (its @c users) share the references it holds to its FCBs.
+
+	Threads read the table without the kernel lock (see @ref FCB_pin),
+	so a table is not freed while a process may still be reading it. When
+	a process replaces its table (to grow it or to copy it), the old table
+	is kept, with a reference, in the @c retired field of the new one. 
+	A single-threaded process drops the old table at once, since its only 
+	thread is the one replacing it.
  */
-void initialize_files();
+typedef struct fid_table
+{
+	unsigned int size;			/**< @brief The number of slots, a power of two */
+	FCB** slot;					/**< @brief The FCB of each fid, or NULL */
+	unsigned long* used;		/**< @brief Bitmap of the non-NULL slots */
+	unsigned int users;			/**< @brief The processes using the table */
+	unsigned int refs;			/**< @brief Users, plus the tables retiring this one */
+	struct fid_table* retired;	/**< @brief The table this one replaced */
+} fid_table;
 
 
 /**
@@ -91,6 +143,47 @@ void FCB_incref(FCB* fcb);
 int FCB_decref(FCB* fcb);
 
 
+/**
+	@brief Take a reference to the FCB of a fid, without the kernel lock.
+
+	This is used by the I/O system calls to access streams with
+	@c FOPS_UNLOCKED methods. The reference is taken only if the FCB
+	is open, and still installed at @c fid.
+
+	@param fid the file ID of the current process
+	@returns the pinned FCB, or NULL if @c fid is not open
+	@see FCB_unpin
+*/
+FCB* FCB_pin(Fid_t fid);
+
+
+/**
+	@brief Drop a reference taken by @ref FCB_pin.
+
+	This must be called without the kernel lock. If this was the last
+	reference, the stream is closed (taking the kernel lock).
+*/
+void FCB_unpin(FCB* fcb);
+
+
+/**
+	@brief Create the file table of a new process.
+
+	The new process shares the file table and gets the file limit of
+	its parent. A process without a parent starts with an empty table.
+
+	@param pcb the new process
+	@param parent its parent, or NULL
+*/
+void initialize_FIDT(PCB* pcb, PCB* parent);
+
+
+/**
+	@brief Close the files of an exiting process, and free its file table.
+*/
+void release_FIDT(PCB* pcb);
+
+
 /** @brief Acquire a number of FCBs and corresponding fids.
 
    Given an array of fids and an array of pointers to FCBs  of
@@ -131,6 +224,30 @@ int FCB_reserve(size_t num, Fid_t *fid, FCB** fcb);
 void FCB_unreserve(size_t num, Fid_t *fid, FCB** fcb);
 
 
+/** @brief Install an open FCB at a free fid of the current process.
+
+   The caller passes its reference to the FCB to the file table; the
+   reference count is not changed. This is used to receive streams
+   from other processes (see @c RecvFid).
+
+   @param fcb the FCB to install
+   @returns the fid of the FCB, or NOFILE if the file table is full.
+*/
+Fid_t FCB_install(FCB* fcb);
+
+
+/** @brief Apply the file actions of @c Spawn to the file table of a new process.
+
+   The actions are applied in order, stopping at the first that fails.
+
+   @param pcb the new process
+   @param actions an array of @c nactions actions
+   @param nactions the number of actions
+   @returns 0 if all actions succeed, else -1.
+*/
+int apply_file_actions(PCB* pcb, const spawn_file_action* actions, unsigned int nactions);
+
+
 /** @brief Translate an fid to an FCB.
 
 	This routine will return NULL if the fid is not legal.
@@ -41,6 +41,17 @@ void NAME SIG \
 	POST_CALL\
 }\
 
+/* 
+  The system call takes the kernel lock itself, only when it needs it. 
+  This is used by the I/O calls, which may run on streams with 
+  FOPS_UNLOCKED methods.
+ */
+#define SYSCALL_UNLOCKED(NAME, RET, SIG, ARGS)\
+RET NAME SIG \
+{\
+	return sys_##NAME ARGS;\
+}\
+
 
 SYSCALLS
 
@@ -6,10 +6,12 @@
 
 #define SYSCALLS \
 SYSCALL(Exec, int, (Task task, int argl, void* args), (task, argl, args))\
+SYSCALL(Spawn, Pid_t, (Task task, int argl, void* args, const spawn_file_action* actions, unsigned int nactions), (task, argl, args, actions, nactions))\
 SYSCALLV(Exit, (int exitval), (exitval))\
 SYSCALL(GetPid, int, (void), ())\
 SYSCALL(GetPPid, int, (void), ())\
 SYSCALL(WaitChild, Pid_t, (Pid_t proc, int* exitval), (proc, exitval))\
+SYSCALL(WaitChildren, int, (Pid_t* pids, int* status, unsigned int max, timeout_t timeout), (pids, status, max, timeout))\
 SYSCALL(CreateThread, Tid_t, (Task task, int argl, void* args), (task, argl, args))\
 SYSCALL(ThreadSelf, Tid_t, (void), ())\
 SYSCALL(ThreadJoin, int, (Tid_t tid, int* exitval), (tid, exitval))\
@@ -18,17 +20,37 @@ SYSCALLV(ThreadExit, (int exitval), (exitval))\
 SYSCALL(GetTerminalDevices, unsigned int, (), ())\
 SYSCALL(OpenTerminal, Fid_t, (unsigned int termno), (termno))\
 SYSCALL(OpenNull, Fid_t, (), ())\
-SYSCALL(Read,int,(Fid_t fd, char *buf, unsigned int size), (fd,buf,size))\
-SYSCALL(Write,int,(Fid_t fd, const char *buf, unsigned int size), (fd,buf,size))\
+SYSCALL_UNLOCKED(Read,int,(Fid_t fd, char *buf, unsigned int size), (fd,buf,size))\
+SYSCALL_UNLOCKED(Write,int,(Fid_t fd, const char *buf, unsigned int size), (fd,buf,size))\
+SYSCALL_UNLOCKED(ReadV,int,(Fid_t fd, const iovec_t* iov, int iovcnt), (fd,iov,iovcnt))\
+SYSCALL_UNLOCKED(WriteV,int,(Fid_t fd, const iovec_t* iov, int iovcnt), (fd,iov,iovcnt))\
 SYSCALL(Close,int,(Fid_t fd),(fd))\
 SYSCALL(Dup2,int, (Fid_t oldfd, Fid_t newfd), (oldfd,newfd))\
+SYSCALL(SetFlags,int, (Fid_t fd, int flags), (fd,flags))\
+SYSCALL(SetFileLimit, int, (unsigned int limit), (limit))\
+SYSCALL(GetFileLimit, unsigned int, (void), ())\
 SYSCALL(Pipe, int, (pipe_t* pipe), (pipe))\
+SYSCALL(PipeEx, int, (pipe_t* pipe, unsigned int size, int flags), (pipe, size, flags))\
+SYSCALL(ReadZC, int, (Fid_t fd, const char** data, unsigned int size), (fd, data, size))\
+SYSCALL(ReleaseZC, int, (Fid_t fd, const char* data), (fd, data))\
+SYSCALL(Splice, int, (Fid_t in, Fid_t out, unsigned int size, int flags), (in, out, size, flags))\
+SYSCALL(Tee, int, (Fid_t in, Fid_t out, unsigned int size, int flags), (in, out, size, flags))\
 SYSCALL(Socket, Fid_t, (port_t port), (port))\
 SYSCALL(Listen, int, (Fid_t sock), (sock))\
+SYSCALL(ListenEx, int, (Fid_t sock, unsigned int backlog), (sock, backlog))\
 SYSCALL(Accept, Fid_t, (Fid_t lsock), (lsock))\
+SYSCALL(AcceptBatch, int, (Fid_t lsock, Fid_t* socks, unsigned int max, int flags), (lsock, socks, max, flags))\
 SYSCALL(Connect, int, (Fid_t sock, port_t port, timeout_t timeout), (sock, port, timeout))\
 SYSCALL(ShutDown, int, (Fid_t sock, shutdown_mode how), (sock, how))\
+SYSCALL(SetSockOpt, int, (Fid_t sock, socket_option option, unsigned int value), (sock, option, value))\
+SYSCALL(GetSockOpt, int, (Fid_t sock, socket_option option, unsigned int* value), (sock, option, value))\
+SYSCALL(ListenStats, int, (Fid_t lsock, listen_stats* stats), (lsock, stats))\
+SYSCALL(SendFid, int, (Fid_t sock, Fid_t fid), (sock, fid))\
+SYSCALL(RecvFid, Fid_t, (Fid_t sock), (sock))\
 SYSCALL(OpenInfo, Fid_t, (), ())\
+SYSCALL(OpenInfoEx, Fid_t, (const procinfo_filter* filter), (filter))\
+SYSCALL(GetRusage, int, (Pid_t pid, rusage_t* usage), (pid, usage))\
+SYSCALL(PoolStats, int, (unsigned int pool, pool_stats* stats), (pool, stats))\
 
 
 
@@ -39,9 +61,14 @@ RET sys_ ## NAME SIG;
 #define SYSCALLV(NAME, SIG, ARGS)\
 void sys_ ## NAME SIG;
 
+/* called without the kernel lock, see kernel_sys.c */
+#define SYSCALL_UNLOCKED(NAME, RET, SIG, ARGS)\
+RET sys_ ## NAME SIG;
+
 SYSCALLS
 
 #undef SYSCALL
 #undef SYSCALLV
+#undef SYSCALL_UNLOCKED
 
 #endif
\ No newline at end of file
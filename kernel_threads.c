@@ -38,6 +38,48 @@ int check_valid_ptcb(Tid_t tid){
     return 0;
 }
 
+/* PTCBs are created and freed with every thread, and with every process */
+static object_pool ptcb_pool = POOL_INIT_PERCORE("PTCB", sizeof(PTCB), sizeof(void*));
+
+PTCB* spawn_ptcb(PCB* pcb, Task task, int argl, void* args, void (*func)())
+{
+  PTCB* ptcb = (PTCB*) pool_alloc(&ptcb_pool);
+
+  ptcb->task = task;
+  ptcb->argl = argl;
+  ptcb->args = args;
+
+  ptcb->exitval = 0;
+  ptcb->exit_cv = COND_INIT;
+  ptcb->exited = 0;
+  ptcb->detached = 0;
+  ptcb->refcount = 0;
+
+  //initialization of new tcb
+  TCB* tcb  = spawn_thread(pcb, func);
+
+  // Connect new tcb with ptcb
+  tcb->ptcb = ptcb;
+  ptcb->tcb = tcb;
+
+  // Add ptcb_node to pcb's ptcb_list
+  rlnode_init(&ptcb->ptcb_list_node, ptcb);
+  rlist_push_back(&pcb->ptcb_list, &ptcb->ptcb_list_node);
+
+  // +1 thread to PCB
+  pcb->thread_count++;
+
+  return ptcb;
+}
+
+void release_ptcbs(PCB* pcb)
+{
+  while(!is_rlist_empty(&pcb->ptcb_list)) {
+    rlnode* node = rlist_pop_front(&pcb->ptcb_list);
+    pool_free(&ptcb_pool, node->obj);
+  }
+}
+
 /** 
   @brief Create a new thread in the current process.
   */
@@ -45,33 +87,7 @@ Tid_t sys_CreateThread(Task task, int argl, void* args){
 
   if(task != NULL){
 
-    //initialize ptcb and tcb
-    //initialization of new ptcb  
-    PTCB* ptcb = (PTCB*)xmalloc(sizeof(PTCB)); //acquire space for ptcb
-    
-    ptcb->task = task;
-    ptcb->argl = argl;
-    ptcb->args = (args == NULL ? NULL : args);
-
-    ptcb->exitval = 0;
-    ptcb->exit_cv = COND_INIT;
-    ptcb->exited = 0;
-    ptcb->detached = 0;
-    ptcb->refcount = 0;
-
-    //initialization of new tcb
-    TCB* tcb  = spawn_thread(CURPROC, start_new_multithread);
-
-    // Connect new tcb with ptcb
-    tcb->ptcb = ptcb;
-    ptcb->tcb = tcb;
-    
-    // Add ptcb_node to pcb's ptcb_list
-    rlnode_init(&ptcb->ptcb_list_node, ptcb); //Init the PTCB node, make it point itself!
-    rlist_push_back(&CURPROC->ptcb_list, &ptcb->ptcb_list_node); // Insert the new PTCB at the list of current PCB.
-
-    // +1 thread to PCB
-    CURPROC->thread_count++;
+    PTCB* ptcb = spawn_ptcb(CURPROC, task, argl, args, start_new_multithread);
 
     //Wake Up the new thread!
     wakeup(ptcb->tcb); 
@@ -127,7 +143,7 @@ int sys_ThreadJoin(Tid_t tid, int* exitval){
 
   if(T2->refcount == 0){ // If T2 exited and no other thread waits then remove from PTCB list
     rlist_remove(&T2->ptcb_list_node); 
-    free(T2);
+    pool_free(&ptcb_pool, T2);
   }
   
   return 0;
@@ -157,12 +173,17 @@ void sys_ThreadExit(int exitval){
   // Current thread(PTCB)
   PTCB* ptcb = (PTCB *)sys_ThreadSelf();
   
+  /* Add the usage of the thread to its process, which stops counting 
+     the TCB of an exited thread */
+  PCB* curproc = CURPROC;
+  sched_charge_exit();
+  rusage_fold(&curproc->usage, &ptcb->tcb->usage);
+
   ptcb->exited = 1;
   ptcb->exitval = exitval;
   kernel_broadcast(&ptcb->exit_cv); // signal rest of the threads
 
   /*sys_Exit()*/
-  PCB* curproc = CURPROC;
   curproc->thread_count--;
   if(curproc->thread_count == 0){
 
@@ -197,24 +218,19 @@ void sys_ThreadExit(int exitval){
      */
 
     /* Release the args data */
-    if(curproc->args) {
+    if(curproc->args != curproc->argbuf)
       free(curproc->args);
-      curproc->args = NULL;
-    }
+    curproc->args = NULL;
 
     /* Clean up FIDT */
-    for(int i=0;i<MAX_FILEID;i++) {
-      if(curproc->FIDT[i] != NULL) {
-        FCB_decref(curproc->FIDT[i]);
-        curproc->FIDT[i] = NULL;
-      }
-    }
+    release_FIDT(curproc);
 
     /* Disconnect my main_thread */
     curproc->main_thread = NULL;
     
-    /* Now, mark the process as exited. */
+    /* Now, mark the process as exited, and wake up a WaitChild for it. */
     curproc->pstate = ZOMBIE;
+    kernel_broadcast(& curproc->exit_cv);
   }
 
   /* Bye-bye cruel world */
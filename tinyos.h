@@ -39,16 +39,26 @@ typedef unsigned long timeout_t;
 /** @brief The invalid PID */
 #define NOPROC (-1)
 
-/** @brief The maximum number of processes */
-#define MAX_PROC 65536
+/** @brief The maximum number of processes 
+
+  This is the number of processes that may exist at the same time. A pid
+  is not reused as soon as its process is gone: pids are unique over a
+  much longer time, and @c pid%MAX_PROC identifies the slot of a process
+  in the process table.
+*/
+#define MAX_PROC (1 << 20)
 
 /** @brief The type of a file ID. */
 typedef int Fid_t;  
 
-/** @brief The maximum number of open files per process. 
-   Only values 0 to MAX_FILEID-1 are legal for file descriptors. */
+/** @brief The default limit of open files per process. 
+   Only values 0 to the limit minus 1 are legal for file descriptors.
+   @see SetFileLimit */
 #define MAX_FILEID 16
 
+/** @brief The highest limit of open files per process. */
+#define MAX_FILE_LIMIT 4096
+
 /** @brief The invalid file id. */
 #define NOFILE  (-1)
 
@@ -241,6 +251,46 @@ typedef int (*Task)(int, void*);
 Pid_t Exec(Task task, int argl, void* args);
 
 
+/** @brief The operation of a @ref spawn_file_action. */
+typedef enum spawn_op {
+  SPAWN_DUP2,   /**< @brief Copy fid @c fid of the child into @c newfid, as @c Dup2 */
+  SPAWN_CLOSE   /**< @brief Close fid @c fid of the child, as @c Close */
+} spawn_op;
+
+/** @brief A change to the file ids of a new process, made by @ref Spawn. */
+typedef struct spawn_file_action {
+  spawn_op op;    /**< @brief The operation */
+  Fid_t fid;      /**< @brief The fid to copy or to close */
+  Fid_t newfid;   /**< @brief The target of @c SPAWN_DUP2 */
+} spawn_file_action;
+
+/** @brief Create a new process, after changing the file ids it inherits.
+
+  This call is like @c Exec, except that the given file actions are applied,
+  in order, to the file ids that the new process inherits, before it starts.
+  This spares the parent (or the child) the calls to @c Dup2 and @c Close
+  that usually surround @c Exec, e.g., to connect a process to a pipe.
+  The file ids of the current process do not change.
+
+  If any of the actions fails, no process is created.
+
+  @param task the main function  of the new process
+  @param argl the length of byte array @c args
+  @param args the byte array copied as argument to `task`
+  @param actions an array of @c nactions file actions
+  @param nactions the number of actions, which may be 0
+  @return On success, the pid of the new process is returned.
+    On error, NOPROC is returned.
+     Possible errors:
+   -  The maximum number of processes has been reached.
+   -  An action refers to a file id that is illegal, or (for @c SPAWN_DUP2)
+      not open.
+   -  The operation of an action is unknown.
+  @see Exec
+  */
+Pid_t Spawn(Task task, int argl, void* args, const spawn_file_action* actions, unsigned int nactions);
+
+
 /** @brief Exit the current process.
 
   When this function is called by a process thread, the process terminates
@@ -279,6 +329,28 @@ void Exit(int val);
 */
 Pid_t WaitChild(Pid_t pid, int* exitval);
 
+
+/** @brief Reap many terminated children at once.
+
+   This call waits until some children of the current process have exited, and
+   then reaps up to @c max of them, storing their pids in @c pids and (if
+   @c status is not NULL) their exit statuses in @c status. A supervisor
+   of many short-lived children can thus reap them with few calls, rather than
+   one @c WaitChild(NOPROC) for each.
+
+   @param pids an array of at least @c max pids
+   @param status an array of at least @c max exit statuses, or NULL
+   @param max the maximum number of children to reap
+   @param timeout the maximum time to wait, in msec; 0 does not wait, and a negative 
+          value (e.g. @c (timeout_t)-1) waits without a limit
+   @return the number of children reaped, 0 if the timeout expired before any child
+   exited, or -1 on error. Possible errors are:
+   - @c pids is NULL or @c max is 0.
+   - the process has no child processes to wait on.
+   @see WaitChild
+*/
+int WaitChildren(Pid_t* pids, int* status, unsigned int max, timeout_t timeout);
+
 /** @brief Return the PID of the caller.
 
  This function returns the pid of the current process 
@@ -431,6 +503,7 @@ Fid_t OpenNull();
         Possible errors are:
          - The file descriptor is invalid.
          - There was a I/O runtime problem.
+        On a @c FID_NONBLOCK stream with no data available, @c WOULDBLOCK is returned.
  */
 int Read(Fid_t fd, char *buf, unsigned int size);
 
@@ -454,10 +527,57 @@ int Read(Fid_t fd, char *buf, unsigned int size);
    Possible errors are:
    - The file id is invalid.
    - There was a I/O runtime problem.
+   On a @c FID_NONBLOCK stream with no space available, @c WOULDBLOCK is returned.
  */
 int Write(Fid_t fd, const char* buf, unsigned int size);
 
 
+/** @brief A buffer for vectored I/O.
+   @see ReadV
+   @see WriteV
+ */
+typedef struct iovec_s {
+	void* base;				/**< The start of the buffer */
+	unsigned int len;		/**< The size of the buffer */
+} iovec_t;
+
+/** @brief The maximum number of buffers passed to @c ReadV or @c WriteV. */
+#define MAX_IOVEC 64
+
+
+/** @brief Read bytes from a stream into a number of buffers.
+
+   This call is like @c Read, but the data is scattered into the buffers 
+   @c iov[0], ..., @c iov[iovcnt-1], filling each buffer before the next. 
+   On a message stream (see @c PIPE_MESSAGE), one message is read, as if 
+   by a single @c Read into the concatenation of the buffers.
+
+  @param fd  the file ID of the stream to read from
+  @param iov an array of buffers
+  @param iovcnt the number of buffers, between 0 and @c MAX_IOVEC
+  @return the number of bytes copied, 0 if we have reached EOF, @c WOULDBLOCK,
+    or -1 on error, exactly as for @c Read. Additional reasons for error:
+    - @c iovcnt is out of range, or the total size of the buffers overflows.
+ */
+int ReadV(Fid_t fd, const iovec_t* iov, int iovcnt);
+
+
+/** @brief Write bytes to a stream from a number of buffers.
+
+   This call is like @c Write, but the data is gathered from the buffers 
+   @c iov[0], ..., @c iov[iovcnt-1], in order. 
+   On a message stream (see @c PIPE_MESSAGE), the buffers form a single message.
+
+  @param fd  the file ID of the stream to write to
+  @param iov an array of buffers
+  @param iovcnt the number of buffers, between 0 and @c MAX_IOVEC
+  @return the number of bytes copied, @c WOULDBLOCK, or -1 on error, exactly 
+    as for @c Write. Additional reasons for error:
+    - @c iovcnt is out of range, or the total size of the buffers overflows.
+ */
+int WriteV(Fid_t fd, const iovec_t* iov, int iovcnt);
+
+
 /** @brief Close a file id.
    
 
@@ -489,6 +609,60 @@ int Close(Fid_t fd);
  */
 int Dup2(Fid_t oldfd, Fid_t newfd);
 
+
+/** @brief Stream flag: do not block in I/O calls.
+
+  When this flag is set on a stream, @c Read and @c Write on pipes and
+  sockets never put the caller to sleep. If some data can be transferred,
+  a partial count is returned. If nothing can be transferred, the call
+  returns @c WOULDBLOCK. Also, @c Accept on a listening socket with no
+  pending requests returns @c NOFILE immediately.
+
+  @see SetFlags
+ */
+#define FID_NONBLOCK  1
+
+/** @brief Returned by I/O calls on a @c FID_NONBLOCK stream that would block. */
+#define WOULDBLOCK  (-2)
+
+
+/** @brief Set the flags of a stream.
+
+  The flags belong to the stream and not to the file id, therefore they
+  are shared by all file ids that refer to it (e.g., after @c Dup2 or
+  @c Exec). A newly opened stream has all flags cleared.
+
+  @param fd the file id of the stream
+  @param flags the new flags; a bitwise-or of @c FID_NONBLOCK, or 0
+  @return 0 on success and -1 on failure.
+  Possible reasons for failure:
+  - The file id is invalid.
+  - The flags contain unknown bits.
+ */
+int SetFlags(Fid_t fd, int flags);
+
+
+/** @brief Set the limit of open files of the process.
+
+  File ids range from 0 to @c limit-1. The limit of a new process is that
+  of its parent, or @c MAX_FILEID for the init process. The file table
+  of a process grows as needed, up to the limit.
+
+  @param limit the new limit, between 1 and @c MAX_FILE_LIMIT
+  @return 0 on success and -1 on failure.
+  Possible reasons for failure:
+  - The limit is out of range.
+  - A file id at or above the new limit is open.
+  @see GetFileLimit
+ */
+int SetFileLimit(unsigned int limit);
+
+
+/** @brief Return the limit of open files of the process.
+  @see SetFileLimit
+ */
+unsigned int GetFileLimit(void);
+
 /*******************************************
  *
  * Pipes
@@ -531,6 +705,158 @@ typedef struct pipe_s {
 */
 int Pipe(pipe_t* pipe);
 
+
+/** @brief The smallest buffer size of a pipe created by @c PipeEx. */
+#define PIPE_MIN_SIZE  512
+
+/** @brief The largest buffer size of a pipe created by @c PipeEx. */
+#define PIPE_MAX_SIZE  (4*1024*1024)
+
+
+/** @brief Flag for @c PipeEx: keep the data in a chain of segments, for @c ReadZC. */
+#define PIPE_SEGMENTED  1
+
+/** @brief Flag for @c PipeEx: preserve the boundaries of the written messages. */
+#define PIPE_MESSAGE  2
+
+/** @brief Writes of at least this many bytes to a segmented pipe get a segment of their own. */
+#define PIPE_SEGMENT_SIZE  (4*1024)
+
+
+/**
+	@brief Construct and return a pipe with a given buffer size.
+
+	This call is like @c Pipe, but the buffer of the new pipe can hold up to 
+	@c size bytes (rounded up to a power of two). The buffer does not occupy
+	this much memory from the start; it grows while writers fill it, and shrinks
+	again when the pipe is idle.
+
+	A large buffer lets bulk transfers proceed with fewer context switches, 
+	at the cost of memory.
+
+	If @c flags contains @c PIPE_SEGMENTED, the pipe stores the written data
+	in a chain of segments instead of a ring buffer. Each write of at least 
+	@c PIPE_SEGMENT_SIZE bytes is copied into a new segment, and smaller writes
+	are packed together. The reader can then use @c ReadZC to access the 
+	segments in place, instead of copying them out with @c Read.
+
+	If @c flags contains @c PIPE_MESSAGE, the pipe carries messages instead
+	of a byte stream. Each @c Write (or @c WriteV) sends one message, which is
+	stored whole or not at all, and each @c Read (or @c ReadV) returns one 
+	message. If the message does not fit in the buffer of @c Read, the rest of
+	it is discarded. A message, plus 4 bytes of overhead, must fit in the pipe
+	buffer, else @c Write returns -1. Writing 0 bytes sends no message, and
+	reading 0 bytes returns 0 at once, leaving the next message in the pipe.
+
+	@param pipe a pointer to a pipe_t structure for storing the file ids.
+	@param size the buffer size, between @c PIPE_MIN_SIZE and @c PIPE_MAX_SIZE.
+	@param flags 0, @c PIPE_SEGMENTED or @c PIPE_MESSAGE.
+	@returns 0 on success, or -1 on error. Possible reasons for error:
+		- the size is out of range.
+		- the flags contain unknown bits, or both @c PIPE_SEGMENTED and @c PIPE_MESSAGE.
+		- the available file ids for the process are exhausted.
+	@see Pipe
+*/
+int PipeEx(pipe_t* pipe, unsigned int size, int flags);
+
+
+/**
+	@brief Read from a segmented pipe without copying.
+
+	This call is like @c Read, but instead of copying the data to a buffer,
+	it stores in @c *data a pointer to up to @c size bytes inside the
+	next segment of the pipe. The data is removed from the pipe, but it
+	remains accessible until it is returned by a call to @c ReleaseZC.
+	Until then, it counts against the buffer size of the pipe, so writers
+	may wait for the reader to release its data.
+	Since a segment is returned at most, the call may return fewer bytes 
+	than are available in the pipe.
+
+	@param fd the read end of a pipe created with @c PIPE_SEGMENTED.
+	@param data a location to store the pointer to the data.
+	@param size the maximum number of bytes to return.
+	@returns the number of bytes returned, 0 if the pipe has reached end of data,
+	   @c WOULDBLOCK if the read end has the @c FID_NONBLOCK flag and no data is 
+	   available, or -1 on error. Possible reasons for error:
+		- @c fd is not the read end of a segmented pipe.
+	@see ReleaseZC
+*/
+int ReadZC(Fid_t fd, const char** data, unsigned int size);
+
+
+/**
+	@brief Return the data obtained by @c ReadZC to the pipe.
+
+	Each pointer returned by @c ReadZC must be released exactly once.
+	After the call, the data is no longer accessible. All unreleased data
+	is released when the pipe is closed.
+
+	@param fd the file id passed to @c ReadZC.
+	@param data a pointer returned by @c ReadZC.
+	@returns 0 on success, or -1 on error. Possible reasons for error:
+		- @c fd is not the read end of a segmented pipe.
+		- @c data was not returned by @c ReadZC, or is already released.
+*/
+int ReleaseZC(Fid_t fd, const char* data);
+
+
+/** @brief Flag for @c Splice and @c Tee: do not wait, return @c WOULDBLOCK instead. */
+#define SPLICE_NONBLOCK  1
+
+
+/**
+	@brief Move data from one stream to another, inside the kernel.
+
+	This call reads up to @c size bytes from stream @c in and writes them
+	to stream @c out, without passing them through a user buffer. It is
+	meant for programs that relay data, e.g., from a socket to the console.
+
+	When @c in is the read end of a pipe (or a connected socket), the data
+	is copied straight out of the pipe buffer: into the buffer of @c out if
+	that is a pipe or socket as well, or else by handing it directly to the
+	device of @c out. Other streams are read into a kernel buffer first.
+
+	Like @c Read, the call waits until some data is available at @c in, and
+	then transfers as much as it can at once, up to @c size bytes.
+	It does not wait if @c flags contains @c SPLICE_NONBLOCK, or if the
+	relevant stream has the @c FID_NONBLOCK flag set.
+
+	@param in the file id to read from.
+	@param out the file id to write to.
+	@param size the maximum number of bytes to move.
+	@param flags 0 or @c SPLICE_NONBLOCK.
+	@returns the number of bytes moved, 0 if @c in has reached end of data,
+	   @c WOULDBLOCK if the call would have to wait, or -1 on error.
+	   Possible reasons for error:
+		- a file id is invalid.
+		- @c in cannot be read, or @c out cannot be written.
+		- @c in and @c out are the two ends of the same pipe.
+		- @c in or @c out carries messages (see @c PIPE_MESSAGE).
+		- the flags contain unknown bits.
+	@see Tee
+*/
+int Splice(Fid_t in, Fid_t out, unsigned int size, int flags);
+
+
+/**
+	@brief Duplicate data from one pipe to another, inside the kernel.
+
+	This call is like @c Splice, but the data is not removed from @c in:
+	a subsequent @c Read or @c Splice from @c in returns the same bytes.
+	Both @c in and @c out must be pipes or connected sockets.
+
+	@param in the file id to copy from.
+	@param out the file id to copy to.
+	@param size the maximum number of bytes to copy.
+	@param flags 0 or @c SPLICE_NONBLOCK.
+	@returns the number of bytes copied, 0 if @c in has reached end of data,
+	   @c WOULDBLOCK if the call would have to wait, or -1 on error.
+	   Possible reasons for error are those of @c Splice, plus:
+		- @c in or @c out is not a pipe or connected socket.
+	@see Splice
+*/
+int Tee(Fid_t in, Fid_t out, unsigned int size, int flags);
+
 /*******************************************
  *
  * Sockets (local)
@@ -542,12 +868,12 @@ int Pipe(pipe_t* pipe);
 
 	A socket port is an integer between 1 and @c MAX_PORT.
 */
-typedef int16_t port_t;
+typedef int32_t port_t;
 
 /**
 	@brief the maximum legal port 
 */
-#define MAX_PORT 1023
+#define MAX_PORT 65535
 
 /**
 	@brief a null value for a port
@@ -583,17 +909,44 @@ Fid_t Socket(port_t port);
 	On each port there must be a unique listening socket (although any number
 	of non-listening sockets are allowed).
 
+	The listener queues at most @c LISTEN_BACKLOG connection requests
+	that have not been accepted yet. Use @c ListenEx for a different limit.
+
 	@param sock the socket to initialize as a listening socket
 	@returns 0 on success, -1 on error. Possible reasons for error:
 		- the file id is not legal
 		- the socket is not bound to a port
-		- the port bound to the socket is occupied by another listener
+		- the port bound to the socket is occupied by another listener,
+		  unless both set @c SOCKOPT_REUSEPORT
 		- the socket has already been initialized
 	@see Socket
  */
 int Listen(Fid_t sock);
 
 
+/** @brief The backlog of a listener initialized by @c Listen. */
+#define LISTEN_BACKLOG 128
+
+/** @brief The largest backlog accepted by @c ListenEx. */
+#define MAX_BACKLOG 4096
+
+/**
+	@brief Initialize a socket as a listening socket, with a given backlog.
+
+	This is the same as @c Listen, but the listener queues at most @c backlog 
+	connection requests that have not been accepted yet. When the queue is
+	full, @c Connect to the listener fails at once, instead of waiting.
+
+	@param sock the socket to initialize as a listening socket
+	@param backlog the maximum number of pending requests, between 1 
+		and @c MAX_BACKLOG
+	@returns 0 on success, -1 on error. The reasons for error are those 
+		of @c Listen, and a @c backlog out of range.
+	@see Listen
+ */
+int ListenEx(Fid_t sock, unsigned int backlog);
+
+
 /**
 	@brief Wait for a connection.
 
@@ -620,6 +973,30 @@ int Listen(Fid_t sock);
 Fid_t Accept(Fid_t lsock);
 
 
+/**
+	@brief Accept a number of connections at once.
+
+	This call waits, like @c Accept, until the listener has a pending request.
+	Then, it accepts up to @c max of the pending requests, without waiting for
+	more, and stores the file ids of the new sockets in @c socks.
+
+	The stream flags of the new sockets (see @c SetFlags) are set to @c flags.
+
+	@param lsock the listening socket
+	@param socks an array of at least @c max file ids
+	@param max the maximum number of connections to accept
+	@param flags the stream flags of the new sockets; a bitwise-or 
+		of @c FID_NONBLOCK, or 0
+	@returns the number of accepted connections on success, which is at
+		least 1, or @c NOFILE on error. The reasons for error are those
+		of @c Accept, and also:
+		- @c max is 0, or @c socks is NULL
+		- @c flags contain unknown bits
+	@see Accept
+ */
+int AcceptBatch(Fid_t lsock, Fid_t* socks, unsigned int max, int flags);
+
+
 
 /**
 	@brief Create a connection to a listener at a specific port.
@@ -636,6 +1013,11 @@ Fid_t Accept(Fid_t lsock);
 	in the order of 100's of msec. Therefore, a timeout of at least 500 msec is
 	reasonable. If a negative timeout is given, it means, "infinite timeout".
 
+	If several listeners share the port (see @c SOCKOPT_REUSEPORT), the
+	request goes to one of them, preferring a listener with a thread blocked
+	in @c Accept, and else the one with the fewest pending requests. Ties are
+	broken in round-robin order.
+
 	@params sock the socket to connect to the other end
 	@params port the port on which to seek a listening socket
 	@params timeout the approximate amount of time to wait for a
@@ -644,6 +1026,7 @@ Fid_t Accept(Fid_t lsock);
 	   - the file id @c sock is not legal (i.e., an unconnected, non-listening socket)
 	   - the given port is illegal.
 	   - the port does not have a listening socket bound to it by @c Listen.
+	   - the queue of the listener is full (see @c ListenEx).
 	   - the timeout has expired without a successful connection.
 */
 int Connect(Fid_t sock, port_t port, timeout_t timeout);
@@ -694,6 +1077,173 @@ typedef enum {
 int ShutDown(Fid_t sock, shutdown_mode how);
 
 
+/**
+   @brief Socket options.
+
+   These constants define the legal values for passing the second argument to
+   the @c SetSockOpt call.
+
+   @see SetSockOpt
+*/
+typedef enum {
+  SOCKOPT_SNDBUF=1,   /**< Buffer size for the sending direction. */
+  SOCKOPT_RCVBUF=2,   /**< Buffer size for the receiving direction. */
+  SOCKOPT_MESSAGE=3,  /**< 1 for a message connection, 0 (the default) for a byte stream. */
+  SOCKOPT_REUSEPORT=4,/**< 1 to let a listener share its port with other listeners that set it. */
+  SOCKOPT_RCVLOWAT=5, /**< The number of bytes a reader waits for (default 1). */
+  SOCKOPT_RCVTIMEO=6, /**< The longest time in msec a reader waits, or 0 (the default) for no limit. */
+  SOCKOPT_SNDTIMEO=7, /**< The longest time in msec a writer waits, or 0 (the default) for no limit. */
+  SOCKOPT_CORK=8,     /**< The bytes written before the reader is woken up, or 0 (the default). */
+  SOCKOPT_RCVWAKEUPS=9 /**< (Read-only) The times a reader of the socket slept waiting for data. */
+} socket_option;
+
+
+/**
+   @brief Set an option of a socket.
+
+   The buffer size options control the size of the pipe buffers which carry the
+   data of a connection, exactly as for @c PipeEx. The buffer of each direction is
+   sized by the receiving socket's @c SOCKOPT_RCVBUF, if it was set, and else by
+   the sending socket's @c SOCKOPT_SNDBUF, if it was set. Otherwise, the default
+   size of @c Pipe is used.
+
+   Options set on a listening socket are inherited by the sockets returned by
+   @c Accept. Options set on a connected socket take effect immediately.
+
+   The @c SOCKOPT_MESSAGE option makes the connection carry messages, with the 
+   semantics of a @c PIPE_MESSAGE pipe in each direction. It must be set on 
+   the listening socket and on the connecting socket before @c Connect, which
+   fails if the two do not agree. It cannot be changed on a connected socket.
+
+   The @c SOCKOPT_REUSEPORT option must be set before @c Listen, on every 
+   listener of a port. The connection requests to the port are then spread
+   over its listeners (see @c Connect).
+
+   With @c SOCKOPT_RCVLOWAT, a blocking @c Read waits until the given number of
+   bytes (at most the receive buffer size) is available, and then returns as 
+   much as it is asked for. The writer does not wake up the reader for fewer 
+   bytes. At EOF, or when the read times out, the reader gets what is there. 
+   Reads of a message connection wait for one message, whatever the option.
+
+   With @c SOCKOPT_RCVTIMEO (@c SOCKOPT_SNDTIMEO), a @c Read (@c Write) that
+   has waited for the given time returns what it has transferred, or 
+   @c WOULDBLOCK if nothing. The resolution of the timeouts is that of 
+   @c Connect.
+
+   The writes of a burst wake up a blocked reader only once, as the reader 
+   takes all the data written until it runs. With @c SOCKOPT_CORK, a writer
+   wakes up the reader only once the given number of bytes (at most the
+   buffer size) is buffered, or when it has to wait for space, or when the
+   option is set back to 0. The data is not hidden from a reader that does
+   not block. @c SOCKOPT_RCVWAKEUPS counts the times the reader blocked, and
+   can only be read by @c GetSockOpt.
+
+   @param sock the file ID of the socket.
+   @param option the option to set
+   @param value the new value of the option
+   @returns 0 on success and -1 on error. Possible reasons for error:
+       - the file id @c sock is not legal (a socket).
+       - the option is unknown, or the value is out of range.
+       - @c SOCKOPT_MESSAGE is set on a connected socket.
+       - @c SOCKOPT_REUSEPORT is set on a listening or connected socket.
+*/
+int SetSockOpt(Fid_t sock, socket_option option, unsigned int value);
+
+
+/**
+   @brief Get an option of a socket.
+
+   The value of an option is the one set by @c SetSockOpt, or its default.
+   For the buffer size options, it is the size of the buffer used by the
+   connection, or that would be used if the socket connected now.
+
+   @param sock the file ID of the socket.
+   @param option the option to get
+   @param value the location to store the value into
+   @returns 0 on success and -1 on error. Possible reasons for error:
+       - the file id @c sock is not legal (a socket).
+       - the option is unknown, or @c value is NULL.
+*/
+int GetSockOpt(Fid_t sock, socket_option option, unsigned int* value);
+
+
+/**
+	@brief The connection queue statistics of a listening socket.
+
+	@see ListenStats
+  */
+typedef struct listen_stats
+{
+	unsigned int backlog;		/**< @brief The maximum number of pending requests */
+	unsigned int pending;		/**< @brief Requests waiting to be accepted */
+	unsigned int peak;			/**< @brief The maximum of @c pending so far */
+	unsigned int acceptors;		/**< @brief Threads blocked in @c Accept */
+	unsigned long accepted;		/**< @brief Requests accepted so far */
+	unsigned long rejected;		/**< @brief Requests refused because the queue was full */
+} listen_stats;
+
+
+/**
+	@brief Return the queue statistics of a listening socket.
+
+	@param lsock the listening socket
+	@param stats the location to store the statistics into
+	@returns 0 on success, or -1 if @c lsock is not a listening socket, 
+		or @c stats is NULL.
+ */
+int ListenStats(Fid_t lsock, listen_stats* stats);
+
+
+/**
+   @brief Send a stream to the other end of a connected socket.
+
+   The stream of @c fid is queued on the connection, and can be received by the
+   other socket of the connection with @c RecvFid, possibly in another process.
+   The stream stays open while it is queued, even if @c fid is closed by the 
+   sender. The streams sent in one direction are received in the order they 
+   were sent. They are not ordered with respect to the data of the connection.
+
+   At most @c MAX_FILEID streams can be queued in each direction. The streams 
+   still queued for a socket are closed when the socket is closed.
+
+   A socket which has streams queued on its connection (in either direction)
+   cannot be sent, and neither can a socket of the connection itself, since 
+   the connection would then hold itself open.
+
+   @param sock the connected socket to send with
+   @param fid the stream to send
+   @returns 0 on success and -1 on error. Possible reasons for error:
+       - @c sock is not a connected socket, or its write direction, or the 
+         read direction of the other end, has been shut down.
+       - @c fid is not a legal file ID.
+       - the queue of the connection is full.
+       - @c fid is a socket which cannot be sent.
+   @see RecvFid
+*/
+int SendFid(Fid_t sock, Fid_t fid);
+
+
+/**
+   @brief Receive a stream sent with @c SendFid.
+
+   The oldest stream queued for @c sock is installed in the file table of the 
+   process. If none is queued, the call blocks until one is sent, unless
+   the socket is non-blocking (see @c SetFlags). The wait is limited by
+   @c SOCKOPT_RCVTIMEO.
+
+   @param sock the connected socket to receive with
+   @returns the new file ID of the stream, or NOFILE on error. Possible reasons 
+       for error:
+       - @c sock is not a connected socket, or its read direction has been
+         shut down.
+       - no stream was queued and the other end has shut down writing, or the 
+         socket is non-blocking, or the wait timed out.
+       - the file table of the process is full. The stream stays queued.
+   @see SendFid
+*/
+Fid_t RecvFid(Fid_t sock);
+
+
 
 /*******************************************
  *
@@ -706,6 +1256,25 @@ int ShutDown(Fid_t sock, shutdown_mode how);
   */
 #define PROCINFO_MAX_ARGS_SIZE (128)
 
+/**
+	@brief The resources used by a process.
+
+	The counters start at 0 when the process is created, and
+	include the usage of all its threads, past and present.
+	@see GetRusage
+  */
+typedef struct rusage_s
+{
+	unsigned long cpu_time;		/**< @brief Time on a core, in usec, in units of the timer resolution */
+	unsigned long switches;		/**< @brief Times a thread of the process gave up its core */
+	unsigned long preemptions;	/**< @brief How many of @c switches were at the end of a time slice */
+	unsigned long reads;		/**< @brief Successful calls to @c Read and @c ReadV */
+	unsigned long writes;		/**< @brief Successful calls to @c Write and @c WriteV */
+	unsigned long read_bytes;	/**< @brief Bytes returned by @c reads */
+	unsigned long write_bytes;	/**< @brief Bytes accepted by @c writes */
+} rusage_t;
+
+
 /**
 	@brief A struct containing process-related information for a non-free
 	pid.
@@ -723,6 +1292,8 @@ typedef struct procinfo
   int alive;      /**< @brief Non-zero if process is alive, zero if process is zombie. */
 	
   unsigned long thread_count; /**< Current no of threads. */
+
+  rusage_t usage;  /**< @brief The resources used by the process so far. */
 	
   Task main_task;  /**< @brief The main task of the process. */
 	
@@ -739,27 +1310,128 @@ typedef struct procinfo
 } procinfo;
 
 
+/** @brief Apply the @c ppid of a @ref procinfo_filter */
+#define PROCINFO_MATCH_PPID 1
+/** @brief Apply the @c alive field of a @ref procinfo_filter */
+#define PROCINFO_MATCH_STATE 2
+/** @brief Apply the pid range of a @ref procinfo_filter */
+#define PROCINFO_MATCH_PIDS 4
+
+/**
+	@brief The processes returned by an information stream.
+
+	Only the filters named in @c match apply; a zeroed filter matches
+	all processes.
+
+	@see OpenInfoEx
+  */
+typedef struct procinfo_filter
+{
+	int match;		/**< @brief A mask of @c PROCINFO_MATCH_* flags */
+	Pid_t ppid;		/**< @brief Only the children of this process */
+	int alive;		/**< @brief Only live processes if non-zero, else only zombies */
+	Pid_t min_pid;	/**< @brief Only pids from @c min_pid ... */
+	Pid_t max_pid;	/**< @brief ... to @c max_pid (inclusive) */
+} procinfo_filter;
+
+
 /**
 	@brief Open a kernel information stream.
 
 	This is a read-only stream that returns a sequence of 
 	@c procinfo structures,
 	each packed into a block of size @c sizeof(procinfo).
+	A @c Read returns as many whole blocks as fit in its buffer, 
+	and 0 at the end of the sequence. A buffer smaller than 
+	@c sizeof(procinfo) is an error.
 
 	Each procinfo structure contains information pertaining to some
 	used PCB (active or zombie) during the time of the stream. 
 
 	There is no guarantee of the timeliness of the information.
 	A best-effort approach to return relevant system information is
-	made. 
+	made. Processes are returned in the order of their creation, each
+	at most once; processes created while the stream is read may be
+	returned as well.
 
 	@returns a file id on success, or NOFILE on error. Possible reasons
 		for error are:
 		- the available file ids for the process are exhausted.
+	@see OpenInfoEx
  */
 Fid_t OpenInfo();
 
 
+/**
+	@brief Open a kernel information stream for some of the processes.
+
+	This is like @ref OpenInfo, but only the processes that match
+	@c filter are returned. The filter is copied.
+
+	@param filter the processes to return, or NULL for all
+	@returns a file id on success, or NOFILE on error. Possible reasons
+		for error are:
+		- the available file ids for the process are exhausted.
+		- the @c match field of the filter has unknown flags.
+ */
+Fid_t OpenInfoEx(const procinfo_filter* filter);
+
+
+/**
+	@brief Get the resources used by a process.
+
+	The counters of a live process are sampled without stopping it,
+	so they may be slightly behind. The CPU time of a thread is 
+	updated when it gives up its core, and when it exits. The I/O
+	counters do not include @c Splice, @c Tee and @c ReadZC.
+
+	Sampling a process twice gives its usage in the meantime; this
+	is how the @c top program of the shell computes its load.
+
+	@param pid the process, which may be a zombie, or NOPROC for the caller
+	@param usage the usage of the process is stored here
+	@returns 0 on success, or -1 on error. Possible reasons for error are:
+		- @c pid is not a used pid
+		- @c usage is NULL
+	@see OpenInfo
+ */
+int GetRusage(Pid_t pid, rusage_t* usage);
+
+
+/**
+	@brief Usage counters of a kernel object pool.
+
+	The kernel allocates control blocks that are created and destroyed
+	often (e.g. of pipes and sockets) from pools, which take memory from
+	the heap in slabs and keep freed objects for reuse.
+	@see PoolStats
+  */
+typedef struct pool_stats
+{
+	char name[24];				/**< @brief The kind of object, e.g. "pipeCB" */
+	unsigned int object_size;	/**< @brief The size of each object in bytes */
+	unsigned int in_use;		/**< @brief Objects currently allocated */
+	unsigned int cached;		/**< @brief Free objects kept for reuse */
+	unsigned int peak;			/**< @brief The maximum of @c in_use so far */
+	unsigned int slabs;			/**< @brief Slabs taken from the heap */
+	unsigned long allocs;		/**< @brief Allocations so far */
+} pool_stats;
+
+
+/**
+	@brief Return the usage counters of a kernel object pool.
+
+	The pools are numbered from 0, in the order they were first used,
+	so a program can list them all by calling this with 0, 1, 2... until
+	it fails.
+
+	@param pool the number of the pool
+	@param stats the location to store the counters into
+	@returns 0 on success, or -1 if there is no such pool, or @c stats is NULL.
+ */
+int PoolStats(unsigned int pool, pool_stats* stats);
+
+
 
 
 /*******************************************
@@ -21,6 +21,7 @@ int Repeat(size_t,const char**);
 int Hanoi(size_t,const char**);
 int HelpMessage(size_t,const char**);
 int SystemInfo(size_t,const char**);
+int Top(size_t,const char**);
 int Capitalize(size_t,const char**);
 int LowerCase(size_t,const char**);
 int LineEnum(size_t,const char**);
@@ -39,6 +40,7 @@ COMMANDS[]  =
 	{"help", HelpMessage, 0, "A help message."},
 	{"ls", ListPrograms, 0, "List available programs programs."},
 	{"sysinfo", SystemInfo, 0, "Print some basic info about the current system."},
+	{"top", Top, 0, "top [<n> [<msec>]] (default: <n>=1, <msec>=1000). Print the usage of each process over <n> periods of <msec>."},
 	{"runterm", RunTerm, 2, "runterm <term> <prog>  <args...> : execute '<prog> <args...>' on terminal <term>."},
 	{"sh", Shell, 0, "Run a shell."},
 	{"repeat", Repeat, 2, "repeat <n> <prog> <args...>: execute '<prog> <args...>' <n> times."},
@@ -164,6 +166,22 @@ int RunTerm(size_t argc, const char** argv)
 }
 
 
+/* The program name of a process, which points into info */
+static const char* procinfo_name(procinfo* info)
+{
+	Program prog=NULL;
+	const char* argv[10];
+	int argc = ParseProcInfo(info, &prog, 10, argv);
+
+	if(argc>=1)
+		return argv[0];
+	if(argc==-1) {
+		/* Try to give some known names */
+		if(info->pid==1) return "init";
+	}
+	return "-";
+}
+
 int SystemInfo(size_t argc, const char** argv)
 {
 	printf("Number of cores         = %d\n", cpu_cores());
@@ -171,34 +189,101 @@ int SystemInfo(size_t argc, const char** argv)
 	Fid_t finfo = OpenInfo();
 	if(finfo!=NOFILE) {
 		/* Print per-process info */
-		procinfo info;
+		procinfo info[16];
 		printf("%5s %5s %6s %8s %20s\n",
 			"PID", "PPID", "State", "Threads", "Main program"
 			);
-		/* Read in next piece of info */		
-		while(Read(finfo, (char*) &info, sizeof(info)) > 0) {
-			Program prog=NULL;
-			const char* argv[10];
-			int argc = ParseProcInfo(&info, &prog, 10, argv);
-
-			const char* pname = "-";
-			if(argc>=1)  {
-				pname = argv[0];
-			} else if(argc==-1) {
-				/* Try to give some known names */
-				if(info.pid==1) pname = "init";
+		/* Read in the next pieces of info */		
+		int n;
+		while((n = Read(finfo, (char*) info, sizeof(info))) > 0) {
+			for(int i=0; i < n / (int) sizeof(procinfo); i++) {
+				printf("%5d %5d %6s %8lu %20s\n",
+					info[i].pid,
+					info[i].ppid,
+					(info[i].alive?"ALIVE":"ZOMBIE"),
+					info[i].thread_count,
+					procinfo_name(&info[i])
+					);
 			}
+		}
+		Close(finfo);
+	}
+	printf("\n");
+	return 0;
+}
+
 
-			printf("%5d %5d %6s %8u %20s\n",
-				info.pid,
-				info.ppid,
-				(info.alive?"ALIVE":"ZOMBIE"),
-				info.thread_count,
-				pname
+#define TOP_PROCS 64
+
+/* Read the info of the first TOP_PROCS processes, returns their number or -1 */
+static int top_sample(procinfo* info)
+{
+	Fid_t finfo = OpenInfo();
+	if(finfo==NOFILE) return -1;
+
+	int count = 0, n;
+	while(count < TOP_PROCS && 
+		(n = Read(finfo, (char*) (info+count), (TOP_PROCS-count)*sizeof(procinfo))) > 0)
+		count += n / sizeof(procinfo);
+	Close(finfo);
+	return count;
+}
+
+int Top(size_t argc, const char** argv)
+{
+	int rounds = (argc>1) ? getint(1) : 1;
+	int msec = (argc>2) ? getint(2) : 1000;
+	if(msec <= 0) msec = 1000;
+
+	/* Two samples, taken msec apart */
+	procinfo* sample[2];
+	sample[0] = malloc(2*TOP_PROCS*sizeof(procinfo));
+	if(sample[0] == NULL) {
+		printf("Out of memory for %d process records.\n", 2*TOP_PROCS);
+		return 1;
+	}
+	sample[1] = sample[0] + TOP_PROCS;
+	int count[2];
+
+	Mutex mx = MUTEX_INIT;
+	CondVar cv = COND_INIT;
+
+	count[0] = top_sample(sample[0]);
+	for(int r=0; r < rounds && count[r%2] >= 0; r++) {
+		procinfo* before = sample[r%2];
+		procinfo* after = sample[(r+1)%2];
+
+		Mutex_Lock(&mx);
+		Cond_TimedWait(&mx, &cv, msec);
+		Mutex_Unlock(&mx);
+
+		int nbefore = count[r%2];
+		int nafter = count[(r+1)%2] = top_sample(after);
+
+		printf("%5s %5s %6s %6s %8s %10s %10s %20s\n",
+			"PID", "PPID", "State", "CPU%", "Switches", "Read", "Written", "Main program");
+		for(int i=0; i < nafter; i++) {
+			/* A process that is not in the first sample started from 0 */
+			rusage_t prev = { 0 };
+			for(int j=0; j < nbefore; j++)
+				if(before[j].pid == after[i].pid) { prev = before[j].usage; break; }
+
+			rusage_t* u = &after[i].usage;
+			printf("%5d %5d %6s %5.1f%% %8lu %10lu %10lu %20s\n",
+				after[i].pid,
+				after[i].ppid,
+				(after[i].alive?"ALIVE":"ZOMBIE"),
+				(u->cpu_time - prev.cpu_time) / (10.0 * msec),
+				u->switches - prev.switches,
+				u->read_bytes - prev.read_bytes,
+				u->write_bytes - prev.write_bytes,
+				procinfo_name(&after[i])
 				);
 		}
+		printf("\n");
 	}
-	printf("\n");
+
+	free(sample[0]);
 	return 0;
 }
 
@@ -759,15 +844,9 @@ int RemoteClient(size_t argc, const char** argv)
 	send_message(sock, args, argl);
 	ShutDown(sock, SHUTDOWN_WRITE);
 
-	/* Read the server data and display */
-	char c;
-	FILE* fin = fidopen(sock, "r");
-	FILE* fout = fidopen(1, "w");
-	while((c=fgetc(fin))!=EOF) {
-		fputc(c, fout);
-	}
-	fclose(fin);
-	fclose(fout);
+	/* Relay the server data to the display */
+	while(Splice(sock, 1, 1024, 0) > 0);
+	Close(sock);
 	return 0;
 }
 
@@ -790,15 +869,6 @@ int process_builtin(int argc, const char** argv)
 }
 
 
-static inline Fid_t savefid(Fid_t fsaved)
-{
-	Fid_t savior = OpenNull();
-	assert(savior!=NOFILE);
-	Dup2(fsaved, savior);
-	return savior;
-}
-
-
 int process_line(int argc, const char** argv)
 {
 	/* Split up into pipeline fragments */
@@ -836,36 +906,35 @@ int process_line(int argc, const char** argv)
 		comd[i] = c;
 	}
 
-	/* Construct pipeline */
+	/* Construct pipeline. Each child gets its pipe ends as 0 and 1,
+	   without changing our own fids. */
 	int child[frag];
-	int savein, saveout;
-
-	savein = savefid(0);
-	saveout = savefid(1);
+	Fid_t in = 0;
 
-	pipe_t pipe;
 	for(int i=0; i<frag; i++) {
+		spawn_file_action act[5];
+		unsigned int nact = 0;
+		pipe_t pipe;
+
+		if(in != 0) {
+			act[nact++] = (spawn_file_action){ SPAWN_DUP2, in, 0 };
+			act[nact++] = (spawn_file_action){ SPAWN_CLOSE, in, NOFILE };
+		}
 		if(i<frag-1) {
 			/* Not the last fragment, make a pipe */
 			Pipe(& pipe);
-			Dup2(pipe.write,1);
-			Close(pipe.write);
-		} else {
-			/* Last fragment, restore saved 1 */
-			Dup2(saveout, 1);
-			Close(saveout);				
+			act[nact++] = (spawn_file_action){ SPAWN_DUP2, pipe.write, 1 };
+			act[nact++] = (spawn_file_action){ SPAWN_CLOSE, pipe.write, NOFILE };
+			act[nact++] = (spawn_file_action){ SPAWN_CLOSE, pipe.read, NOFILE };
 		}
 
-		child[i] = Execute(COMMANDS[comd[i]].prog, Vargc[i], Vargv[i]);
+		child[i] = ExecuteEx(COMMANDS[comd[i]].prog, Vargc[i], Vargv[i], act, nact);
 
+		if(in != 0) 
+			Close(in);
 		if(i<frag-1) {
-			/* Not the last fragment, make a pipe */
-			Dup2(pipe.read,0);
-			Close(pipe.read);
-		} else {
-			/* Last fragment, restore saved 1 */
-			Dup2(savein, 0);
-			Close(savein);
+			Close(pipe.write);
+			in = pipe.read;
 		}
 	}
 
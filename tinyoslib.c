@@ -146,6 +146,13 @@ int ParseProcInfo(procinfo* pinfo, Program* prog, int argc, const char** argv )
 
 
 int Execute(Program prog, size_t argc, const char** argv)
+{
+	return ExecuteEx(prog, argc, argv, NULL, 0);
+}
+
+
+int ExecuteEx(Program prog, size_t argc, const char** argv, 
+	const spawn_file_action* actions, unsigned int nactions)
 {
 	/* We will pack the prog pointer and the arguments to 
 	  an argument buffer.
@@ -164,7 +171,7 @@ int Execute(Program prog, size_t argc, const char** argv)
 	argvpack(args+sizeof(prog), argc, argv);
 
 	/* Execute the process */
-	return Exec(exec_wrapper, argl, args);
+	return Spawn(exec_wrapper, argl, args, actions, nactions);
 }
 
 
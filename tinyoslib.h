@@ -44,6 +44,16 @@ typedef int (*Program)(size_t argc, const char** argv);
 int Execute(Program prog, size_t argc, const char** argv);
 
 
+/**
+	@brief Execute a new process, changing the file ids it inherits.
+
+	This is like @ref Execute, but it uses the @c Spawn system call,
+	applying the given file actions to the new process.
+  */
+int ExecuteEx(Program prog, size_t argc, const char** argv, 
+	const spawn_file_action* actions, unsigned int nactions);
+
+
 /**
 	@brief Try to reclaim the arguments of a process.
 
@@ -119,6 +119,22 @@ static inline void * xmalloc (size_t size)
 }
 
 
+/**
+	@brief A wrapper for aligned_alloc checking for out-of-memory.
+
+	@param align the alignment, a power of two
+	@param size the number of bytes allocated, rounded up to a multiple of @c align
+	@returns the new memory block, to be released by free()
+  */
+static inline void * xmalloc_aligned (size_t align, size_t size)
+{
+  void *value = aligned_alloc (align, (size + align - 1) & ~(align - 1));
+  if (value == 0)
+    FATAL("virtual memory exhausted");
+  return value;
+}
+
+
 /** @}   check_macros  */
 
 
@@ -5,6 +5,7 @@
 #include <time.h>
 #include <math.h>
 #include <setjmp.h>
+#include <malloc.h>
 
 #include "util.h"
 #include "symposium.h"
@@ -2593,11 +2594,1584 @@ BARE_TEST(dummy_user_test,
 }
 
 
+BOOT_TEST(test_pipe_nonblocking,
+	"Test that a FID_NONBLOCK pipe returns partial counts and WOULDBLOCK instead of sleeping."
+	)
+{
+	pipe_t pipe;
+	ASSERT(Pipe(&pipe)==0);
+	ASSERT(SetFlags(pipe.read, FID_NONBLOCK)==0);
+	ASSERT(SetFlags(pipe.write, FID_NONBLOCK)==0);
+	ASSERT(SetFlags(pipe.write, ~0)==-1);
+	ASSERT(SetFlags(MAX_FILEID, 0)==-1);
+
+	char buffer[16384];
+	ASSERT(Read(pipe.read, buffer, 10)==WOULDBLOCK);
+
+	/* Fill the pipe with a partial write */
+	int rc = Write(pipe.write, buffer, sizeof(buffer));
+	ASSERT(rc>0 && rc<sizeof(buffer));
+	ASSERT(Write(pipe.write, buffer, 1)==WOULDBLOCK);
+
+	/* Drain it with a partial read */
+	ASSERT(Read(pipe.read, buffer, sizeof(buffer))==rc);
+	ASSERT(Read(pipe.read, buffer, sizeof(buffer))==WOULDBLOCK);
+
+	ASSERT(Write(pipe.write, "Hello", 6)==6);
+	Close(pipe.write);
+	ASSERT(Read(pipe.read, buffer, sizeof(buffer))==6);
+	ASSERT(Read(pipe.read, buffer, sizeof(buffer))==0);
+	return 0;
+}
+
+
+BOOT_TEST(test_pipe_ex_buffer_size,
+	"Test that PipeEx creates pipes whose buffer holds the requested size."
+	)
+{
+	pipe_t pipe;
+	ASSERT(PipeEx(&pipe, PIPE_MIN_SIZE-1, 0)==-1);
+	ASSERT(PipeEx(&pipe, PIPE_MAX_SIZE+1, 0)==-1);
+
+	static char buffer[256*1024];
+	for(unsigned int size = PIPE_MIN_SIZE; size <= sizeof(buffer); size *= 8) {
+		ASSERT(PipeEx(&pipe, size, 0)==0);
+		ASSERT(SetFlags(pipe.write, FID_NONBLOCK)==0);
+
+		/* The buffer grows to the requested size, but not beyond */
+		ASSERT(Write(pipe.write, buffer, sizeof(buffer))==size);
+		ASSERT(Read(pipe.read, buffer, sizeof(buffer))==size);
+		ASSERT(Write(pipe.write, buffer, 100)==100);
+		ASSERT(Read(pipe.read, buffer, sizeof(buffer))==100);
+
+		Close(pipe.read);
+		Close(pipe.write);
+	}
+	return 0;
+}
+
+
+BOOT_TEST(test_socket_buffer_options,
+	"Test that SetSockOpt sizes the buffers of a connection."
+	)
+{
+	Fid_t lsock = Socket(100);
+	ASSERT(SetSockOpt(lsock, SOCKOPT_RCVBUF, 64*1024)==0);
+	ASSERT(SetSockOpt(lsock, SOCKOPT_RCVBUF, PIPE_MAX_SIZE+1)==-1);
+	ASSERT(SetSockOpt(lsock, 0, 1024)==-1);
+	ASSERT(Listen(lsock)==0);
+
+	Fid_t cli = Socket(NOPORT), srv;
+	connect_sockets(cli, lsock, &srv, 100);
+
+	static char buffer[128*1024];
+	ASSERT(SetFlags(cli, FID_NONBLOCK)==0);
+	ASSERT(SetFlags(srv, FID_NONBLOCK)==0);
+
+	/* The server inherited a 64 KiB receive buffer */
+	ASSERT(Write(cli, buffer, sizeof(buffer))==64*1024);
+	ASSERT(Read(srv, buffer, sizeof(buffer))==64*1024);
+
+	/* The other direction has the default size, until we change it */
+	int rc = Write(srv, buffer, sizeof(buffer));
+	ASSERT(rc>0 && rc<64*1024);
+	ASSERT(Read(cli, buffer, sizeof(buffer))==rc);
+	ASSERT(SetSockOpt(srv, SOCKOPT_SNDBUF, 128*1024)==0);
+	ASSERT(Write(srv, buffer, sizeof(buffer))==128*1024);
+	return 0;
+}
+
+
+BOOT_TEST(test_splice_and_tee,
+	"Test that Splice and Tee move data between pipes and devices."
+	)
+{
+	pipe_t p1, p2;
+	ASSERT(Pipe(&p1)==0);
+	ASSERT(Pipe(&p2)==0);
+	Fid_t null = OpenNull();
+
+	char buffer[64];
+
+	/* Bad arguments */
+	ASSERT(Splice(p1.read, p1.write, 10, 0)==-1);
+	ASSERT(Splice(p1.write, p2.write, 10, 0)==-1);
+	ASSERT(Splice(p1.read, p2.read, 10, 0)==-1);
+	ASSERT(Splice(p1.read, p2.write, 10, 2)==-1);
+	ASSERT(Tee(p1.read, null, 10, 0)==-1);
+	ASSERT(Splice(p1.read, p2.write, 10, SPLICE_NONBLOCK)==WOULDBLOCK);
+	ASSERT(Tee(p1.read, p2.write, 10, SPLICE_NONBLOCK)==WOULDBLOCK);
+
+	/* Tee copies without consuming, Splice moves */
+	ASSERT(Write(p1.write, "hello world", 11)==11);
+	ASSERT(Tee(p1.read, p2.write, 5, 0)==5);
+	ASSERT(Splice(p1.read, p2.write, 100, 0)==11);
+	ASSERT(Read(p2.read, buffer, sizeof(buffer))==16);
+	ASSERT(memcmp(buffer, "hellohello world", 16)==0);
+
+	/* Splice into a device, and from a device */
+	ASSERT(Write(p1.write, "abc", 3)==3);
+	ASSERT(Splice(p1.read, null, 100, 0)==3);
+	ASSERT(Splice(null, p2.write, 7, 0)==7);
+	ASSERT(Read(p2.read, buffer, sizeof(buffer))==7);
+
+	/* A non-blocking Splice from a device fills a pipe, without losing data */
+	pipe_t p3;
+	ASSERT(PipeEx(&p3, 4096, 0)==0);
+	int n, total = 0;
+	while((n = Splice(null, p3.write, 1000, SPLICE_NONBLOCK)) > 0)
+		total += n;
+	ASSERT(n==WOULDBLOCK && total==4096);
+	while(total > 0 && (n = Read(p3.read, buffer, sizeof(buffer))) > 0)
+		total -= n;
+	ASSERT(total==0);
+	Close(p3.read);
+	Close(p3.write);
+
+	/* End of data */
+	Close(p1.write);
+	ASSERT(Splice(p1.read, p2.write, 10, 0)==0);
+	ASSERT(Tee(p1.read, p2.write, 10, 0)==0);
+
+	/* Closed reader */
+	Close(p2.read);
+	ASSERT(Splice(null, p2.write, 10, 0)==-1);
+
+	Close(p1.read);
+	Close(p2.write);
+	Close(null);
+	return 0;
+}
+
+
+BOOT_TEST(test_pipe_segmented_zero_copy,
+	"Test that ReadZC and ReleaseZC lend out the segments of a segmented pipe."
+	)
+{
+	pipe_t pipe, ring;
+	ASSERT(PipeEx(&pipe, 64*1024, 4)==-1);
+	ASSERT(PipeEx(&pipe, 64*1024, PIPE_SEGMENTED|PIPE_MESSAGE)==-1);
+	ASSERT(PipeEx(&pipe, 64*1024, PIPE_SEGMENTED)==0);
+	ASSERT(Pipe(&ring)==0);
+
+	const char* data;
+	static char buffer[16*1024];
+	for(unsigned int i=0; i<sizeof(buffer); i++) buffer[i] = i % 251;
+
+	/* Only segmented pipes can be read in place */
+	ASSERT(ReadZC(ring.read, &data, 10)==-1);
+	ASSERT(ReadZC(pipe.write, &data, 10)==-1);
+
+	/* Small writes are packed together */
+	ASSERT(Write(pipe.write, "hello ", 6)==6);
+	ASSERT(Write(pipe.write, "world", 5)==5);
+	ASSERT(ReadZC(pipe.read, &data, 100)==11);
+	ASSERT(memcmp(data, "hello world", 11)==0);
+
+	/* Large writes get a segment of their own, which can be lent out in parts */
+	ASSERT(Write(pipe.write, "x", 1)==1);
+	ASSERT(Write(pipe.write, buffer, sizeof(buffer))==sizeof(buffer));
+	const char* x;
+	ASSERT(ReadZC(pipe.read, &x, 100)==1 && *x=='x');
+	const char* d1;
+	const char* d2;
+	ASSERT(ReadZC(pipe.read, &d1, 1000)==1000);
+	ASSERT(ReadZC(pipe.read, &d2, sizeof(buffer))==sizeof(buffer)-1000);
+	ASSERT(memcmp(d1, buffer, 1000)==0);
+	ASSERT(memcmp(d2, buffer+1000, sizeof(buffer)-1000)==0);
+
+	/* The lent data stays valid while more data passes through the pipe */
+	ASSERT(Write(pipe.write, buffer, 100)==100);
+	char small[100];
+	ASSERT(Read(pipe.read, small, sizeof(small))==100);
+	ASSERT(memcmp(small, buffer, 100)==0);
+	ASSERT(memcmp(data, "hello world", 11)==0);
+
+	ASSERT(ReleaseZC(pipe.read, data)==0);
+	ASSERT(ReleaseZC(pipe.read, x)==0);
+	ASSERT(ReleaseZC(pipe.read, d1)==0);
+	/* d2 is in the same segment, which stays in use */
+	ASSERT(ReleaseZC(pipe.read, d1)==-1);
+	ASSERT(ReleaseZC(pipe.read, d2+1)==-1);
+	ASSERT(memcmp(d2, buffer+1000, sizeof(buffer)-1000)==0);
+	ASSERT(ReleaseZC(pipe.read, d2)==0);
+	ASSERT(ReleaseZC(pipe.read, d2)==-1);
+	ASSERT(ReleaseZC(pipe.read, small)==-1);
+
+	/* Unreleased data counts against the limit of the pipe */
+	pipe_t sp;
+	ASSERT(PipeEx(&sp, 4096, PIPE_SEGMENTED)==0);
+	ASSERT(SetFlags(sp.read, FID_NONBLOCK)==0);
+	ASSERT(SetFlags(sp.write, FID_NONBLOCK)==0);
+	ASSERT(Write(sp.write, buffer, 4096)==4096);
+	const char* lease[64];
+	int leases = 0, total = 0, n;
+	while(leases < 64 && (n = ReadZC(sp.read, &lease[leases], 4096)) > 0) {
+		leases++;
+		total += n;
+	}
+	ASSERT(total==4096);
+	ASSERT(Write(sp.write, buffer, 10)==WOULDBLOCK);
+	for(int i=0; i<leases; i++)
+		ASSERT(ReleaseZC(sp.read, lease[i])==0);
+	ASSERT(Write(sp.write, buffer, 10)==10);
+	Close(sp.read);
+	Close(sp.write);
+
+	/* Non-blocking and end of data */
+	ASSERT(SetFlags(pipe.read, FID_NONBLOCK)==0);
+	ASSERT(ReadZC(pipe.read, &data, 100)==WOULDBLOCK);
+	ASSERT(Write(pipe.write, "abc", 3)==3);
+	Close(pipe.write);
+	ASSERT(ReadZC(pipe.read, &data, 100)==3);
+	ASSERT(ReadZC(pipe.read, &data, 100)==0);
+
+	/* Unreleased data is freed with the pipe */
+	Close(pipe.read);
+	Close(ring.read);
+	Close(ring.write);
+	return 0;
+}
+
+
+BOOT_TEST(test_pipe_message_mode,
+	"Test that a PIPE_MESSAGE pipe preserves message boundaries, also with ReadV and WriteV."
+	)
+{
+	pipe_t pipe;
+	ASSERT(PipeEx(&pipe, 1024, PIPE_MESSAGE)==0);
+	ASSERT(SetFlags(pipe.write, FID_NONBLOCK)==0);
+
+	char buffer[2048];
+	memset(buffer, 'x', sizeof(buffer));
+
+	/* Messages larger than the buffer are rejected, empty ones are not sent */
+	ASSERT(Write(pipe.write, buffer, 1024)==-1);
+	ASSERT(Write(pipe.write, buffer, 0)==0);
+
+	/* Each message is delivered whole */
+	ASSERT(Write(pipe.write, "hello", 5)==5);
+	ASSERT(Write(pipe.write, "world!", 6)==6);
+
+	/* An empty read takes no message */
+	ASSERT(Read(pipe.read, buffer, 0)==0);
+	ASSERT(Read(pipe.read, buffer, sizeof(buffer))==5);
+	ASSERT(memcmp(buffer, "hello", 5)==0);
+
+	/* A message that does not fit is truncated */
+	ASSERT(Read(pipe.read, buffer, 3)==3);
+	ASSERT(memcmp(buffer, "wor", 3)==0);
+
+	/* A message is written all or nothing */
+	ASSERT(Write(pipe.write, buffer, 600)==600);
+	ASSERT(Write(pipe.write, buffer, 600)==WOULDBLOCK);
+	ASSERT(Read(pipe.read, buffer, sizeof(buffer))==600);
+
+	/* Gather a header and a body into one message, and scatter it back */
+	int header = 4;
+	iovec_t out[3] = { { &header, sizeof(header) }, { "", 0 }, { "body", 4 } };
+	ASSERT(WriteV(pipe.write, out, 3)==sizeof(header)+4);
+	ASSERT(Write(pipe.write, "next", 4)==4);
+
+	int rheader = 0;
+	char body[16];
+	iovec_t in[2] = { { &rheader, sizeof(rheader) }, { body, sizeof(body) } };
+	ASSERT(ReadV(pipe.read, in, 2)==sizeof(header)+4);
+	ASSERT(rheader==4 && memcmp(body, "body", 4)==0);
+	ASSERT(ReadV(pipe.read, in, 2)==4);
+	ASSERT(memcmp(&rheader, "next", 4)==0);
+
+	/* Bad vectors */
+	ASSERT(ReadV(pipe.read, in, -1)==-1);
+	ASSERT(WriteV(pipe.write, out, MAX_IOVEC+1)==-1);
+	ASSERT(WriteV(pipe.read, out, 3)==-1);
+
+	/* Messages cannot be spliced */
+	pipe_t other;
+	ASSERT(Pipe(&other)==0);
+	ASSERT(Splice(pipe.read, other.write, 100, SPLICE_NONBLOCK)==-1);
+
+	Close(pipe.write);
+	ASSERT(Read(pipe.read, buffer, sizeof(buffer))==0);
+	Close(pipe.read);
+	Close(other.read);
+	Close(other.write);
+	return 0;
+}
+
+
+BOOT_TEST(test_socket_message_mode,
+	"Test that SOCKOPT_MESSAGE connections preserve message boundaries."
+	)
+{
+	Fid_t lsock = Socket(100);
+	ASSERT(SetSockOpt(lsock, SOCKOPT_MESSAGE, 2)==-1);
+	ASSERT(SetSockOpt(lsock, SOCKOPT_MESSAGE, 1)==0);
+	ASSERT(Listen(lsock)==0);
+
+	/* A stream socket cannot connect to a message listener */
+	Fid_t cli = Socket(NOPORT), srv;
+	ASSERT(Connect(cli, 100, 10)==-1);
+	ASSERT(SetSockOpt(cli, SOCKOPT_MESSAGE, 1)==0);
+	connect_sockets(cli, lsock, &srv, 100);
+	ASSERT(SetSockOpt(cli, SOCKOPT_MESSAGE, 0)==-1);
+
+	char buffer[64];
+	ASSERT(Write(cli, "one", 3)==3);
+	ASSERT(Write(cli, "two", 3)==3);
+	ASSERT(Read(srv, buffer, sizeof(buffer))==3);
+	ASSERT(Read(srv, buffer, sizeof(buffer))==3);
+	ASSERT(memcmp(buffer, "two", 3)==0);
+
+	iovec_t out[2] = { { "re", 2 }, { "ply", 3 } };
+	ASSERT(WriteV(srv, out, 2)==5);
+	ASSERT(Read(cli, buffer, sizeof(buffer))==5);
+	ASSERT(memcmp(buffer, "reply", 5)==0);
+	return 0;
+}
+
+
+BOOT_TEST(test_readv_writev_streams,
+	"Test ReadV and WriteV on byte streams, natively and by the fallback."
+	)
+{
+	pipe_t pipe;
+	ASSERT(Pipe(&pipe)==0);
+
+	iovec_t out[2] = { { "hello ", 6 }, { "world", 5 } };
+	ASSERT(WriteV(pipe.write, out, 2)==11);
+
+	/* Byte streams fill each buffer before the next */
+	char a[4], b[16];
+	iovec_t in[2] = { { a, sizeof(a) }, { b, sizeof(b) } };
+	ASSERT(ReadV(pipe.read, in, 2)==11);
+	ASSERT(memcmp(a, "hell", 4)==0 && memcmp(b, "o world", 7)==0);
+
+	/* The null device */
+	Fid_t null = OpenNull();
+	ASSERT(WriteV(null, out, 2)==11);
+	memset(a, 1, sizeof(a));
+	ASSERT(ReadV(null, in, 2)==sizeof(a)+sizeof(b));
+	ASSERT(a[0]==0);
+
+	/* Info streams have no native ReadV, and read one record per buffer */
+	Pid_t child = Exec(void_child, 0, NULL);
+	Fid_t info = OpenInfo();
+	procinfo pi[2];
+	iovec_t piv[2] = { { &pi[0], sizeof(procinfo) }, { &pi[1], sizeof(procinfo) } };
+	ASSERT(ReadV(info, piv, 2)==2*sizeof(procinfo));
+	ASSERT(pi[0].pid != pi[1].pid);
+	ASSERT(WaitChild(child, NULL)==child);
+
+	Close(info);
+	Close(null);
+	Close(pipe.read);
+	Close(pipe.write);
+	return 0;
+}
+
+
+#define SEQUENCE_SIZE  (1<<20)
+#define MESSAGE_WRITERS  4
+#define MESSAGE_READERS  3
+
+/* Write bytes 0..SEQUENCE_SIZE-1 (mod 251) to fid, in chunks of varying size */
+static void write_sequence(Fid_t fid)
+{
+	char buffer[3000];
+	unsigned int sent = 0, chunk = 1;
+	while(sent < SEQUENCE_SIZE) {
+		unsigned int n = (chunk < SEQUENCE_SIZE - sent) ? chunk : SEQUENCE_SIZE - sent;
+		for(unsigned int i = 0; i < n; i++)
+			buffer[i] = (sent + i) % 251;
+		ASSERT(Write(fid, buffer, n)==n);
+		sent += n;
+		chunk = (chunk * 7 + 3) % sizeof(buffer) + 1;
+	}
+}
+
+/* Read the bytes written by write_sequence from fid, in chunks of varying size, until EOF */
+static void read_sequence(Fid_t fid)
+{
+	char buffer[4096];
+	unsigned int count = 0, chunk = 1, errors = 0;
+	int rc;
+	while((rc = Read(fid, buffer, chunk)) > 0) {
+		for(int i = 0; i < rc; i++)
+			if(buffer[i] != (char) ((count + i) % 251))
+				errors++;
+		count += rc;
+		chunk = (chunk * 13 + 5) % sizeof(buffer) + 1;
+	}
+	ASSERT(rc==0 && count==SEQUENCE_SIZE && errors==0);
+}
+
+/* Write the sequence to fid 'argl' and close it */
+static int sequence_writer(int argl, void* args)
+{
+	write_sequence(argl);
+	Close(argl);
+	return 0;
+}
+
+/* Arguments of the message readers and writers */
+struct message_args {
+	Fid_t fid;
+	int id;				/* writer id */
+	int count;			/* messages to write */
+	int received;		/* messages read */
+};
+
+/* Write messages (id, 0), (id, 1), ... */
+static int message_writer(int argl, void* args)
+{
+	struct message_args* A = args;
+	for(int i = 0; i < A->count; i++) {
+		int msg[2] = { A->id, i };
+		ASSERT(Write(A->fid, (char*) msg, sizeof(msg))==sizeof(msg));
+	}
+	return 0;
+}
+
+/* Read messages until EOF, checking that the messages of each writer arrive in order */
+static int message_reader(int argl, void* args)
+{
+	struct message_args* A = args;
+	int last[MESSAGE_WRITERS];
+	for(int i = 0; i < MESSAGE_WRITERS; i++)
+		last[i] = -1;
+
+	int msg[2], rc;
+	while((rc = Read(A->fid, (char*) msg, sizeof(msg))) > 0) {
+		ASSERT(rc==sizeof(msg) && msg[0] >= 0 && msg[0] < MESSAGE_WRITERS);
+		ASSERT(msg[1] > last[msg[0]]);
+		last[msg[0]] = msg[1];
+		A->received++;
+	}
+	ASSERT(rc==0);
+	return 0;
+}
+
+
+BOOT_TEST(test_pipe_concurrent_io,
+	"Test that pipes deliver data intact to concurrent readers and writers. Run it on several cores, e.g. with -c 4.",
+	.timeout = 60
+	)
+{
+	/* A single reader and writer stream a byte sequence */
+	pipe_t pipe;
+	ASSERT(Pipe(&pipe)==0);
+	Tid_t t = CreateThread(sequence_writer, pipe.write, NULL);
+	read_sequence(pipe.read);
+	ASSERT(ThreadJoin(t, NULL)==0);
+	Close(pipe.read);
+
+	/* Several readers and writers share a small message pipe */
+	ASSERT(PipeEx(&pipe, PIPE_MIN_SIZE, PIPE_MESSAGE)==0);
+
+	struct message_args W[MESSAGE_WRITERS], R[MESSAGE_READERS];
+	Tid_t wt[MESSAGE_WRITERS], rt[MESSAGE_READERS];
+	for(int i = 0; i < MESSAGE_READERS; i++) {
+		R[i] = (struct message_args) { pipe.read, 0, 0, 0 };
+		rt[i] = CreateThread(message_reader, 0, &R[i]);
+	}
+	for(int i = 0; i < MESSAGE_WRITERS; i++) {
+		W[i] = (struct message_args) { pipe.write, i, 5000, 0 };
+		wt[i] = CreateThread(message_writer, 0, &W[i]);
+	}
+
+	for(int i = 0; i < MESSAGE_WRITERS; i++)
+		ASSERT(ThreadJoin(wt[i], NULL)==0);
+	Close(pipe.write);
+
+	int received = 0;
+	for(int i = 0; i < MESSAGE_READERS; i++) {
+		ASSERT(ThreadJoin(rt[i], NULL)==0);
+		received += R[i].received;
+	}
+	ASSERT(received == MESSAGE_WRITERS * 5000);
+
+	Close(pipe.read);
+	return 0;
+}
+
+
+/* Write the sequence to socket 'argl' and shut down its write direction */
+static int sequence_sender(int argl, void* args)
+{
+	write_sequence(argl);
+	ASSERT(ShutDown(argl, SHUTDOWN_WRITE)==0);
+	return 0;
+}
+
+/* Read the sequence from fid 'argl' */
+static int sequence_receiver(int argl, void* args)
+{
+	read_sequence(argl);
+	return 0;
+}
+
+
+BOOT_TEST(test_socket_concurrent_io,
+	"Test that a socket delivers data intact in both directions at once, with a thread on each end of each direction. Run it on several cores, e.g. with -c 4.",
+	.timeout = 60
+	)
+{
+	Fid_t lsock = Socket(100), cli = Socket(NOPORT), srv;
+	ASSERT(Listen(lsock)==0);
+	connect_sockets(cli, lsock, &srv, 100);
+
+	Tid_t t[3];
+	t[0] = CreateThread(sequence_sender, cli, NULL);
+	t[1] = CreateThread(sequence_sender, srv, NULL);
+	t[2] = CreateThread(sequence_receiver, cli, NULL);
+	read_sequence(srv);
+	for(int i = 0; i < 3; i++)
+		ASSERT(ThreadJoin(t[i], NULL)==0);
+
+	/* Both directions are shut down, but the sockets are still open */
+	char c;
+	ASSERT(Read(srv, &c, 1)==0 && Write(srv, &c, 1)==-1);
+	Close(cli);
+	Close(srv);
+	Close(lsock);
+	return 0;
+}
+
+
+/* Find the pool of the given name, return 1 if found */
+static int find_pool(const char* name, pool_stats* stats)
+{
+	for(unsigned int i = 0; PoolStats(i, stats)==0; i++)
+		if(strcmp(stats->name, name)==0)
+			return 1;
+	return 0;
+}
+
+static int connect_to_closed_listener(int argl, void* args)
+{
+	Fid_t sock = Socket(NOPORT);
+	ASSERT(Connect(sock, 100, 100000)==NOFILE);
+	Close(sock);
+	return 0;
+}
+
+
+BOOT_TEST(test_pool_stats,
+	"Test that pipes, sockets, connections, connection requests and FCBs are allocated from pools, and returned to them."
+	)
+{
+	pool_stats ps;
+	ASSERT(PoolStats(0, NULL)==-1);
+	ASSERT(PoolStats(1000, &ps)==-1);
+
+	/* A pipe */
+	pipe_t pipe;
+	ASSERT(Pipe(&pipe)==0);
+	ASSERT(find_pool("pipeCB", &ps));
+	ASSERT(ps.in_use==1 && ps.allocs==1 && ps.slabs==1 && ps.object_size > 0);
+	ASSERT(find_pool("pipe buffer 512", &ps) && ps.in_use==1);
+	Close(pipe.read);
+	Close(pipe.write);
+	ASSERT(find_pool("pipeCB", &ps) && ps.in_use==0 && ps.peak==1 && ps.cached > 0);
+
+	/* A connection, and a request that times out */
+	Fid_t lsock = Socket(100), cli = Socket(NOPORT), srv;
+	ASSERT(Listen(lsock)==0);
+	ASSERT(Connect(cli, 100, 10)==NOFILE);
+	ASSERT(find_pool("connection_request", &ps) && ps.in_use==0 && ps.allocs==1);
+
+	connect_sockets(cli, lsock, &srv, 100);
+	ASSERT(find_pool("socketCB", &ps) && ps.in_use==3);
+	ASSERT(find_pool("connection", &ps) && ps.in_use==1);
+	ASSERT(find_pool("pipeCB", &ps) && ps.in_use==0);
+	ASSERT(find_pool("connection_request", &ps) && ps.in_use==0 && ps.allocs==2);
+	check_transfer(cli, srv);
+	Close(cli);
+	ASSERT(find_pool("connection", &ps) && ps.in_use==1);
+	Close(srv);
+	ASSERT(find_pool("connection", &ps) && ps.in_use==0 && ps.slabs==1);
+
+	/* Closing the listener refuses the pending requests */
+	Tid_t t = CreateThread(connect_to_closed_listener, 0, NULL);
+	Mutex mx = MUTEX_INIT;
+	CondVar cv = COND_INIT;
+	Mutex_Lock(&mx);
+	while(find_pool("connection_request", &ps) && ps.in_use==0)
+		Cond_TimedWait(&mx, &cv, 10);
+	Mutex_Unlock(&mx);
+	Close(lsock);
+	ASSERT(ThreadJoin(t, NULL)==0);
+	ASSERT(find_pool("connection_request", &ps) && ps.in_use==0);
+	ASSERT(find_pool("socketCB", &ps) && ps.in_use==0);
+
+	/* FCBs, through the per-core caches of their pool */
+	pool_stats before;
+	ASSERT(find_pool("FCB", &before));
+	ASSERT(SetFileLimit(256)==0);
+	Fid_t fid[200];
+	for(int i=0; i<200; i++)
+		ASSERT((fid[i] = OpenNull()) != NOFILE);
+	ASSERT(find_pool("FCB", &ps) && ps.in_use==before.in_use+200 && ps.allocs==before.allocs+200);
+	for(int i=0; i<200; i++)
+		ASSERT(Close(fid[i])==0);
+	ASSERT(find_pool("FCB", &ps) && ps.in_use==before.in_use && ps.cached >= 200);
+	return 0;
+}
+
+
+/* Connect a new socket to port 'argl', and close it */
+static int connect_and_close(int argl, void* args)
+{
+	Fid_t sock = Socket(NOPORT);
+	ASSERT(Connect(sock, argl, 10000)==0);
+	Close(sock);
+	return 0;
+}
+
+/* Accept a connection on lsock 'argl', and close it */
+static int accept_and_close(int argl, void* args)
+{
+	Fid_t sock = Accept(argl);
+	ASSERT(sock != NOFILE);
+	Close(sock);
+	return 0;
+}
+
+/* Wait a little, to let other threads block */
+static void pause_msec(timeout_t msec)
+{
+	Mutex mx = MUTEX_INIT;
+	CondVar cv = COND_INIT;
+	Mutex_Lock(&mx);
+	Cond_TimedWait(&mx, &cv, msec);
+	Mutex_Unlock(&mx);
+}
+
+
+BOOT_TEST(test_socket_reuseport,
+	"Test 64K ports, and several listeners sharing a port with SOCKOPT_REUSEPORT."
+	)
+{
+	/* The whole port range can be used */
+	Fid_t lsock = Socket(MAX_PORT), cli, srv;
+	ASSERT(Listen(lsock)==0);
+	connect_sockets(cli = Socket(NOPORT), lsock, &srv, MAX_PORT);
+	check_transfer(cli, srv);
+	Close(cli); Close(srv); Close(lsock);
+
+	/* Sharing a port needs SOCKOPT_REUSEPORT on every listener */
+	Fid_t l1 = Socket(200), l2 = Socket(200), l3 = Socket(200);
+	ASSERT(SetSockOpt(l1, SOCKOPT_REUSEPORT, 2)==-1);
+	ASSERT(SetSockOpt(l1, SOCKOPT_REUSEPORT, 1)==0);
+	ASSERT(Listen(l1)==0);
+	ASSERT(SetSockOpt(l1, SOCKOPT_REUSEPORT, 0)==-1);
+	ASSERT(Listen(l2)==-1);
+	ASSERT(SetSockOpt(l2, SOCKOPT_REUSEPORT, 1)==0);
+	ASSERT(Listen(l2)==0);
+	Close(l3);
+
+	/* Pending requests are spread evenly over the listeners */
+	ASSERT(SetFlags(l1, FID_NONBLOCK)==0 && SetFlags(l2, FID_NONBLOCK)==0);
+	Tid_t t[4];
+	for(int i = 0; i < 4; i++)
+		t[i] = CreateThread(connect_and_close, 200, NULL);
+	pool_stats ps;
+	while(find_pool("connection_request", &ps) && ps.in_use < 4)
+		pause_msec(10);
+
+	int accepted[2] = { 0, 0 };
+	Fid_t sock;
+	while((sock = Accept(l1)) != NOFILE) { accepted[0]++; Close(sock); }
+	while((sock = Accept(l2)) != NOFILE) { accepted[1]++; Close(sock); }
+	ASSERT(accepted[0]==2 && accepted[1]==2);
+	for(int i = 0; i < 4; i++)
+		ASSERT(ThreadJoin(t[i], NULL)==0);
+
+	/* A listener with a blocked acceptor is preferred */
+	ASSERT(SetFlags(l2, 0)==0);
+	for(int i = 0; i < 3; i++) {
+		Tid_t a = CreateThread(accept_and_close, l2, NULL);
+		pause_msec(20);
+		ASSERT(connect_and_close(200, NULL)==0);
+		ASSERT(ThreadJoin(a, NULL)==0);
+	}
+
+	/* Closing a listener wakes up all its acceptors, and frees it */
+	Tid_t a1 = CreateThread(unblocking_accept_connection, l2, NULL);
+	Tid_t a2 = CreateThread(unblocking_accept_connection, l2, NULL);
+	pause_msec(20);
+	Close(l2);
+	ASSERT(ThreadJoin(a1, NULL)==0 && ThreadJoin(a2, NULL)==0);
+	Close(l1);
+	ASSERT(find_pool("socketCB", &ps) && ps.in_use==0);
+	ASSERT(find_pool("port_entry", &ps) && ps.in_use==0);
+	return 0;
+}
+
+
+/* Connect a new socket to port 'argl', and read until the other side closes */
+static int connect_and_drain(int argl, void* args)
+{
+	Fid_t sock = Socket(NOPORT);
+	ASSERT(Connect(sock, argl, 10000)==0);
+	char buf[16];
+	while(Read(sock, buf, sizeof(buf)) > 0);
+	Close(sock);
+	return 0;
+}
+
+/* Wait until listener 'lsock' has 'pending' requests */
+static void wait_pending(Fid_t lsock, unsigned int pending)
+{
+	listen_stats ls;
+	while(ListenStats(lsock, &ls)==0 && ls.pending < pending)
+		pause_msec(10);
+}
+
+
+BOOT_TEST(test_listen_backlog,
+	"Test the backlog of ListenEx, the statistics of ListenStats and AcceptBatch."
+	)
+{
+	Fid_t lsock = Socket(300), cli = Socket(NOPORT);
+	listen_stats ls;
+	ASSERT(ListenEx(lsock, 0)==-1);
+	ASSERT(ListenEx(lsock, MAX_BACKLOG+1)==-1);
+	ASSERT(ListenStats(lsock, &ls)==-1);
+	ASSERT(ListenEx(lsock, 2)==0);
+	ASSERT(ListenStats(lsock, NULL)==-1);
+	ASSERT(ListenStats(lsock, &ls)==0);
+	ASSERT(ls.backlog==2 && ls.pending==0 && ls.accepted==0 && ls.rejected==0);
+
+	/* A full queue refuses requests at once */
+	Tid_t t1 = CreateThread(connect_and_drain, 300, NULL);
+	Tid_t t2 = CreateThread(connect_and_drain, 300, NULL);
+	wait_pending(lsock, 2);
+	ASSERT(Connect(cli, 300, -1)==NOFILE);
+	ASSERT(ListenStats(lsock, &ls)==0);
+	ASSERT(ls.pending==2 && ls.peak==2 && ls.rejected==1);
+
+	/* A batch takes all the pending requests, and sets their flags */
+	Fid_t socks[4];
+	ASSERT(AcceptBatch(lsock, socks, 4, 2)==NOFILE);
+	ASSERT(AcceptBatch(lsock, NULL, 4, 0)==NOFILE);
+	ASSERT(AcceptBatch(lsock, socks, 0, 0)==NOFILE);
+	ASSERT(AcceptBatch(lsock, socks, 4, FID_NONBLOCK)==2);
+	char c;
+	ASSERT(Read(socks[0], &c, 1)==WOULDBLOCK && Read(socks[1], &c, 1)==WOULDBLOCK);
+	Close(socks[0]);
+	Close(socks[1]);
+	ASSERT(ThreadJoin(t1, NULL)==0 && ThreadJoin(t2, NULL)==0);
+	ASSERT(ListenStats(lsock, &ls)==0);
+	ASSERT(ls.pending==0 && ls.peak==2 && ls.accepted==2 && ls.rejected==1);
+
+	/* A non-blocking listener with no requests */
+	ASSERT(SetFlags(lsock, FID_NONBLOCK)==0);
+	ASSERT(AcceptBatch(lsock, socks, 4, 0)==NOFILE);
+	Close(lsock);
+
+	/* Listeners sharing a port take requests while their queues have room */
+	Fid_t l1 = Socket(301), l2 = Socket(301);
+	ASSERT(SetSockOpt(l1, SOCKOPT_REUSEPORT, 1)==0 && SetSockOpt(l2, SOCKOPT_REUSEPORT, 1)==0);
+	ASSERT(ListenEx(l1, 1)==0 && ListenEx(l2, 1)==0);
+	t1 = CreateThread(connect_and_drain, 301, NULL);
+	t2 = CreateThread(connect_and_drain, 301, NULL);
+	wait_pending(l1, 1);
+	wait_pending(l2, 1);
+	ASSERT(Connect(cli, 301, 10000)==NOFILE);
+
+	listen_stats ls2;
+	ASSERT(ListenStats(l1, &ls)==0 && ListenStats(l2, &ls2)==0);
+	ASSERT(ls.rejected + ls2.rejected == 1);
+	ASSERT(AcceptBatch(l1, socks, 4, 0)==1 && AcceptBatch(l2, socks+1, 4, 0)==1);
+	Close(socks[0]);
+	Close(socks[1]);
+	ASSERT(ThreadJoin(t1, NULL)==0 && ThreadJoin(t2, NULL)==0);
+	Close(l1);
+	Close(l2);
+	Close(cli);
+
+	pool_stats ps;
+	ASSERT(find_pool("socketCB", &ps) && ps.in_use==0);
+	ASSERT(find_pool("connection_request", &ps) && ps.in_use==0);
+	return 0;
+}
+
+
+/* Write 5 bytes to socket 'argl', and 5 more a little later */
+static int write_in_two(int argl, void* args)
+{
+	ASSERT(Write(argl, "01234", 5)==5);
+	pause_msec(20);
+	ASSERT(Write(argl, "56789", 5)==5);
+	return 0;
+}
+
+
+BOOT_TEST(test_socket_options,
+	"Test GetSockOpt, and the SOCKOPT_RCVLOWAT, SOCKOPT_RCVTIMEO and SOCKOPT_SNDTIMEO options."
+	)
+{
+	Fid_t lsock = Socket(100), cli = Socket(NOPORT), srv;
+	unsigned int value;
+
+	/* Defaults and bad arguments */
+	ASSERT(GetSockOpt(lsock, SOCKOPT_RCVLOWAT, &value)==0 && value==1);
+	ASSERT(GetSockOpt(lsock, SOCKOPT_RCVTIMEO, &value)==0 && value==0);
+	ASSERT(GetSockOpt(lsock, SOCKOPT_SNDBUF, &value)==0 && value >= PIPE_MIN_SIZE);
+	ASSERT(GetSockOpt(lsock, SOCKOPT_SNDBUF, NULL)==-1);
+	ASSERT(GetSockOpt(lsock, 0, &value)==-1);
+	ASSERT(GetSockOpt(NOFILE, SOCKOPT_SNDBUF, &value)==-1);
+	ASSERT(SetSockOpt(lsock, SOCKOPT_RCVLOWAT, PIPE_MAX_SIZE+1)==-1);
+
+	/* Accepted sockets inherit the options of the listener */
+	ASSERT(SetSockOpt(lsock, SOCKOPT_RCVLOWAT, 10)==0);
+	ASSERT(SetSockOpt(lsock, SOCKOPT_RCVTIMEO, 50)==0);
+	ASSERT(SetSockOpt(lsock, SOCKOPT_RCVBUF, PIPE_MIN_SIZE)==0);
+	ASSERT(Listen(lsock)==0);
+	connect_sockets(cli, lsock, &srv, 100);
+	ASSERT(GetSockOpt(srv, SOCKOPT_RCVLOWAT, &value)==0 && value==10);
+	ASSERT(GetSockOpt(srv, SOCKOPT_RCVTIMEO, &value)==0 && value==50);
+	ASSERT(GetSockOpt(srv, SOCKOPT_RCVBUF, &value)==0 && value==PIPE_MIN_SIZE);
+	ASSERT(GetSockOpt(cli, SOCKOPT_SNDBUF, &value)==0 && value==PIPE_MIN_SIZE);
+
+	/* A read times out, and returns the data below the low-water mark */
+	char buffer[2*PIPE_MIN_SIZE];
+	ASSERT(Read(srv, buffer, 100)==WOULDBLOCK);
+	ASSERT(Write(cli, buffer, 5)==5);
+	ASSERT(Read(srv, buffer, 100)==5);
+
+	/* A read waits for the low-water mark */
+	ASSERT(SetSockOpt(srv, SOCKOPT_RCVTIMEO, 10000)==0);
+	Tid_t t = CreateThread(write_in_two, cli, NULL);
+	ASSERT(Read(srv, buffer, 100)==10);
+	ASSERT(memcmp(buffer, "0123456789", 10)==0);
+	ASSERT(ThreadJoin(t, NULL)==0);
+
+	/* At EOF, the reader gets what is there */
+	ASSERT(Write(cli, buffer, 3)==3);
+	ASSERT(ShutDown(cli, SHUTDOWN_WRITE)==0);
+	ASSERT(Read(srv, buffer, 100)==3);
+	ASSERT(Read(srv, buffer, 100)==0);
+
+	/* A write times out, returning what it wrote */
+	ASSERT(SetSockOpt(srv, SOCKOPT_SNDTIMEO, 50)==0);
+	ASSERT(SetSockOpt(cli, SOCKOPT_RCVBUF, PIPE_MIN_SIZE)==0);
+	ASSERT(Write(srv, buffer, sizeof(buffer))==PIPE_MIN_SIZE);
+	ASSERT(Write(srv, buffer, sizeof(buffer))==WOULDBLOCK);
+	ASSERT(Read(cli, buffer, sizeof(buffer))==PIPE_MIN_SIZE);
+
+	Close(cli);
+	Close(srv);
+	Close(lsock);
+	return 0;
+}
+
+
+static volatile int corked_read_done;
+
+/* Read once from socket 'argl', and return the number of bytes read */
+static int read_once(int argl, void* args)
+{
+	char buffer[256];
+	int rc = Read(argl, buffer, sizeof(buffer));
+	corked_read_done = 1;
+	return rc;
+}
+
+
+BOOT_TEST(test_socket_cork,
+	"Test that SOCKOPT_CORK holds back the wakeup of a blocked reader, and that SOCKOPT_RCVWAKEUPS counts the wakeups."
+	)
+{
+	Fid_t lsock = Socket(100), cli = Socket(NOPORT), srv;
+	unsigned int value;
+	ASSERT(Listen(lsock)==0);
+	connect_sockets(cli, lsock, &srv, 100);
+
+	ASSERT(GetSockOpt(cli, SOCKOPT_CORK, &value)==0 && value==0);
+	ASSERT(SetSockOpt(cli, SOCKOPT_CORK, PIPE_MAX_SIZE+1)==-1);
+	ASSERT(SetSockOpt(srv, SOCKOPT_RCVWAKEUPS, 0)==-1);
+	ASSERT(GetSockOpt(srv, SOCKOPT_RCVWAKEUPS, &value)==0 && value==0);
+	ASSERT(SetSockOpt(cli, SOCKOPT_CORK, 100)==0);
+
+	/* The reader wakes up once 100 bytes are written */
+	char buffer[100];
+	int rc;
+	corked_read_done = 0;
+	Tid_t t = CreateThread(read_once, srv, NULL);
+	pause_msec(20);
+	ASSERT(Write(cli, buffer, 10)==10);
+	pause_msec(20);
+	ASSERT(corked_read_done==0);
+	ASSERT(Write(cli, buffer, 90)==90);
+	ASSERT(ThreadJoin(t, &rc)==0 && rc >= 10);
+	if(rc < 100)
+		ASSERT(Read(srv, buffer, 100)==100-rc);
+
+	/* Uncorking wakes up the reader */
+	corked_read_done = 0;
+	t = CreateThread(read_once, srv, NULL);
+	pause_msec(20);
+	ASSERT(Write(cli, buffer, 5)==5);
+	pause_msec(20);
+	ASSERT(corked_read_done==0);
+	ASSERT(SetSockOpt(cli, SOCKOPT_CORK, 0)==0);
+	ASSERT(ThreadJoin(t, &rc)==0 && rc==5);
+
+	ASSERT(GetSockOpt(srv, SOCKOPT_RCVWAKEUPS, &value)==0 && value >= 2);
+	Close(cli);
+	Close(srv);
+	Close(lsock);
+	return 0;
+}
+
+
+/* Receive a stream on socket 'argl', and check that it reads "hello" up to EOF */
+static int fid_receiver(int argl, void* args)
+{
+	char buffer[16];
+	Fid_t fid = RecvFid(argl);
+	ASSERT(fid != NOFILE);
+	ASSERT(Read(fid, buffer, sizeof(buffer))==6);
+	ASSERT(strcmp(buffer, "hello")==0);
+	ASSERT(Read(fid, buffer, sizeof(buffer))==0);
+	return 0;
+}
+
+
+BOOT_TEST(test_socket_send_fid,
+	"Test that SendFid and RecvFid pass streams between processes over a connection."
+	)
+{
+	Fid_t lsock = Socket(100), cli = Socket(NOPORT), srv;
+	ASSERT(Listen(lsock)==0);
+	connect_sockets(cli, lsock, &srv, 100);
+
+	/* Bad arguments */
+	pipe_t p;
+	ASSERT(Pipe(&p)==0);
+	ASSERT(SendFid(p.write, p.read)==-1);
+	ASSERT(SendFid(lsock, p.read)==-1);
+	ASSERT(SendFid(cli, NOFILE)==-1);
+	ASSERT(SendFid(cli, MAX_FILEID)==-1);
+	ASSERT(RecvFid(lsock)==NOFILE);
+	ASSERT(RecvFid(p.read)==NOFILE);
+	Close(p.read);
+	Close(p.write);
+
+	/* The sockets of a connection cannot be sent over it */
+	ASSERT(SendFid(cli, cli)==-1);
+	ASSERT(SendFid(cli, srv)==-1);
+
+	/* A non-blocking or timed receive fails when nothing is sent */
+	ASSERT(SetFlags(srv, FID_NONBLOCK)==0);
+	ASSERT(RecvFid(srv)==NOFILE);
+	ASSERT(SetFlags(srv, 0)==0);
+	ASSERT(SetSockOpt(srv, SOCKOPT_RCVTIMEO, 20)==0);
+	ASSERT(RecvFid(srv)==NOFILE);
+	ASSERT(SetSockOpt(srv, SOCKOPT_RCVTIMEO, 0)==0);
+
+	/* A stream opened after Exec is passed to the child, and stays open when the sender closes it */
+	Pid_t pid = Exec(fid_receiver, srv, NULL);
+	ASSERT(pid != NOPROC);
+	ASSERT(Pipe(&p)==0);
+	ASSERT(SendFid(cli, p.read)==0);
+	ASSERT(Close(p.read)==0);
+	ASSERT(Write(p.write, "hello", 6)==6);
+	ASSERT(Close(p.write)==0);
+	int status;
+	ASSERT(WaitChild(pid, &status)==pid && status==0);
+
+	/* Streams are received in order */
+	for(int i=0; i<3; i++) {
+		ASSERT(Pipe(&p)==0);
+		ASSERT(Write(p.write, "abc", i+1)==i+1);
+		ASSERT(SendFid(srv, p.read)==0);
+		Close(p.read);
+		Close(p.write);
+	}
+	for(int i=0; i<3; i++) {
+		char buffer[4];
+		Fid_t fid = RecvFid(cli);
+		ASSERT(fid != NOFILE);
+		ASSERT(Read(fid, buffer, sizeof(buffer))==i+1);
+		Close(fid);
+	}
+
+	/* The queue is limited */
+	Fid_t null = OpenNull();
+	int sent = 0;
+	while(SendFid(cli, null)==0)
+		sent++;
+	ASSERT(sent==MAX_FILEID);
+	for(int i=0; i<sent; i++) {
+		Fid_t fid = RecvFid(srv);
+		ASSERT(fid != NOFILE);
+		Close(fid);
+	}
+
+	/* A socket with queued streams cannot be sent, so connections do not hold each other open */
+	Fid_t cli2 = Socket(NOPORT), srv2;
+	connect_sockets(cli2, lsock, &srv2, 100);
+	ASSERT(SendFid(cli, srv2)==0);
+	ASSERT(SendFid(cli2, srv)==-1);
+	ASSERT(SendFid(cli2, null)==0);
+	Close(srv2);
+	ASSERT((srv2 = RecvFid(srv)) != NOFILE);
+	ASSERT(RecvFid(srv2) != NOFILE);
+
+	/* The streams still queued are closed with the receiver */
+	ASSERT(Pipe(&p)==0);
+	ASSERT(SendFid(cli2, p.read)==0);
+	Close(p.read);
+	Close(srv2);
+	ASSERT(Write(p.write, "x", 1)==-1);
+	Close(p.write);
+
+	/* A receive fails after the other end shuts down writing */
+	ASSERT(ShutDown(cli, SHUTDOWN_WRITE)==0);
+	ASSERT(SendFid(cli, null)==-1);
+	ASSERT(RecvFid(srv)==NOFILE);
+
+	Close(cli2);
+	Close(cli);
+	Close(srv);
+	Close(lsock);
+	return 0;
+}
+
+
+/* Check that the file limit and the fids of the parent were inherited */
+static int file_limit_child(int argl, void* args)
+{
+	ASSERT(GetFileLimit()==256);
+	ASSERT(Write(argl, "x", 1)==1);
+	ASSERT(Write(255, "x", 1)==1);
+	return 0;
+}
+
+
+BOOT_TEST(test_file_limit,
+	"Test that SetFileLimit raises the number of open files, that the lowest free fid is used, and that the limit is inherited."
+	)
+{
+	ASSERT(GetFileLimit()==MAX_FILEID);
+	ASSERT(SetFileLimit(0)==-1);
+	ASSERT(SetFileLimit(MAX_FILE_LIMIT+1)==-1);
+
+	/* Fill the default table */
+	Fid_t fid;
+	while((fid = OpenNull()) != NOFILE)
+		;
+	ASSERT(Close(MAX_FILEID)==-1);
+	ASSERT(Dup2(0, MAX_FILEID)==-1);
+
+	/* Raise the limit, and fill the table again, in order */
+	ASSERT(SetFileLimit(256)==0);
+	ASSERT(GetFileLimit()==256);
+	for(Fid_t f = MAX_FILEID; f < 256; f++)
+		ASSERT(OpenNull()==f);
+	ASSERT(OpenNull()==NOFILE);
+	ASSERT(Close(256)==-1);
+
+	/* The lowest free fid is used first */
+	ASSERT(Close(200)==0);
+	ASSERT(Close(70)==0);
+	ASSERT(Close(130)==0);
+	ASSERT(OpenNull()==70);
+	ASSERT(OpenNull()==130);
+	ASSERT(OpenNull()==200);
+
+	/* The limit cannot go below an open fid */
+	ASSERT(SetFileLimit(100)==-1);
+	for(Fid_t f = 100; f < 256; f++)
+		ASSERT(Close(f)==0);
+	ASSERT(SetFileLimit(100)==0);
+	ASSERT(Dup2(0, 100)==-1);
+	ASSERT(SetFileLimit(256)==0);
+
+	/* Dup2 can use a fid past the end of the table */
+	ASSERT(Dup2(0, 255)==0);
+
+	/* Children inherit the limit and the fids */
+	int status;
+	Pid_t pid = Exec(file_limit_child, 99, NULL);
+	ASSERT(pid != NOPROC);
+	ASSERT(WaitChild(pid, &status)==pid && status==0);
+	return 0;
+}
+
+
+/* Read from null stream 'argl' until it is closed, and return the number of reads */
+static int read_until_closed(int argl, void* args)
+{
+	char buf[16];
+	int reads = 0;
+	while(Read(argl, buf, sizeof(buf))==sizeof(buf))
+		reads++;
+	return reads;
+}
+
+
+BOOT_TEST(test_close_during_unlocked_read,
+	"Test that closing a null device stream while threads read it without the kernel lock is safe, and that the FCB is freed by the last reader."
+	)
+{
+	pool_stats before, ps;
+	Fid_t fid = OpenNull();
+	ASSERT(fid != NOFILE);
+	ASSERT(find_pool("FCB", &before));
+
+	Tid_t t[4];
+	for(int i=0; i<4; i++)
+		t[i] = CreateThread(read_until_closed, fid, NULL);
+	pause_msec(20);
+	ASSERT(Close(fid)==0);
+
+	int reads;
+	for(int i=0; i<4; i++)
+		ASSERT(ThreadJoin(t[i], &reads)==0 && reads >= 0);
+	ASSERT(Read(fid, (char*) &reads, 1)==-1);
+	ASSERT(find_pool("FCB", &ps) && ps.in_use==before.in_use-1);
+	return 0;
+}
+
+
+/* A thread that just returns */
+static int return_argl(int argl, void* args)
+{
+	return argl;
+}
+
+/* Change the file table shared with the parent, and send back the arguments */
+static int shared_table_child(int argl, void* args)
+{
+	pipe_t* p = args;
+	ASSERT(Close(p->read)==0);
+	ASSERT(OpenNull()==p->read);
+	ASSERT(Write(p->write, args, argl)==argl);
+	ASSERT(Close(p->write)==0);
+
+	/* Leave some PTCBs to be freed with the process */
+	Tid_t t = CreateThread(return_argl, 1, NULL);
+	ASSERT(ThreadDetach(t)==0);
+	CreateThread(return_argl, 2, NULL);
+	return 0;
+}
+
+BOOT_TEST(test_shared_file_table,
+	"Test that a child shares the file table of its parent until one of them changes it, that small and large arguments are passed, and that the PTCBs of a process are freed."
+	)
+{
+	pool_stats before, ps;
+	ASSERT(find_pool("PTCB", &before));
+
+	unsigned int sizes[] = { sizeof(pipe_t), 64, 65, 1000 };
+	for(int i=0; i<4; i++) {
+		char args[1000], buf[1000];
+		pipe_t p;
+		ASSERT(Pipe(&p)==0);
+		memset(args, 'a'+i, sizeof(args));
+		memcpy(args, &p, sizeof(p));
+
+		/* The child changes its table before or after the parent does */
+		Pid_t pid = Exec(shared_table_child, sizes[i], args);
+		ASSERT(pid != NOPROC);
+		if(i%2) ASSERT(Close(p.write)==0);
+		int status;
+		ASSERT(WaitChild(pid, &status)==pid && status==0);
+		if(i%2==0) ASSERT(Close(p.write)==0);
+
+		/* The read end of the parent is still open; the write ends are all closed */
+		ASSERT(Read(p.read, buf, sizeof(buf))==sizes[i]);
+		ASSERT(memcmp(buf, args, sizes[i])==0);
+		ASSERT(Read(p.read, buf, sizeof(buf))==0);
+		ASSERT(Close(p.read)==0);
+	}
+
+	ASSERT(find_pool("PTCB", &ps) && ps.in_use==before.in_use && ps.allocs==before.allocs+12);
+	return 0;
+}
+
+
+/* Wait for a byte on fid argl */
+static int read_byte(int argl, void* args)
+{
+	char c;
+	return Read(argl, &c, 1);
+}
+
+BOOT_TEST(test_shared_file_table_bounded,
+	"Test that a parent that changes the file table it shares with a child, in a loop, does not keep the old tables."
+	)
+{
+	pipe_t p;
+	ASSERT(Pipe(&p)==0);
+
+	size_t heap = 0;
+	for(int i=0; i<2100; i++) {
+		if(i == 100)
+			heap = mallinfo2().uordblks;
+
+		/* The Close copies the table, which the waiting child still uses */
+		Fid_t fid = OpenNull();
+		Pid_t pid = Exec(read_byte, p.read, NULL);
+		ASSERT(pid != NOPROC);
+		ASSERT(Close(fid)==0);
+		ASSERT(Write(p.write, "x", 1)==1);
+		int status;
+		ASSERT(WaitChild(pid, &status)==pid && status==1);
+	}
+
+	/* A table kept per child would take about 250 KB; the pools of the cores 
+	   may still take a few slabs */
+	ASSERT(mallinfo2().uordblks < heap + 64*1024);
+	Close(p.read);
+	Close(p.write);
+	return 0;
+}
+
+
+/* Write to fid args[2], which Spawn connected to a pipe, and check that the pipe fids args[0..1] are closed */
+static int spawned_writer(int argl, void* args)
+{
+	Fid_t* fid = args;
+	ASSERT(Write(fid[0], "x", 1)==-1);
+	ASSERT(Write(fid[1], "x", 1)==-1);
+	ASSERT(Write(fid[2], "spawned", 7)==7);
+	return 0;
+}
+
+BOOT_TEST(test_spawn_file_actions,
+	"Test that Spawn applies the file actions to the new process only, and creates no process when an action fails."
+	)
+{
+	pipe_t p;
+	ASSERT(Pipe(&p)==0);
+	Fid_t null = OpenNull();
+	ASSERT(null != NOFILE);
+
+	spawn_file_action act[] = {
+		{ SPAWN_DUP2, p.write, null },
+		{ SPAWN_CLOSE, p.write, NOFILE },
+		{ SPAWN_CLOSE, p.read, NOFILE }
+	};
+	Fid_t fids[3] = { p.read, p.write, null };
+	Pid_t pid = Spawn(spawned_writer, sizeof(fids), fids, act, 3);
+	ASSERT(pid != NOPROC);
+	int status;
+	ASSERT(WaitChild(pid, &status)==pid && status==0);
+
+	/* Our fids did not change */
+	ASSERT(Write(null, "x", 1)==1);
+	ASSERT(Close(p.write)==0);
+	char buf[16];
+	ASSERT(Read(p.read, buf, sizeof(buf))==7 && memcmp(buf, "spawned", 7)==0);
+	ASSERT(Read(p.read, buf, sizeof(buf))==0);
+
+	/* Failed actions */
+	spawn_file_action bad_dup = { SPAWN_DUP2, p.write, null };
+	ASSERT(Spawn(spawned_writer, 0, NULL, &bad_dup, 1)==NOPROC);
+	spawn_file_action bad_close = { SPAWN_CLOSE, MAX_FILE_LIMIT, NOFILE };
+	ASSERT(Spawn(spawned_writer, 0, NULL, &bad_close, 1)==NOPROC);
+	spawn_file_action bad_op = { 42, null, null };
+	ASSERT(Spawn(spawned_writer, 0, NULL, &bad_op, 1)==NOPROC);
+	ASSERT(Spawn(spawned_writer, 0, NULL, NULL, 1)==NOPROC);
+	spawn_file_action close_then_fail[] = {
+		{ SPAWN_CLOSE, null, NOFILE },
+		{ SPAWN_CLOSE, p.read, NOFILE },
+		{ SPAWN_DUP2, p.write, null }
+	};
+	ASSERT(Spawn(spawned_writer, 0, NULL, close_then_fail, 3)==NOPROC);
+	ASSERT(WaitChild(NOPROC, NULL)==NOPROC);
+	ASSERT(Write(null, "x", 1)==1);
+	ASSERT(Read(p.read, buf, sizeof(buf))==0);
+	ASSERT(Close(p.read)==0);
+	return 0;
+}
+
+
+/* Read fid 'argl' to the end of file, and exit with argl */
+static int exit_on_eof_status(int argl, void* args)
+{
+	char c;
+	while(Read(argl, &c, 1) > 0)
+		;
+	return argl;
+}
+
+/* Wait for the child with pid 'argl', and return its status */
+static int wait_for_pid(int argl, void* args)
+{
+	int status = -1;
+	ASSERT(WaitChild(argl, &status)==argl);
+	return status;
+}
+
+BOOT_TEST(test_wait_child_by_pid,
+	"Test that threads waiting for different children each get their own child, whatever the order of exit, and that a reaped child cannot be waited for."
+	)
+{
+	/* The children exit in the reverse order of creation */
+	pipe_t p[3];
+	Pid_t pid[3];
+	Tid_t t[3];
+	for(int i=0; i<3; i++) {
+		ASSERT(Pipe(&p[i])==0);
+		spawn_file_action close_write = { SPAWN_CLOSE, p[i].write, NOFILE };
+		pid[i] = Spawn(exit_on_eof_status, p[i].read, NULL, &close_write, 1);
+		ASSERT(pid[i] != NOPROC);
+		Close(p[i].read);
+		t[i] = CreateThread(wait_for_pid, pid[i], NULL);
+	}
+	pause_msec(10);
+	for(int i=2; i>=0; i--) {
+		ASSERT(Close(p[i].write)==0);
+		int status;
+		ASSERT(ThreadJoin(t[i], &status)==0 && status==p[i].read);
+	}
+
+	/* A reaped child is gone */
+	ASSERT(WaitChild(pid[0], NULL)==NOPROC);
+	ASSERT(WaitChild(NOPROC, NULL)==NOPROC);
+	return 0;
+}
+
+
+BOOT_TEST(test_wait_children,
+	"Test that WaitChildren reaps many children in one call, respects its limit and its timeout, and fails without children."
+	)
+{
+	Pid_t pids[8];
+	int status[8];
+	ASSERT(WaitChildren(pids, status, 8, 0)==-1);
+	ASSERT(WaitChildren(NULL, status, 8, 0)==-1);
+
+	/* Five children, that exit when the pipe is closed */
+	pipe_t p;
+	ASSERT(Pipe(&p)==0);
+	spawn_file_action close_write = { SPAWN_CLOSE, p.write, NOFILE };
+	Pid_t child[5];
+	for(int i=0; i<5; i++)
+		ASSERT((child[i] = Spawn(exit_on_eof_status, p.read, NULL, &close_write, 1)) != NOPROC);
+	Close(p.read);
+
+	/* Nobody has exited yet */
+	ASSERT(WaitChildren(pids, status, 8, 0)==0);
+	ASSERT(WaitChildren(pids, status, 8, 20)==0);
+	ASSERT(WaitChildren(pids, status, 0, 20)==-1);
+
+	Close(p.write);
+	int reaped = 0, n;
+	while(reaped < 5) {
+		ASSERT((n = WaitChildren(pids, status, 3, (timeout_t)-1)) > 0 && n <= 3);
+		for(int i=0; i<n; i++) {
+			int found = 0;
+			for(int c=0; c<5; c++)
+				if(child[c]==pids[i]) { found = 1; child[c] = NOPROC; }
+			ASSERT(found && status[i]==p.read);
+		}
+		reaped += n;
+	}
+	ASSERT(reaped == 5);
+	ASSERT(WaitChildren(pids, NULL, 8, (timeout_t)-1)==-1);
+	return 0;
+}
+
+
+static int return_pid(int argl, void* args)
+{
+	return GetPid();
+}
+
+BOOT_TEST(test_pid_reuse,
+	"Test that the pid of a reaped child is not handed out again at once, and that it is stale when its slot in the process table is reused."
+	)
+{
+	int status;
+	Pid_t first = Exec(return_pid, 0, NULL);
+	ASSERT(first != NOPROC);
+	ASSERT(WaitChild(first, &status)==first && status==first);
+
+	/* Create children until the slot of the first is reused */
+	Pid_t pid;
+	int count = 0;
+	while(1) {
+		pid = Exec(return_pid, 0, NULL);
+		ASSERT(pid != NOPROC && pid != first);
+		count++;
+		if(pid % MAX_PROC == first % MAX_PROC) break;
+		ASSERT(WaitChild(pid, NULL)==pid);
+	}
+	ASSERT(count > 100);
+
+	/* The old pid does not reach the new process */
+	ASSERT(WaitChild(first, NULL)==NOPROC);
+	ASSERT(WaitChild(pid, &status)==pid && status==pid);
+	return 0;
+}
+
+
+/* Read all records of an info stream, 'batch' at a time, and return their number */
+static int read_procinfo(Fid_t info, procinfo* pi, int batch)
+{
+	int total = 0, n;
+	while((n = Read(info, (char*) (pi+total), batch*sizeof(procinfo))) > 0) {
+		ASSERT(n % sizeof(procinfo) == 0 && n <= batch*sizeof(procinfo));
+		total += n / sizeof(procinfo);
+	}
+	ASSERT(n == 0);
+	return total;
+}
+
+BOOT_TEST(test_procinfo_filters,
+	"Test that info streams return many records per Read, filter by parent, state and pid range, and survive the exit of the processes they return."
+	)
+{
+	static procinfo pi[16];
+	pipe_t p;
+	ASSERT(Pipe(&p)==0);
+	spawn_file_action close_write = { SPAWN_CLOSE, p.write, NOFILE };
+	Pid_t child[4];
+	for(int i=0; i<3; i++)
+		ASSERT((child[i] = Spawn(exit_on_eof_status, p.read, NULL, &close_write, 1)) != NOPROC);
+	child[3] = Exec(return_pid, 0, NULL);
+	pause_msec(20);
+
+	/* All processes: init and the children */
+	Fid_t info = OpenInfo();
+	ASSERT(Read(info, (char*) pi, sizeof(procinfo)-1)==-1);
+	ASSERT(read_procinfo(info, pi, 16)==5);
+	ASSERT(pi[0].pid==1 && pi[1].pid==child[0] && pi[4].pid==child[3]);
+	Close(info);
+
+	/* By parent, in batches of 3 */
+	procinfo_filter f = { .match = PROCINFO_MATCH_PPID, .ppid = GetPid() };
+	info = OpenInfoEx(&f);
+	ASSERT(read_procinfo(info, pi, 3)==4);
+	for(int i=0; i<4; i++)
+		ASSERT(pi[i].pid==child[i] && pi[i].ppid==GetPid());
+	Close(info);
+
+	/* By state */
+	f.match |= PROCINFO_MATCH_STATE;
+	f.alive = 0;
+	info = OpenInfoEx(&f);
+	ASSERT(read_procinfo(info, pi, 16)==1 && pi[0].pid==child[3] && !pi[0].alive);
+	Close(info);
+
+	/* By pid range */
+	f = (procinfo_filter) { .match = PROCINFO_MATCH_PIDS, .min_pid = child[1], .max_pid = child[2] };
+	info = OpenInfoEx(&f);
+	ASSERT(read_procinfo(info, pi, 16)==2 && pi[0].pid==child[1] && pi[1].pid==child[2]);
+	Close(info);
+
+	f.match = 8;
+	ASSERT(OpenInfoEx(&f)==NOFILE);
+
+	/* The processes exit while the stream is read */
+	info = OpenInfo();
+	ASSERT(Read(info, (char*) pi, 2*sizeof(procinfo))==2*sizeof(procinfo));
+	ASSERT(pi[1].pid==child[0]);
+	Close(p.read);
+	Close(p.write);
+	for(int i=0; i<4; i++)
+		ASSERT(WaitChild(child[i], NULL)==child[i]);
+	ASSERT(read_procinfo(info, pi, 16)==0);
+	Close(info);
+	return 0;
+}
+
+
+/* Spin for 50 msec, then write 128 bytes to fid argl */
+static int spin_and_write(int argl, void* args)
+{
+	TimerDuration start = bios_clock();
+	while(bios_clock() < start + 50000);
+
+	char buf[100] = { 0 };
+	Write(argl, buf, 100);
+	Write(argl, buf, 28);
+	return 0;
+}
+
+BOOT_TEST(test_rusage,
+	"Test that GetRusage and info streams return the CPU time and the I/O of a process."
+	)
+{
+	rusage_t u;
+	ASSERT(GetRusage(NOPROC, &u)==0);
+	ASSERT(GetRusage(GetPid(), NULL)==-1);
+	ASSERT(GetRusage(4711, &u)==-1);
+
+	pipe_t p;
+	ASSERT(Pipe(&p)==0);
+	Pid_t child = Exec(spin_and_write, p.write, NULL);
+	Close(p.write);
+
+	char buf[128];
+	int n = 0, rc;
+	while((rc = Read(p.read, buf, sizeof(buf))) > 0)
+		n += rc;
+	ASSERT(n==128);
+
+	/* The child is a zombie after the EOF */
+	pause_msec(20);
+	ASSERT(GetRusage(child, &u)==0);
+	ASSERT(u.cpu_time >= 30000);
+	ASSERT(u.writes==2 && u.write_bytes==128);
+	ASSERT(u.reads==0 && u.read_bytes==0);
+
+	procinfo pi;
+	procinfo_filter f = { .match = PROCINFO_MATCH_PIDS, .min_pid = child, .max_pid = child };
+	Fid_t info = OpenInfoEx(&f);
+	ASSERT(Read(info, (char*) &pi, sizeof(pi))==sizeof(pi));
+	ASSERT(!pi.alive && pi.usage.cpu_time==u.cpu_time && pi.usage.write_bytes==128);
+	Close(info);
+
+	/* The reads of this process, including the EOF and the info stream */
+	ASSERT(GetRusage(NOPROC, &u)==0);
+	ASSERT(u.read_bytes==128+sizeof(procinfo) && u.reads>=3);
+
+	ASSERT(WaitChild(child, NULL)==child);
+	ASSERT(GetRusage(child, &u)==-1);
+	return 0;
+}
+
+
 TEST_SUITE(user_tests, 
 	"These are tests defined by the user."
 	)
 {
 	&dummy_user_test,
+	&test_pipe_nonblocking,
+	&test_pipe_ex_buffer_size,
+	&test_socket_buffer_options,
+	&test_splice_and_tee,
+	&test_pipe_segmented_zero_copy,
+	&test_pipe_message_mode,
+	&test_socket_message_mode,
+	&test_readv_writev_streams,
+	&test_pipe_concurrent_io,
+	&test_socket_concurrent_io,
+	&test_pool_stats,
+	&test_socket_reuseport,
+	&test_listen_backlog,
+	&test_socket_options,
+	&test_socket_cork,
+	&test_socket_send_fid,
+	&test_file_limit,
+	&test_close_during_unlocked_read,
+	&test_shared_file_table,
+	&test_shared_file_table_bounded,
+	&test_spawn_file_actions,
+	&test_wait_child_by_pid,
+	&test_wait_children,
+	&test_pid_reuse,
+	&test_procinfo_filters,
+	&test_rusage,
 	NULL
 };
 